@@ -0,0 +1,281 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+// Host benchmark of ble_comp. Built and run by `make compbench`.
+//
+// Encodes events the way a sensor publishes them, laid out as pyrinas_codec_encode()
+// does, compresses each one, restores it and compares. Prints the ratio and speed per kind of payload, and
+// exits non zero if any frame does not come back as it went in.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ble_comp.h"
+
+#define FRAMES 20000
+#define FRAME_MAX 300
+
+// CBOR heads used by the event map
+#define CBOR_UINT 0x00
+#define CBOR_NINT 0x20
+#define CBOR_BYTES 0x40
+#define CBOR_MAP 0xa0
+
+static char const *m_topics[] = {"temperature", "humidity", "battery", "accel", "env", "button"};
+
+// A sensor only fills in its own address and RSSI
+static uint8_t const m_peripheral_addr[6] = {0xc3, 0x11, 0x52, 0x7a, 0x0e, 0xd9};
+static uint8_t const m_central_addr[6] = {0};
+
+static size_t cbor_head(uint8_t *p_out, uint8_t major, uint32_t value)
+{
+    if (value < 24)
+    {
+        p_out[0] = major | value;
+        return 1;
+    }
+
+    if (value < 256)
+    {
+        p_out[0] = major | 24;
+        p_out[1] = value;
+        return 2;
+    }
+
+    p_out[0] = major | 25;
+    p_out[1] = value >> 8;
+    p_out[2] = value;
+    return 3;
+}
+
+static size_t cbor_bytes(uint8_t *p_out, uint8_t const *p_data, size_t len)
+{
+    size_t head = cbor_head(p_out, CBOR_BYTES, len);
+    memcpy(&p_out[head], p_data, len);
+    return head + len;
+}
+
+static size_t cbor_int(uint8_t *p_out, int32_t value)
+{
+    return value < 0 ? cbor_head(p_out, CBOR_NINT, -1 - value) : cbor_head(p_out, CBOR_UINT, value);
+}
+
+/**@brief Function for encoding the start of an event map. Same as codec_fast_head_encode().
+ */
+static size_t head_encode(uint8_t *p_out, char const *name)
+{
+    size_t len = 0;
+
+    p_out[len++] = CBOR_MAP | 6;
+    p_out[len++] = 0;
+    len += cbor_bytes(&p_out[len], (uint8_t const *)name, strlen(name));
+    p_out[len++] = 1;
+
+    return len;
+}
+
+/**@brief Function for encoding the end of an event map. Same as codec_fast_tail_encode() with RSSI.
+ */
+static size_t tail_encode(uint8_t *p_out, uint8_t const *p_peripheral_addr, uint8_t const *p_central_addr,
+                          int8_t peripheral_rssi, int8_t central_rssi)
+{
+    size_t len = 0;
+
+    p_out[len++] = 2;
+    len += cbor_bytes(&p_out[len], p_peripheral_addr, 6);
+    p_out[len++] = 3;
+    len += cbor_bytes(&p_out[len], p_central_addr, 6);
+    p_out[len++] = 4;
+    len += cbor_int(&p_out[len], peripheral_rssi);
+    p_out[len++] = 5;
+    len += cbor_int(&p_out[len], central_rssi);
+
+    return len;
+}
+
+/**@brief Function for encoding an event map. Same keys and order as pyrinas_codec_encode().
+ */
+static size_t event_encode(uint8_t *p_out, char const *name, uint8_t const *p_data, size_t data_len, int8_t rssi)
+{
+    size_t len = head_encode(p_out, name);
+
+    len += cbor_bytes(&p_out[len], p_data, data_len);
+    len += tail_encode(&p_out[len], m_peripheral_addr, m_central_addr, rssi, 0);
+
+    return len;
+}
+
+/**@brief Typed value, as ble_publish_value() sends: marker and a CBOR float.
+ */
+static size_t data_value(uint8_t *p_data)
+{
+    float value = 20.0f + (rand() % 1000) / 100.0f;
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    p_data[0] = 0x00;
+    p_data[1] = 0xfa;
+    p_data[2] = bits >> 24;
+    p_data[3] = bits >> 16;
+    p_data[4] = bits >> 8;
+    p_data[5] = bits;
+
+    return 6;
+}
+
+/**@brief Fixed layout record, as a schemagen <record>_publish() sends.
+ */
+static size_t data_record(uint8_t *p_data)
+{
+    size_t len = 0;
+
+    p_data[len++] = 0x01;
+    p_data[len++] = 0x5a;
+    p_data[len++] = 0xc7;
+
+    // A few slowly moving 16 bit readings
+    for (int i = 0; i < 8; i++)
+    {
+        int16_t value = 1000 * i + rand() % 16;
+        p_data[len++] = value;
+        p_data[len++] = value >> 8;
+    }
+
+    return len;
+}
+
+/**@brief Short status text.
+ */
+static size_t data_text(uint8_t *p_data)
+{
+    static char const *texts[] = {"ok", "door open", "door closed", "low battery", "charging"};
+    char const *text = texts[rand() % 5];
+
+    strcpy((char *)p_data, text);
+    return strlen(text);
+}
+
+/**@brief Noise. Should never get bigger, only skipped.
+ */
+static size_t data_random(uint8_t *p_data)
+{
+    size_t len = 16 + rand() % 64;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        p_data[i] = rand();
+    }
+
+    return len;
+}
+
+typedef size_t (*data_gen_t)(uint8_t *p_data);
+
+static int run(char const *label, data_gen_t gen)
+{
+    static uint8_t event[FRAME_MAX], packed[FRAME_MAX], unpacked[FRAME_MAX], data[FRAME_MAX];
+    ble_comp_stats_t before, after;
+    int failed = 0;
+
+    ble_comp_stats_get(&before);
+
+    for (int i = 0; i < FRAMES; i++)
+    {
+        size_t data_len = gen(data);
+        size_t event_len = event_encode(event, m_topics[rand() % 6], data, data_len, -40 - rand() % 50);
+        size_t packed_len;
+        size_t unpacked_len;
+
+        if (ble_comp_compress(event, event_len, packed, sizeof(packed), &packed_len) != NRF_SUCCESS)
+        {
+            continue;
+        }
+
+        if (packed_len >= event_len || !ble_comp_is_compressed(packed, packed_len))
+        {
+            failed++;
+            continue;
+        }
+
+        if (ble_comp_decompress(packed, packed_len, unpacked, sizeof(unpacked), &unpacked_len) != NRF_SUCCESS ||
+            unpacked_len != event_len || memcmp(unpacked, event, event_len) != 0)
+        {
+            failed++;
+        }
+    }
+
+    ble_comp_stats_get(&after);
+
+    uint32_t frames = after.frames - before.frames;
+    uint32_t skipped = after.skipped - before.skipped;
+    uint32_t bytes_in = after.bytes_in - before.bytes_in;
+    uint32_t bytes_out = after.bytes_out - before.bytes_out;
+    double ns = (double)(after.cycles.total - before.cycles.total);
+
+    printf("%-8s %6u %6u %7.3f %8.1f %8.1f %6d\n", label, frames, skipped, (double)bytes_out / bytes_in,
+           ns / bytes_in, bytes_in / ns * 1000.0, failed);
+
+    return failed;
+}
+
+int main(void)
+{
+    srand(1);
+
+    // Same seeding as ble_stack_init() and ble_compress_topic_add() on both ends
+    static uint8_t const no_addr[6] = {0};
+    uint8_t seed[FRAME_MAX];
+
+    if (ble_comp_dict_add(seed, tail_encode(seed, no_addr, no_addr, 0, 0)) != NRF_SUCCESS)
+    {
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(m_topics) / sizeof(m_topics[0]); i++)
+    {
+        if (ble_comp_dict_add(seed, head_encode(seed, m_topics[i])) != NRF_SUCCESS)
+        {
+            return 1;
+        }
+    }
+
+    printf("%-8s %6s %6s %7s %8s %8s %6s\n", "payload", "comp", "skip", "ratio", "ns/B", "MB/s", "failed");
+
+    int failed = 0;
+    failed += run("value", data_value);
+    failed += run("record", data_record);
+    failed += run("text", data_text);
+    failed += run("random", data_random);
+
+    return failed != 0;
+}
@@ -0,0 +1,21 @@
+// Host stand-in for the parts of app_util.h that ble_comp.c uses.
+#ifndef APP_UTIL_H__
+#define APP_UTIL_H__
+
+#include <stdint.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static inline uint8_t uint16_encode(uint16_t value, uint8_t *p_encoded_data)
+{
+    p_encoded_data[0] = (uint8_t)(value & 0x00FF);
+    p_encoded_data[1] = (uint8_t)((value & 0xFF00) >> 8);
+    return sizeof(uint16_t);
+}
+
+static inline uint16_t uint16_decode(const uint8_t *p_encoded_data)
+{
+    return (uint16_t)p_encoded_data[0] | ((uint16_t)p_encoded_data[1] << 8);
+}
+
+#endif
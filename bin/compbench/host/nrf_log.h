@@ -0,0 +1,11 @@
+// Host stand-in for nrf_log.h. Logs go nowhere.
+#ifndef NRF_LOG_H_
+#define NRF_LOG_H_
+
+#define NRF_LOG_MODULE_REGISTER()
+#define NRF_LOG_DEBUG(...)
+#define NRF_LOG_INFO(...)
+#define NRF_LOG_WARNING(...)
+#define NRF_LOG_ERROR(...)
+
+#endif
@@ -0,0 +1,15 @@
+// Host stand-in for sdk_errors.h. Values as in nrf_error.h.
+#ifndef SDK_ERRORS_H__
+#define SDK_ERRORS_H__
+
+#include <stdint.h>
+
+typedef uint32_t ret_code_t;
+
+#define NRF_SUCCESS 0
+#define NRF_ERROR_NO_MEM 4
+#define NRF_ERROR_NOT_FOUND 5
+#define NRF_ERROR_INVALID_DATA 11
+#define NRF_ERROR_DATA_SIZE 12
+
+#endif
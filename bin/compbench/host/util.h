@@ -0,0 +1,37 @@
+// Host stand-in for util.h. "Cycles" are nanoseconds of the monotonic clock here.
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdint.h>
+#include <time.h>
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t last;
+    uint32_t max;
+    uint64_t total;
+} util_cycles_stats_t;
+
+static inline uint32_t util_cycles_get(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec);
+}
+
+static inline void util_cycles_stats_add(util_cycles_stats_t *p_stats, uint32_t begin)
+{
+    uint32_t cycles = util_cycles_get() - begin;
+
+    p_stats->count++;
+    p_stats->last = cycles;
+    p_stats->total += cycles;
+
+    if (cycles > p_stats->max)
+    {
+        p_stats->max = cycles;
+    }
+}
+
+#endif
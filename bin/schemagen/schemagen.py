@@ -0,0 +1,338 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2020, Jared Wolff
+# All rights reserved.
+#
+# Generates C structs and fixed layout encode/decode functions from a
+# .schema file. See example.schema for the format.
+#
+# Usage: schemagen.py <file.schema> <source dir> <include dir>
+#
+# For <name>.schema this writes <name>_schema.c and <name>_schema.h.
+#
+
+import binascii
+import os
+import re
+import sys
+
+# Schema type -> (C type, encoded size)
+TYPES = {
+    'bool': ('bool', 1),
+    'int8': ('int8_t', 1),
+    'uint8': ('uint8_t', 1),
+    'int16': ('int16_t', 2),
+    'uint16': ('uint16_t', 2),
+    'int32': ('int32_t', 4),
+    'uint32': ('uint32_t', 4),
+    'float': ('float', 4),
+}
+
+# Marker and schema id in front of the fields
+HEADER_SIZE = 3
+
+IDENT = re.compile(r'^[A-Za-z_][A-Za-z0-9_]*$')
+FIELD = re.compile(r'^([A-Za-z_][A-Za-z0-9_]*)(?:\[([0-9]+)\])?$')
+
+
+class SchemaError(Exception):
+    pass
+
+
+class Field(object):
+    def __init__(self, type_name, name, count):
+        self.type_name = type_name
+        self.name = name
+        self.count = count  # None for scalars
+        self.ctype, self.size = TYPES[type_name]
+        self.offset = 0
+
+    @property
+    def length(self):
+        return self.size * (self.count or 1)
+
+
+class Record(object):
+    def __init__(self, name, topic):
+        self.name = name
+        self.topic = topic
+        self.fields = []
+
+    @property
+    def macro(self):
+        return self.name.upper()
+
+    @property
+    def encoded_size(self):
+        return HEADER_SIZE + sum(f.length for f in self.fields)
+
+    @property
+    def schema_id(self):
+        # Changes with any change to the layout, so both ends have to agree on it
+        layout = self.name + ':' + ','.join(
+            '%s %s[%d]' % (f.type_name, f.name, f.count or 0) for f in self.fields)
+        return binascii.crc_hqx(layout.encode('ascii'), 0xffff)
+
+
+def parse(path):
+    records = []
+    record = None
+
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            words = line.split('#', 1)[0].split()
+
+            if not words:
+                continue
+
+            def fail(msg):
+                raise SchemaError('%s:%d: %s' % (path, number, msg))
+
+            if words[0] == 'record':
+                if len(words) not in (2, 3) or not IDENT.match(words[1]):
+                    fail('expected "record <name> [topic]"')
+
+                if any(r.name == words[1] for r in records):
+                    fail('record "%s" already defined' % words[1])
+
+                topic = words[2] if len(words) == 3 else words[1]
+                record = Record(words[1], topic)
+                records.append(record)
+                continue
+
+            if record is None:
+                fail('field outside of a record')
+
+            if len(words) != 2 or words[0] not in TYPES:
+                fail('expected "<type> <name>[count]", types: %s' % ', '.join(sorted(TYPES)))
+
+            match = FIELD.match(words[1])
+            if match is None:
+                fail('bad field name "%s"' % words[1])
+
+            name, count = match.group(1), match.group(2)
+
+            if any(fld.name == name for fld in record.fields):
+                fail('field "%s" already defined' % name)
+
+            if count is not None and int(count) == 0:
+                fail('array "%s" is empty' % name)
+
+            record.fields.append(Field(words[0], name, int(count) if count else None))
+
+    for r in records:
+        if not r.fields:
+            raise SchemaError('%s: record "%s" has no fields' % (path, r.name))
+
+        offset = HEADER_SIZE
+        for fld in r.fields:
+            fld.offset = offset
+            offset += fld.length
+
+    return records
+
+
+def gen_header(records, base, source):
+    guard = 'SCHEMA_%s_H' % base.upper()
+    out = []
+
+    out.append('/* Generated by schemagen.py from %s. Do not edit. */' % source)
+    out.append('')
+    out.append('#ifndef %s' % guard)
+    out.append('#define %s' % guard)
+    out.append('')
+    out.append('#include <stdbool.h>')
+    out.append('#include <stdint.h>')
+    out.append('#include <stddef.h>')
+    out.append('')
+    out.append('#include "codec_value.h"')
+    out.append('#include "sdk_errors.h"')
+
+    for r in records:
+        out.append('')
+        out.append('/**@brief %s record, published on "%s". */' % (r.name, r.topic))
+        out.append('typedef struct')
+        out.append('{')
+        for fld in r.fields:
+            suffix = '[%d]' % fld.count if fld.count else ''
+            out.append('    %s %s%s;' % (fld.ctype, fld.name, suffix))
+        out.append('} %s_t;' % r.name)
+        out.append('')
+        out.append('#define %s_TOPIC "%s"' % (r.macro, r.topic))
+        out.append('#define %s_SCHEMA_ID 0x%04x' % (r.macro, r.schema_id))
+        out.append('#define %s_ENCODED_SIZE %d /**< Marker, schema id and fields. */' % (r.macro, r.encoded_size))
+        out.append('')
+        out.append('/**@brief Function for encoding a record into %s_ENCODED_SIZE bytes. */' % r.macro)
+        out.append('size_t %s_encode(%s_t const *p_rec, uint8_t *p_out);' % (r.name, r.name))
+        out.append('')
+        out.append('/**@brief Function for decoding event data into a record.')
+        out.append(' *')
+        out.append(' * @details Pass the bytes of the CODEC_VALUE_TEXT value a ble_subscribe_value() handler gets.')
+        out.append(' *')
+        out.append(' * @retval NRF_SUCCESS            Decoded.')
+        out.append(' * @retval NRF_ERROR_INVALID_DATA Not a %s_t, or one of another layout.' % r.name)
+        out.append(' */')
+        out.append('ret_code_t %s_decode(uint8_t const *p_data, size_t len, %s_t *p_rec);' % (r.name, r.name))
+        out.append('')
+        out.append('/**@brief Function for publishing a record on %s_TOPIC. */' % r.macro)
+        out.append('void %s_publish(%s_t const *p_rec);' % (r.name, r.name))
+
+    out.append('')
+    out.append('#endif')
+    out.append('')
+
+    return '\n'.join(out)
+
+
+def gen_encode(r):
+    out = []
+    out.append('size_t %s_encode(%s_t const *p_rec, uint8_t *p_out)' % (r.name, r.name))
+    out.append('{')
+    out.append('    p_out[0] = CODEC_VALUE_RECORD_MARKER;')
+    out.append('    p_out[1] = (uint8_t)%s_SCHEMA_ID;' % r.macro)
+    out.append('    p_out[2] = (uint8_t)(%s_SCHEMA_ID >> 8);' % r.macro)
+
+    for fld in r.fields:
+        if fld.type_name == 'bool' and fld.count:
+            out.append('')
+            out.append('    for (int i = 0; i < %d; i++)' % fld.count)
+            out.append('    {')
+            out.append('        p_out[%d + i] = p_rec->%s[i] ? 1 : 0;' % (fld.offset, fld.name))
+            out.append('    }')
+            out.append('')
+        elif fld.type_name == 'bool':
+            out.append('    p_out[%d] = p_rec->%s ? 1 : 0;' % (fld.offset, fld.name))
+        elif fld.count:
+            out.append('    memcpy(&p_out[%d], p_rec->%s, %d);' % (fld.offset, fld.name, fld.length))
+        elif fld.size == 1:
+            out.append('    p_out[%d] = (uint8_t)p_rec->%s;' % (fld.offset, fld.name))
+        else:
+            out.append('    memcpy(&p_out[%d], &p_rec->%s, %d);' % (fld.offset, fld.name, fld.length))
+
+    out.append('')
+    out.append('    return %s_ENCODED_SIZE;' % r.macro)
+    out.append('}')
+
+    return out
+
+
+def gen_decode(r):
+    out = []
+    out.append('ret_code_t %s_decode(uint8_t const *p_data, size_t len, %s_t *p_rec)' % (r.name, r.name))
+    out.append('{')
+    out.append('    if (len != %s_ENCODED_SIZE || p_data[0] != CODEC_VALUE_RECORD_MARKER ||' % r.macro)
+    out.append('        (p_data[1] | (p_data[2] << 8)) != %s_SCHEMA_ID)' % r.macro)
+    out.append('    {')
+    out.append('        return NRF_ERROR_INVALID_DATA;')
+    out.append('    }')
+    out.append('')
+
+    for fld in r.fields:
+        if fld.type_name == 'bool' and fld.count:
+            out.append('')
+            out.append('    for (int i = 0; i < %d; i++)' % fld.count)
+            out.append('    {')
+            out.append('        p_rec->%s[i] = p_data[%d + i] != 0;' % (fld.name, fld.offset))
+            out.append('    }')
+            out.append('')
+        elif fld.type_name == 'bool':
+            out.append('    p_rec->%s = p_data[%d] != 0;' % (fld.name, fld.offset))
+        elif fld.count:
+            out.append('    memcpy(p_rec->%s, &p_data[%d], %d);' % (fld.name, fld.offset, fld.length))
+        elif fld.size == 1:
+            out.append('    p_rec->%s = (%s)p_data[%d];' % (fld.name, fld.ctype, fld.offset))
+        else:
+            out.append('    memcpy(&p_rec->%s, &p_data[%d], %d);' % (fld.name, fld.offset, fld.length))
+
+    out.append('')
+    out.append('    return NRF_SUCCESS;')
+    out.append('}')
+
+    return out
+
+
+def gen_publish(r):
+    out = []
+    out.append('void %s_publish(%s_t const *p_rec)' % (r.name, r.name))
+    out.append('{')
+    out.append('    pyrinas_event_t event;')
+    out.append('')
+    out.append('    memset(&event, 0, sizeof(pyrinas_event_t));')
+    out.append('    event.name.size = sizeof(%s_TOPIC) - 1;' % r.macro)
+    out.append('    memcpy(event.name.bytes, %s_TOPIC, event.name.size);' % r.macro)
+    out.append('    event.data.size = %s_encode(p_rec, event.data.bytes);' % r.name)
+    out.append('')
+    out.append('    ble_publish_raw(event);')
+    out.append('}')
+
+    return out
+
+
+def gen_source(records, base, source):
+    out = []
+
+    out.append('/* Generated by schemagen.py from %s. Do not edit. */' % source)
+    out.append('')
+    out.append('#include <string.h>')
+    out.append('')
+    out.append('#include "%s_schema.h"' % base)
+    out.append('')
+    out.append('#include "app_util.h"')
+    out.append('#include "ble_m.h"')
+    out.append('#include "util.h"')
+    out.append('')
+    out.append('// Fields are copied in the byte order of the target, little endian on nRF52.')
+
+    for r in records:
+        out.append('')
+        out.append('// One byte spare like strings, the receiver may terminate it')
+        out.append('STATIC_ASSERT(%s_ENCODED_SIZE < member_size(pyrinas_event_data_t, bytes));' % r.macro)
+        out.append('STATIC_ASSERT(sizeof(%s_TOPIC) <= member_size(pyrinas_event_name_data_t, bytes));' % r.macro)
+        out.append('')
+        out.extend(gen_encode(r))
+        out.append('')
+        out.extend(gen_decode(r))
+        out.append('')
+        out.extend(gen_publish(r))
+
+    out.append('')
+
+    # Tidy up blank lines doubled around loops
+    text = '\n'.join(out)
+    text = re.sub(r'\n\n\n+', '\n\n', text)
+    text = re.sub(r'\{\n\n', '{\n', text)
+    text = re.sub(r'\n\n(\s*)\}', r'\n\1}', text)
+
+    return text
+
+
+def main(argv):
+    if len(argv) != 4:
+        sys.stderr.write('usage: %s <file.schema> <source dir> <include dir>\n' % argv[0])
+        return 2
+
+    path, src_dir, inc_dir = argv[1:]
+    source = os.path.basename(path)
+    base = os.path.splitext(source)[0]
+
+    if not IDENT.match(base):
+        sys.stderr.write('%s: file name must be a C identifier\n' % path)
+        return 1
+
+    try:
+        records = parse(path)
+    except SchemaError as e:
+        sys.stderr.write('%s\n' % e)
+        return 1
+
+    with open(os.path.join(inc_dir, base + '_schema.h'), 'w') as f:
+        f.write(gen_header(records, base, source))
+
+    with open(os.path.join(src_dir, base + '_schema.c'), 'w') as f:
+        f.write(gen_source(records, base, source))
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -43,8 +43,12 @@
 #define MANUFACTURER_NAME "Circuit Dojo" /**< Manufacturer. Will be passed to Device Information Service. */
 #endif 
 
+#define APP_ADV_DIRECTED_INTERVAL 64     /**< Directed advertising interval after losing a hub (in units of 0.625 ms. This value corresponds to 40 ms). */
+#define APP_ADV_DIRECTED_DURATION 500    /**< Directed advertising duration (5 seconds) in units of 10 milliseconds. */
 #define APP_ADV_INTERVAL 300             /**< The advertising interval (in units of 0.625 ms. This value corresponds to 187.5 ms). */
-#define APP_ADV_DURATION 0               /**< The advertising duration (180 seconds) in units of 10 milliseconds. */
+#define APP_ADV_DURATION 3000            /**< The advertising duration (30 seconds) in units of 10 milliseconds. */
+#define APP_ADV_SLOW_INTERVAL 3200       /**< Slow advertising interval (in units of 0.625 ms. This value corresponds to 2 seconds). */
+#define APP_ADV_SLOW_DURATION 0          /**< Slow advertising duration in units of 10 milliseconds. 0 advertises until connected. */
 #define APP_BLE_CONN_CFG_TAG 1           /**< A tag identifying the SoftDevice BLE configuration. */
 #define APP_ADV_TX_POWER 8u
 
@@ -64,6 +68,7 @@
 #define BLE_PB_ENABLED true
 #define BLE_PB_CONFIG_LOG_ENABLED true
 #define BLE_PB_BLE_OBSERVER_PRIO 2
+#define BLE_PB_TX_QUEUE_SIZE 8
 
 // PB Collector
 #define BLE_PB_C_ENABLED true
@@ -110,11 +115,14 @@
 #define NRF_BLE_GQ_GATTS_HVX_MAX_DATA_LEN 96
 
 // Central count
-#define NRF_SDH_BLE_PERIPHERAL_LINK_COUNT 1
+#define NRF_SDH_BLE_PERIPHERAL_LINK_COUNT 2
 #define NRF_SDH_BLE_CENTRAL_LINK_COUNT 8
-#define NRF_SDH_BLE_TOTAL_LINK_COUNT 9
+#define NRF_SDH_BLE_TOTAL_LINK_COUNT 10
 #define NRF_SDH_BLE_GATT_MAX_MTU_SIZE 128
 
+// RX, TX, capability and snapshot characteristics of the Protobuf service
+#define NRF_SDH_BLE_GATTS_ATTR_TAB_SIZE 2048
+
 // Scan related
 #define NRF_BLE_SCAN_ENABLED 1
 #define NRF_BLE_SCAN_BUFFER 255
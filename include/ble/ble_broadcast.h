@@ -0,0 +1,139 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef BLE_BROADCAST_H
+#define BLE_BROADCAST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "app_util.h"
+#include "ble.h"
+#include "ble_handlers.h"
+
+#define BLE_BROADCAST_COMPANY_ID 0xFFFF     /**< Company ID of the manufacturer specific data (reserved for testing). */
+#define BLE_BROADCAST_FRAME_TELEMETRY 0x01  /**< Frame carries an encoded sensor event. */
+#define BLE_BROADCAST_FRAME_COMMAND 0x02    /**< Frame carries an encoded hub command. */
+#define BLE_BROADCAST_HEADER_SIZE 4         /**< Company ID (2), frame type (1), sequence number (1). */
+#define BLE_BROADCAST_AD_OVERHEAD 2         /**< AD structure length and type bytes. */
+#define BLE_BROADCAST_PAYLOAD_MAX (BLE_GAP_ADV_SET_DATA_SIZE_EXTENDED_MAX_SUPPORTED - \
+                                   BLE_BROADCAST_AD_OVERHEAD - BLE_BROADCAST_HEADER_SIZE)
+
+#ifndef BLE_BROADCAST_ADV_INTERVAL
+#define BLE_BROADCAST_ADV_INTERVAL MSEC_TO_UNITS(100, UNIT_0_625_MS) /**< Interval between repetitions of a frame. */
+#endif
+
+#ifndef BLE_BROADCAST_ADV_EVTS
+#define BLE_BROADCAST_ADV_EVTS 3 /**< Number of advertising events each frame is repeated for. */
+#endif
+
+#ifndef BLE_BROADCAST_CMD_DURATION
+#define BLE_BROADCAST_CMD_DURATION 1000 /**< How long a command is advertised in 10 ms units. Must span several listen intervals. */
+#endif
+
+#ifndef BLE_BROADCAST_LISTEN_INTERVAL
+#define BLE_BROADCAST_LISTEN_INTERVAL MSEC_TO_UNITS(1000, UNIT_0_625_MS) /**< Sensor side scan interval. */
+#endif
+
+#ifndef BLE_BROADCAST_LISTEN_WINDOW
+#define BLE_BROADCAST_LISTEN_WINDOW MSEC_TO_UNITS(50, UNIT_0_625_MS) /**< Sensor side scan window. */
+#endif
+
+#ifndef BLE_BROADCAST_SENDER_MAX
+#define BLE_BROADCAST_SENDER_MAX 64 /**< Senders tracked for duplicate suppression. Power of two. */
+#endif
+
+/**@brief Function for initializing the broadcast module.
+ */
+void ble_broadcast_init(void);
+
+/**@brief Function for broadcasting an encoded event in extended advertising data.
+ *
+ * @details The frame is sent non-connectable on the coded PHY and repeated for
+ *          @ref BLE_BROADCAST_ADV_EVTS advertising events. A new frame replaces
+ *          one that is still being repeated.
+ *
+ * @param[in] data  Encoded event.
+ * @param[in] size  Size of the encoded event.
+ *
+ * @retval NRF_SUCCESS          If the frame is being advertised.
+ * @retval NRF_ERROR_DATA_SIZE  If the frame does not fit in the advertising data.
+ * @retval err_code             Otherwise, the error returned by the SoftDevice.
+ */
+uint32_t ble_broadcast_write(uint8_t *data, size_t size);
+
+/**@brief Function for broadcasting an encoded command to every listening sensor.
+ *
+ * @details The frame is advertised for @ref BLE_BROADCAST_CMD_DURATION so that
+ *          low duty cycle listeners get a chance to catch it. Each command gets
+ *          a new sequence number.
+ *
+ * @param[in] data  Encoded event.
+ * @param[in] size  Size of the encoded event.
+ *
+ * @retval NRF_SUCCESS          If the frame is being advertised.
+ * @retval NRF_ERROR_DATA_SIZE  If the frame does not fit in the advertising data.
+ * @retval err_code             Otherwise, the error returned by the SoftDevice.
+ */
+uint32_t ble_broadcast_command(uint8_t *data, size_t size);
+
+/**@brief Function for starting to listen for broadcast commands.
+ *
+ * @details Starts a low duty cycle scan. Commands with a sequence number not seen
+ *          before are forwarded to the raw handler and dispatched by ble_process().
+ *
+ * @param[in] p_hub_addr  Only accept commands from this hub. NULL or all zeros accepts any hub.
+ */
+void ble_broadcast_listen_start(ble_gap_addr_t const *p_hub_addr);
+
+/**@brief Function for stopping to listen for broadcast commands.
+ */
+void ble_broadcast_listen_stop(void);
+
+/**@brief Function for parsing an advertising report for broadcast frames.
+ *
+ * @details Decoded telemetry and commands are forwarded to the raw handler. Repeats of the same
+ *          frame from the same sender are dropped.
+ *
+ * @param[in] p_adv_report  Advertising report from the SoftDevice.
+ */
+void ble_broadcast_on_adv_report(ble_gap_evt_adv_report_t const *p_adv_report);
+
+/**@brief Function for attaching the handler that receives decoded broadcast events.
+ */
+void ble_broadcast_attach_raw_handler(raw_susbcribe_handler_t raw_evt_handler);
+
+/**@brief Function for handling BLE events related to the broadcast advertising set.
+ */
+void ble_broadcast_evt_handler(ble_evt_t const *p_ble_evt, void *p_context);
+
+#endif
@@ -0,0 +1,179 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef BLE_BULK_H
+#define BLE_BULK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ble.h"
+#include "sdk_errors.h"
+
+#ifndef BLE_BULK_PSM
+#define BLE_BULK_PSM 0x0081 /**< LE PSM of the bulk channel. Dynamic range. */
+#endif
+
+#ifndef BLE_BULK_MTU
+#define BLE_BULK_MTU 512 /**< Largest SDU in either direction. */
+#endif
+
+#ifndef BLE_BULK_MPS
+#define BLE_BULK_MPS 247 /**< Largest L2CAP PDU. Fits one data length extended LL packet. */
+#endif
+
+#ifndef BLE_BULK_TX_BUFFERS
+#define BLE_BULK_TX_BUFFERS 2 /**< SDUs handed to the SoftDevice at once per channel. */
+#endif
+
+#ifndef BLE_BULK_RX_BUFFERS
+#define BLE_BULK_RX_BUFFERS 2 /**< SDU buffers given to the SoftDevice per channel. */
+#endif
+
+#ifndef BLE_BULK_CHANNEL_COUNT
+#define BLE_BULK_CHANNEL_COUNT 2 /**< Links with a bulk channel at the same time. */
+#endif
+
+// Credits that cover one whole SDU, including its 2 byte length
+#define BLE_BULK_RX_CREDITS (((BLE_BULK_MTU + 2) + BLE_BULK_MPS - 1) / BLE_BULK_MPS)
+
+/**@brief Bulk channel event type. */
+typedef enum
+{
+    BLE_BULK_EVT_CONNECTED,    /**< The channel is up. */
+    BLE_BULK_EVT_DISCONNECTED, /**< The channel was released. */
+    BLE_BULK_EVT_RX,           /**< An SDU was received. */
+    BLE_BULK_EVT_TX_DONE,      /**< Every byte of a transfer was sent. */
+    BLE_BULK_EVT_TX_FAILED     /**< A transfer was cut short. */
+} ble_bulk_evt_type_t;
+
+/**@brief Bulk channel event. */
+typedef struct
+{
+    ble_bulk_evt_type_t evt_type; /**< Type of event. */
+    uint16_t conn_handle;         /**< Link of the channel. */
+    union
+    {
+        struct
+        {
+            uint8_t const *p_data; /**< Received SDU. Only valid during the handler. */
+            uint16_t len;          /**< Length of the SDU. */
+        } rx;
+        struct
+        {
+            uint32_t bytes; /**< Bytes sent. */
+            uint32_t ms;    /**< Time from start to the last SDU leaving the SoftDevice. */
+        } tx;
+    } params;
+} ble_bulk_evt_t;
+
+/**@brief Bulk channel event handler type. Called from the SoftDevice observer and from ble_process(). */
+typedef void (*ble_bulk_evt_handler_t)(ble_bulk_evt_t const *p_evt);
+
+/**@brief Bulk transfer statistics. */
+typedef struct
+{
+    uint32_t transfers;  /**< Completed transfers. */
+    uint32_t bytes;      /**< Bytes of the last transfer. */
+    uint32_t ms;         /**< Duration of the last transfer. */
+    uint32_t rx_bytes;   /**< Bytes received on all channels. */
+    uint32_t tx_stalled; /**< Times the peer ran out of credits for us. */
+} ble_bulk_stats_t;
+
+/**@brief Function for reserving SoftDevice resources for the channels.
+ *
+ * @details Must be called after nrf_sdh_ble_default_cfg_set() and before the stack is enabled.
+ */
+void ble_bulk_cfg_set(uint8_t conn_cfg_tag, uint32_t ram_start);
+
+/**@brief Function for initializing the bulk channels.
+ *
+ * @param[in] evt_handler  Handler for received data and transfer results. May be NULL.
+ */
+void ble_bulk_init(ble_bulk_evt_handler_t evt_handler);
+
+/**@brief Function for opening a channel to the peer (central only).
+ *
+ * @details Called once the Pyrinas service was discovered. The peer accepts if it runs
+ *          ble_bulk as well.
+ *
+ * @retval NRF_ERROR_INVALID_STATE  The module is not initialized.
+ * @retval NRF_ERROR_NO_MEM         Every channel is in use.
+ * @retval err_code                 Otherwise the error of sd_ble_l2cap_ch_setup.
+ */
+ret_code_t ble_bulk_connect(uint16_t conn_handle);
+
+/**@brief Function for checking if a link has an open channel.
+ */
+bool ble_bulk_is_connected(uint16_t conn_handle);
+
+/**@brief Function for checking if a transfer is running on a link.
+ */
+bool ble_bulk_is_busy(uint16_t conn_handle);
+
+/**@brief Function for streaming a buffer.
+ *
+ * @details Sent in SDUs of up to @ref BLE_BULK_MTU bytes straight from the buffer.
+ *          The buffer must stay untouched until BLE_BULK_EVT_TX_DONE or BLE_BULK_EVT_TX_FAILED.
+ *
+ * @retval NRF_SUCCESS              The transfer started.
+ * @retval NRF_ERROR_INVALID_STATE  No channel on the link.
+ * @retval NRF_ERROR_BUSY           A transfer is running on the link.
+ */
+ret_code_t ble_bulk_send(uint16_t conn_handle, uint8_t const *data, size_t size);
+
+/**@brief Function for streaming a file.
+ *
+ * @details Read in SDU sized pieces as credits come in. The name must stay valid until the end.
+ *
+ * @retval NRF_ERROR_NOT_FOUND  The file is empty or missing.
+ */
+ret_code_t ble_bulk_send_file(uint16_t conn_handle, const char *filename);
+
+/**@brief Function for streaming generated bytes. For throughput measurements.
+ */
+ret_code_t ble_bulk_send_pattern(uint16_t conn_handle, size_t size);
+
+/**@brief Function for getting the bulk transfer statistics.
+ */
+void ble_bulk_stats_get(ble_bulk_stats_t *p_stats);
+
+/**@brief Function for handling BLE events. Called from the SoftDevice observer.
+ */
+void ble_bulk_on_ble_evt(ble_evt_t const *p_ble_evt);
+
+/**@brief Function for feeding running transfers. Called from ble_process().
+ */
+void ble_bulk_process(void);
+
+#endif
@@ -46,6 +46,7 @@
 
 #include "ble.h"
 #include "ble_handlers.h"
+#include "util.h"
 
 #include "peer_manager.h"
 
@@ -53,14 +54,46 @@ typedef struct
 {
     ble_gap_addr_t devices[NRF_SDH_BLE_CENTRAL_LINK_COUNT];
     uint8_t device_count;
+    bool broadcast_ingest; /**< Keep scanning for broadcast telemetry once all devices are connected. */
+    int8_t min_rssi;       /**< Ignore peers advertising below this RSSI (dBm). 0 disables the floor. */
+    bool strongest_first;  /**< Collect matching peers for a short window and connect to the strongest. */
+    bool snapshot_read;    /**< Read the last event of every topic from peers once notifications are on. */
 } ble_central_init_t;
 
+/**@brief Scan processing counters. */
+typedef struct
+{
+    uint32_t cache_hits;   /**< Reports dropped as duplicates. */
+    uint32_t cache_misses; /**< Reports passed on to the scan filters. */
+    uint32_t rssi_dropped; /**< Connectable reports dropped below the RSSI floor. */
+    uint32_t candidates;   /**< Filter matches seen while connecting strongest first. */
+} ble_central_scan_stats_t;
+
+/**@brief Function for getting the scan processing counters.
+ */
+void ble_central_scan_stats_get(ble_central_scan_stats_t *p_stats);
+
 //TODO: document this.
 bool ble_central_is_connected(void);
 void ble_central_pm_evt_handler(pm_evt_t const *p_evt);
 void ble_central_disconnect(void);
 void ble_central_attach_raw_handler(raw_susbcribe_handler_t raw_evt_handler);
+
+/**@brief Function for taking received events undecoded. Call before @ref ble_central_init.
+ */
+void ble_central_attach_raw_bytes_handler(raw_bytes_handler_t raw_bytes_handler);
+
+/**@brief Function for getting the time spent in the observer on notifications.
+ */
+void ble_central_rx_cycles_get(util_cycles_stats_t *p_stats);
 void ble_central_write(uint8_t *data, size_t size);
+void ble_central_mtu_set(uint16_t conn_handle, uint16_t mtu);
+
+/**@brief Function for getting what every connected sensor handles.
+ *
+ * @return BLE_PB_CAP_* common to all of them. 0 if none is connected.
+ */
+uint8_t ble_central_peer_caps_get(void);
 void ble_central_evt_handler(ble_evt_t const *p_ble_evt, void *p_context);
 void ble_central_scan_start(void);
 void ble_central_reload(ble_central_init_t *init);
@@ -0,0 +1,115 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef BLE_COMP_H
+#define BLE_COMP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sdk_errors.h"
+#include "util.h"
+
+// An event starts with a CBOR map head, 0xa0 to 0xbf, so a leading 0x00 is unambiguous.
+#define BLE_COMP_MARKER 0x00
+#define BLE_COMP_HEADER_SIZE 3 /**< Marker and the id of the dictionary. */
+
+// LZSS tokens. A flag byte tells which of the next 8 tokens are matches.
+#define BLE_COMP_MATCH_MIN 3     /**< Shorter matches go out as literals. */
+#define BLE_COMP_MATCH_MAX 18    /**< Longest match a token holds. */
+#define BLE_COMP_DISTANCE_MAX 4096 /**< Farthest a match reaches back, dictionary included. */
+
+#ifndef BLE_COMP_DICT_SIZE
+#define BLE_COMP_DICT_SIZE 256 /**< Bytes of event fields and topic heads both ends start with. */
+#endif
+
+/**@brief Compression statistics. */
+typedef struct
+{
+    uint32_t frames;            /**< Frames sent compressed. */
+    uint32_t skipped;           /**< Frames that would not get smaller. */
+    uint32_t bytes_in;          /**< Encoded bytes of all frames tried. */
+    uint32_t bytes_out;         /**< Bytes sent for them, raw or compressed. */
+    util_cycles_stats_t cycles; /**< Time spent compressing. */
+} ble_comp_stats_t;
+
+/**@brief Function for adding bytes, usually a topic name, to the dictionary.
+ *
+ * @details Both ends have to add the same bytes in the same order. Frames made with
+ *          another dictionary are rejected by the receiver.
+ *
+ * @retval NRF_SUCCESS       Added.
+ * @retval NRF_ERROR_NO_MEM  BLE_COMP_DICT_SIZE reached. Nothing was added.
+ */
+ret_code_t ble_comp_dict_add(uint8_t const *p_data, size_t len);
+
+/**@brief Function for getting the id of the dictionary. CRC16 of its contents.
+ */
+uint16_t ble_comp_dict_id(void);
+
+/**@brief Function for checking if a received frame is compressed.
+ */
+static inline bool ble_comp_is_compressed(uint8_t const *p_data, size_t len)
+{
+    return len >= BLE_COMP_HEADER_SIZE && p_data[0] == BLE_COMP_MARKER;
+}
+
+/**@brief Function for compressing an encoded event.
+ *
+ * @param[in]   p_in        Encoded event.
+ * @param[in]   in_len      Length of the encoded event.
+ * @param[out]  p_out       Compressed frame.
+ * @param[in]   out_size    Size of p_out.
+ * @param[out]  p_out_len   Length of the compressed frame.
+ *
+ * @retval NRF_SUCCESS          The frame is smaller than the event.
+ * @retval NRF_ERROR_DATA_SIZE  It would not get smaller. Send the event as it is.
+ */
+ret_code_t ble_comp_compress(uint8_t const *p_in, size_t in_len, uint8_t *p_out, size_t out_size, size_t *p_out_len);
+
+/**@brief Function for restoring the encoded event of a compressed frame.
+ *
+ * @retval NRF_SUCCESS            Restored.
+ * @retval NRF_ERROR_NOT_FOUND    Made with another dictionary.
+ * @retval NRF_ERROR_INVALID_DATA Corrupt.
+ * @retval NRF_ERROR_DATA_SIZE    Does not fit in p_out.
+ */
+ret_code_t ble_comp_decompress(uint8_t const *p_in, size_t in_len, uint8_t *p_out, size_t out_size, size_t *p_out_len);
+
+/**@brief Function for getting the compression statistics.
+ *
+ * @details Ratio is bytes_out / bytes_in, cycles per byte is cycles.total / bytes_in.
+ */
+void ble_comp_stats_get(ble_comp_stats_t *p_stats);
+
+#endif
@@ -0,0 +1,121 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef BLE_CONN_MGR_H
+#define BLE_CONN_MGR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "app_util.h"
+#include "ble.h"
+
+#ifndef BLE_CONN_MGR_BURST_MIN_INTERVAL
+#define BLE_CONN_MGR_BURST_MIN_INTERVAL MSEC_TO_UNITS(7.5, UNIT_1_25_MS) /**< Minimum connection interval while data is backed up. */
+#endif
+
+#ifndef BLE_CONN_MGR_BURST_MAX_INTERVAL
+#define BLE_CONN_MGR_BURST_MAX_INTERVAL MSEC_TO_UNITS(15, UNIT_1_25_MS) /**< Maximum connection interval while data is backed up. */
+#endif
+
+#ifndef BLE_CONN_MGR_IDLE_MIN_INTERVAL
+#define BLE_CONN_MGR_IDLE_MIN_INTERVAL MSEC_TO_UNITS(100, UNIT_1_25_MS) /**< Minimum connection interval of an idle link. */
+#endif
+
+#ifndef BLE_CONN_MGR_IDLE_MAX_INTERVAL
+#define BLE_CONN_MGR_IDLE_MAX_INTERVAL MSEC_TO_UNITS(200, UNIT_1_25_MS) /**< Maximum connection interval of an idle link. */
+#endif
+
+#ifndef BLE_CONN_MGR_IDLE_SLAVE_LATENCY
+#define BLE_CONN_MGR_IDLE_SLAVE_LATENCY 4 /**< Connection events an idle peripheral may skip. */
+#endif
+
+#ifndef BLE_CONN_MGR_SUP_TIMEOUT
+#define BLE_CONN_MGR_SUP_TIMEOUT MSEC_TO_UNITS(4000, UNIT_10_MS) /**< Supervision timeout for both parameter sets. */
+#endif
+
+#ifndef BLE_CONN_MGR_IDLE_HOLD_MS
+#define BLE_CONN_MGR_IDLE_HOLD_MS 2000 /**< Time without demand before an idle link goes back to the idle parameters. */
+#endif
+
+#ifndef BLE_CONN_MGR_RETRY_MAX
+#define BLE_CONN_MGR_RETRY_MAX 3 /**< Requests for the same parameters after the central granted others. */
+#endif
+
+#ifndef BLE_CONN_MGR_RETRY_MS
+#define BLE_CONN_MGR_RETRY_MS 10000 /**< Time between those requests. */
+#endif
+
+/**@brief Connection parameter manager statistics.
+ *
+ * @details The estimated connection events are proportional to the radio energy spent
+ *          on the links. Wake latency is how long data may wait for the next connection
+ *          event the peripheral listens to.
+ */
+typedef struct
+{
+    uint32_t switches_burst;  /**< Switches to the burst parameters. */
+    uint32_t switches_idle;   /**< Switches to the idle parameters. */
+    uint32_t update_failures; /**< Requests that could not be made. */
+    uint32_t burst_ms;        /**< Time spent on a short interval. */
+    uint32_t idle_ms;         /**< Time spent on a long interval. */
+    uint32_t conn_events;     /**< Estimated connection events attended. */
+    uint32_t wake_latency_ms; /**< Worst case wait for a connection event with the last granted parameters. */
+} ble_conn_mgr_stats_t;
+
+/**@brief Function for initializing the connection parameter manager.
+ *
+ * @details Manages the links where this device is the peripheral. A new link starts
+ *          on whatever the central picked and moves to the idle parameters after
+ *          @ref BLE_CONN_MGR_IDLE_HOLD_MS without demand.
+ */
+void ble_conn_mgr_init(void);
+
+/**@brief Function for signalling that a link has data backed up.
+ *
+ * @details Switches the link to the burst parameters if it is not on them yet.
+ *          The link goes back to the idle parameters once there was no demand for
+ *          @ref BLE_CONN_MGR_IDLE_HOLD_MS.
+ *
+ * @param[in] conn_handle  Connection with the backlog.
+ */
+void ble_conn_mgr_demand(uint16_t conn_handle);
+
+/**@brief Function for getting the connection parameter manager statistics.
+ */
+void ble_conn_mgr_stats_get(ble_conn_mgr_stats_t *p_stats);
+
+/**@brief Function for handling BLE events related to connection parameters.
+ */
+void ble_conn_mgr_evt_handler(ble_evt_t const *p_ble_evt, void *p_context);
+
+#endif
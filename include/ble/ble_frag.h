@@ -0,0 +1,108 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef BLE_FRAG_H
+#define BLE_FRAG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pyrinas_codec.h"
+#include "systick.h"
+
+// One byte in front of every PDU on the RX and TX characteristics
+#define BLE_FRAG_HEADER_SIZE 1
+#define BLE_FRAG_START 0x80    /**< First PDU of an event. */
+#define BLE_FRAG_END 0x40      /**< Last PDU of an event. */
+#define BLE_FRAG_SEQ_MASK 0x3f /**< Running PDU counter. Catches lost or reordered PDUs. */
+
+// Largest event that can be reassembled
+#define BLE_FRAG_DATA_MAX_LEN sizeof(pyrinas_event_t)
+
+#ifndef BLE_FRAG_RX_TIMEOUT_MS
+#define BLE_FRAG_RX_TIMEOUT_MS 1000 /**< Longest gap between two PDUs of one event. */
+#endif
+
+/**@brief Result of adding a PDU to a reassembly. */
+typedef enum
+{
+    BLE_FRAG_RX_PENDING,  /**< More PDUs needed. */
+    BLE_FRAG_RX_COMPLETE, /**< The event is complete in the reassembly buffer. */
+    BLE_FRAG_RX_ERROR     /**< Out of sequence, timed out or too large. The partial event was dropped. */
+} ble_frag_rx_result_t;
+
+/**@brief Reassembly state of one link. */
+typedef struct
+{
+    uint8_t data[BLE_FRAG_DATA_MAX_LEN]; /**< Event put together so far. */
+    uint16_t len;                        /**< Bytes in data. */
+    uint8_t seq;                         /**< Counter expected in the next PDU. */
+    bool active;                         /**< A START was seen and the END is outstanding. */
+    systick_ticks_t last_ticks;          /**< When the last PDU arrived. */
+} ble_frag_rx_t;
+
+/**@brief Function for dropping a partial event.
+ */
+void ble_frag_rx_reset(ble_frag_rx_t *p_rx);
+
+/**@brief Function for adding a received PDU to a reassembly.
+ *
+ * @param[in]   p_rx    Reassembly of the link the PDU came in on.
+ * @param[in]   p_pdu   PDU including the header.
+ * @param[in]   len     Length of the PDU.
+ *
+ * @return      BLE_FRAG_RX_COMPLETE once p_rx->data holds p_rx->len bytes of a whole event.
+ */
+ble_frag_rx_result_t ble_frag_rx_put(ble_frag_rx_t *p_rx, uint8_t const *p_pdu, uint16_t len);
+
+/**@brief Function for building the next PDU of an event.
+ *
+ * @param[out]  p_pdu        Buffer of at least BLE_FRAG_HEADER_SIZE + payload_max bytes.
+ * @param[in]   data         Whole encoded event.
+ * @param[in]   size         Size of the event.
+ * @param[in]   offset       Bytes of the event already sent.
+ * @param[in]   payload_max  Event bytes that fit in one PDU.
+ * @param[in]   seq          Counter of this PDU.
+ *
+ * @return      Length of the PDU. The offset advances by this minus BLE_FRAG_HEADER_SIZE.
+ */
+uint16_t ble_frag_build(uint8_t *p_pdu, uint8_t const *data, size_t size, size_t offset, uint16_t payload_max, uint8_t seq);
+
+/**@brief Function for getting the number of PDUs an event takes.
+ */
+static inline uint16_t ble_frag_count(size_t size, uint16_t payload_max)
+{
+    return (size + payload_max - 1) / payload_max;
+}
+
+#endif
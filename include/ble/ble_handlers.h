@@ -33,13 +33,27 @@
 #ifndef BLE_HANDLERS_H
 #define BLE_HANDLERS_H
 
+#include "codec_value.h"
 #include "pyrinas_codec.h"
 
 // TODO: duplicate handlers that are doing the same thing as Central and Peripheral
 /**@brief Subscription handler definition. */
 typedef void (*susbcribe_handler_t)(char *name, char *data);
 
+/**@brief Typed subscription handler definition.
+ *
+ * @details Events published as strings come in as CODEC_VALUE_TEXT. p_value is only valid
+ *          during the call.
+ */
+typedef void (*value_subscribe_handler_t)(char *name, codec_value_t const *p_value);
+
 /**@brief Raw subscription handler definition. */
 typedef void (*raw_susbcribe_handler_t)(pyrinas_event_t *evt);
 
+/**@brief Handler definition for encoded events that are decoded later.
+ *
+ * @details Called from the SoftDevice observer. The data is only valid during the call.
+ */
+typedef void (*raw_bytes_handler_t)(uint8_t const *data, uint16_t len, int8_t rssi);
+
 #endif
\ No newline at end of file
@@ -52,21 +52,30 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "ble_bulk.h"
 #include "ble_central.h"
+#include "ble_comp.h"
 #include "ble_handlers.h"
+#include "ble_peripheral.h"
 
 #include "peer_manager.h"
 
+#include "codec_fast.h"
 #include "pyrinas_codec.h"
 
 //TODO: better place to define this
 #define BLE_M_SUBSCRIBER_MAX_COUNT 12 /**< Max amount of potential subscriptions. */
 
+#ifndef BLE_M_RAW_RING_SIZE
+#define BLE_M_RAW_RING_SIZE 2048 /**< Bytes of received events waiting for ble_process(), as they came in. */
+#endif
+
 /**@brief Struct for tracking callbacks
  */
 typedef struct
 {
     susbcribe_handler_t evt_handler;
+    value_subscribe_handler_t value_handler; /**< Takes the decoded value instead. */
     pyrinas_event_name_data_t name;
 } ble_subscription_handler_t;
 
@@ -82,8 +91,26 @@ typedef enum
 {
     ble_mode_peripheral = 0,
     ble_mode_central = 1,
+    ble_mode_broadcast = 2, /**< Connectionless sensor. Publishes are sent in extended advertising data. */
 } ble_mode_t;
 
+/**@brief SoftDevice resource profiles.
+ *
+ * @details Trades application RAM for packets per connection event. Every profile
+ *          other than the default overrides the connection event length, the
+ *          notification/write command queue sizes and connection event extension.
+ *          The linker script RAM start is sized for the default profile. If the
+ *          SoftDevice needs more for the selected one, ble_stack_init() logs the
+ *          required RAM start and falls back to the default.
+ */
+typedef enum
+{
+    ble_resource_profile_default = 0,    /**< Use the defaults from sdk_config.h. */
+    ble_resource_profile_low_power,      /**< Shortest events, single packet queues. */
+    ble_resource_profile_balanced,       /**< Moderate events and queues, event extension on. */
+    ble_resource_profile_max_throughput, /**< Long events and deep queues. Uses the most RAM. */
+} ble_resource_profile_t;
+
 /**@brief BLE callback function to main context.
  */
 
@@ -93,15 +120,21 @@ typedef struct
 {
     ble_mode_t mode;
     bool long_range;
+    ble_resource_profile_t resource_profile;
+    bool bulk_enabled; /**< Reserve an L2CAP channel per link for bulk transfers. */
+    bool compress;     /**< Compress publishes to peers that handle it. */
+    ble_bulk_evt_handler_t bulk_evt_handler; /**< Bulk channel events. Optional. */
     union
     {
         ble_central_init_t config;
+        ble_peripheral_init_t peripheral;
     };
 
 } ble_stack_init_t;
 
 #define BLE_STACK_PERIPH_DEF(X) ble_stack_init_t X = {.mode = ble_mode_peripheral, .long_range = true}
 #define BLE_STACK_CENTRAL_DEF(X) ble_stack_init_t X = {.mode = ble_mode_central, .long_range = true}
+#define BLE_STACK_BROADCAST_DEF(X) ble_stack_init_t X = {.mode = ble_mode_broadcast, .long_range = true}
 
 /**@brief Function for terminating connection with a BLE peripheral device.
  */
@@ -113,6 +146,14 @@ void ble_disconnect(void);
  */
 void ble_stack_init(ble_stack_init_t *init);
 
+/**@brief Function for getting the application RAM start required by the SoftDevice.
+ *
+ * @details Only valid after @ref ble_stack_init. Depends on the selected resource profile.
+ *
+ * @return Minimum application RAM start address for the current configuration.
+ */
+uint32_t ble_ram_start_get(void);
+
 /**@brief Function for reloading configuration
  *
  * @details Re-initialize configuration
@@ -130,9 +171,42 @@ void ble_publish(char *name, char *data);
 // TODO: document this
 void ble_publish_raw(pyrinas_event_t event);
 
+/**@brief Function for publishing a typed value instead of a string.
+ *
+ * @details Sent as CBOR, so numbers need no formatting here and no parsing on the other end.
+ *          Subscribers of @ref ble_subscribe on older firmware get an empty string.
+ */
+void ble_publish_value(char *name, codec_value_t const *p_value);
+
+/**@brief Function for publishing an integer. See @ref ble_publish_value. */
+void ble_publish_int(char *name, int32_t value);
+
+/**@brief Function for publishing a float. See @ref ble_publish_value. */
+void ble_publish_float(char *name, float value);
+
+/**@brief Function for publishing data that is not urgent.
+ *
+ * @details In peripheral mode with @ref ble_peripheral_init_t::defer_enabled the publish
+ *          is held until the radio wakes up anyway. Otherwise the same as @ref ble_publish.
+ */
+void ble_publish_deferred(char *name, char *data);
+
+/**@brief Function for broadcasting a command to all listening sensors (central only).
+ *
+ * @details Sent once in advertising data instead of one write per connected link.
+ *          Sensors pick it up with @ref ble_peripheral_init_t::broadcast_listen.
+ */
+void ble_publish_broadcast(char *name, char *data);
+
 // TODO: document this
 void ble_subscribe(char *name, susbcribe_handler_t handler);
 
+/**@brief Function for subscribing to the decoded values of a topic.
+ *
+ * @details Replaces a @ref ble_subscribe of the same name, and the other way around.
+ */
+void ble_subscribe_value(char *name, value_subscribe_handler_t handler);
+
 // TODO: document this
 void ble_subscribe_raw(raw_susbcribe_handler_t handler);
 
@@ -160,6 +234,30 @@ void ble_pm_evt_handler(pm_evt_t const *p_evt);
  */
 void ble_external_antenna(bool enabled);
 
+/**@brief Function for getting the time the SoftDevice observer spends on received data.
+ *
+ * @details The observer only copies them. They are decoded in ble_process().
+ */
+void ble_rx_cycles_get(util_cycles_stats_t *p_stats);
+
+/**@brief Function for adding a topic name to the compression dictionary.
+ *
+ * @details Adds the start of the topic's events. Hub and sensors have to add the same
+ *          names in the same order, after ble_stack_init() and before anything is
+ *          published. Frames of a mismatched dictionary are dropped.
+ */
+void ble_compress_topic_add(char *name);
+
+/**@brief Function for getting the compression ratio and cost of sent publishes.
+ */
+void ble_compress_stats_get(ble_comp_stats_t *p_stats);
+
+/**@brief Function for getting the cost of encoding publishes, template and generic path.
+ *
+ * @details Use @ref codec_fast_benchmark to time both on the same event.
+ */
+void ble_encode_stats_get(codec_fast_stats_t *p_stats);
+
 // TODO: document this
 void ble_process();
 
@@ -45,7 +45,8 @@
  * @ingroup ble_sdk_srv
  * @brief Protobuf Service module.
  *
- * @details This module implements the Protobuf Service with the Command characteristic.
+ * @details This module implements the Protobuf Service with the RX and TX characteristics.
+ *          The legacy Command characteristic carries both directions for older hubs.
  *
  * @note    The application must register this module as BLE event observer using the
  *          NRF_SDH_BLE_OBSERVER macro. Example:
@@ -60,9 +61,14 @@
 #define BLE_PB_H__
 
 #include "ble.h"
+#include "ble_comp.h"
+#include "ble_frag.h"
+#include "codec_fast.h"
 #include "pyrinas_codec.h"
 #include "ble_srv_common.h"
+#include "nrf_queue.h"
 #include "nrf_sdh_ble.h"
+#include "util.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -78,18 +84,53 @@ extern "C"
             0x80, 0x62, 0x45, 0x8d, 0x00, 0x00, 0x00, 0x00 \
     }
 #define PROTOBUF_UUID_SERVICE 0xf510
-#define PROTOBUF_UUID_CONFIG_CHAR (PROTOBUF_UUID_SERVICE + 1)
+#define PROTOBUF_UUID_CONFIG_CHAR (PROTOBUF_UUID_SERVICE + 1) // Legacy. Written and notified.
+#define PROTOBUF_UUID_RX_CHAR (PROTOBUF_UUID_SERVICE + 2)     // Central to peripheral. Write without response.
+#define PROTOBUF_UUID_TX_CHAR (PROTOBUF_UUID_SERVICE + 3)     // Peripheral to central. Notify.
+#define PROTOBUF_UUID_CAPS_CHAR (PROTOBUF_UUID_SERVICE + 4)   // Protocol version and capabilities. Read, then written with the central's own.
+#define PROTOBUF_UUID_SNAPSHOT_CHAR (PROTOBUF_UUID_SERVICE + 5) // Last event of every topic. Long read.
+
+// Largest notification payload that fits in the ATT MTU
+#define BLE_PB_TX_DATA_MAX_LEN (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3)
+
+// Centrals that can be served at the same time
+#define BLE_PB_LINK_COUNT NRF_SDH_BLE_PERIPHERAL_LINK_COUNT
+
+// What a peer is known to handle beyond plain encoded events
+#define BLE_PB_CAP_COMPRESS (1 << 0) // Frames from ble_comp_compress()
+#define BLE_PB_CAP_FRAGMENT (1 << 1) // Events on RX and TX carry a fragment header
+#define BLE_PB_CAP_HEADER (1 << 2)   // Events leave out addresses and RSSI the link already carried
+
+// Capabilities of this firmware. Peers without the characteristic are version 0.
+#define BLE_PB_PROTOCOL_VERSION 1
+#define BLE_PB_CAPS_LOCAL (BLE_PB_CAP_COMPRESS | BLE_PB_CAP_FRAGMENT | BLE_PB_CAP_HEADER)
+#define BLE_PB_CAPS_LEN 4 // Version, BLE_PB_CAP_* flags, dictionary id
+
+// Snapshot value: one record per topic, 2 byte length then the encoded event
+#define BLE_PB_SNAPSHOT_RECORD_HEADER_SIZE 2
+
+#ifndef BLE_PB_SNAPSHOT_SIZE
+#define BLE_PB_SNAPSHOT_SIZE 256 /**< Bytes of all records. At most 512, the longest attribute value. */
+#endif
+
+#ifndef BLE_PB_SNAPSHOT_TOPICS
+#define BLE_PB_SNAPSHOT_TOPICS 8 /**< Topics kept in the snapshot. */
+#endif
 
 /**@brief Macro for defining a ble_protobuf instance.
  *
  * @param   _name  Name of the instance.
  * @hideinitializer
  */
-#define BLE_PB_DEF(_name)                          \
-    static ble_protobuf_t _name;                   \
-    NRF_SDH_BLE_OBSERVER(_name##_obs,              \
-                         BLE_PB_BLE_OBSERVER_PRIO, \
-                         ble_protobuf_on_ble_evt,  \
+#define BLE_PB_DEF(_name)                                              \
+    NRF_QUEUE_ARRAY_DEF(ble_pb_tx_item_t, _name##_tx_queues,           \
+                        BLE_PB_TX_QUEUE_SIZE,                          \
+                        NRF_QUEUE_MODE_NO_OVERFLOW,                    \
+                        BLE_PB_LINK_COUNT);                            \
+    static ble_protobuf_t _name = {.p_tx_queues = _name##_tx_queues}; \
+    NRF_SDH_BLE_OBSERVER(_name##_obs,                                  \
+                         BLE_PB_BLE_OBSERVER_PRIO,                     \
+                         ble_protobuf_on_ble_evt,                      \
                          &_name)
 
     // TODO: handling subscriptions
@@ -98,6 +139,7 @@ extern "C"
     typedef enum
     {
         BLE_PB_EVT_DATA,
+        BLE_PB_EVT_RAW,                  /**< Encoded data. Only with @ref ble_protobuf_init_t::defer_decode. */
         BLE_PB_EVT_NOTIFICATION_ENABLED, /**< Protobuf value notification enabled event. */
         BLE_PB_EVT_NOTIFICATION_DISABLED /**< Protobuf value notification disabled event. */
     } ble_pb_evt_type_t;
@@ -107,13 +149,68 @@ extern "C"
     typedef struct
     {
         ble_pb_evt_type_t evt_type; /**< Type of event. */
+        uint16_t conn_handle;       /**< Connection the event happened on. */
         union
         {
             pyrinas_event_t data; /* data */
+            struct
+            {
+                uint8_t const *p_data; /**< Encoded event. Only valid during the handler. */
+                uint16_t len;          /**< Length of the encoded event. */
+            } raw;
         } params;
 
     } ble_pb_evt_t;
 
+    /**@brief What to do with a notification when the TX queue is full. */
+    typedef enum
+    {
+        BLE_PB_TX_DROP_NEWEST, /**< Reject the new notification. */
+        BLE_PB_TX_DROP_OLDEST  /**< Discard the oldest queued event, all of its PDUs, to make room. */
+    } ble_pb_tx_overflow_t;
+
+    /**@brief Queued notification. */
+    typedef struct
+    {
+        uint16_t len;                          /**< Length of the encoded data. */
+        bool first;                            /**< Starts an event. */
+        bool last;                             /**< Ends an event. */
+        uint8_t data[BLE_PB_TX_DATA_MAX_LEN]; /**< Encoded data. */
+    } ble_pb_tx_item_t;
+
+    /**@brief Notification TX statistics. */
+    typedef struct
+    {
+        uint32_t sent;      /**< Notifications handed to the SoftDevice. */
+        uint32_t dropped;   /**< Notifications lost to overflow or errors. */
+        uint16_t depth_max; /**< Deepest any TX queue has been. */
+    } ble_pb_tx_stats_t;
+
+    /**@brief Per connection state of the Protobuf Service. */
+    typedef struct
+    {
+        uint16_t conn_handle;       /**< Handle of the connection, BLE_CONN_HANDLE_INVALID if the slot is free. */
+        bool notifications_enabled; /**< The central subscribed to the TX or the Command characteristic. */
+        bool tx_subscribed;         /**< Subscribed to the TX characteristic. Preferred over the Command characteristic. */
+        bool command_subscribed;    /**< Subscribed to the legacy Command characteristic. */
+        uint16_t mtu;               /**< ATT MTU negotiated on the link. */
+        uint8_t tx_seq;             /**< Counter of the next PDU on the TX characteristic. */
+        ble_frag_rx_t rx;           /**< Reassembly of events written to the RX characteristic. */
+        uint8_t peer_caps;          /**< BLE_PB_CAP_* the central handles. */
+        uint8_t peer_version;       /**< Protocol version the central wrote. 0 if it did not. */
+        codec_fast_hdr_t hdr_tx;    /**< Header fields the central has from us. */
+        codec_fast_hdr_t hdr_rx;    /**< Header fields we have from the central. */
+    } ble_pb_link_t;
+
+    /**@brief Where the last event of a topic is in the snapshot. */
+    typedef struct
+    {
+        uint8_t name[member_size(pyrinas_event_name_data_t, bytes)]; /**< Topic. */
+        uint8_t name_len;                                            /**< Length of the topic. */
+        uint16_t offset;                                             /**< Record of the topic in the snapshot. */
+        uint16_t len;                                                /**< Length of the encoded event. */
+    } ble_pb_snapshot_topic_t;
+
     // Forward declaration of the ble_protobuf_t type.
     typedef struct ble_protobuf_s ble_protobuf_t;
 
@@ -127,6 +224,8 @@ extern "C"
         ble_protobuf_evt_handler_t evt_handler; /**< Event handler to be called for handling events in the Protobuf Service. */
         security_req_t bl_cccd_wr_sec;          /**< Security requirement for writing the BL characteristic CCCD. */
         security_req_t bl_wr_sec;               /**< Security requirement for writing the BL characteristic value */
+        ble_pb_tx_overflow_t tx_overflow;       /**< Policy when the TX queue is full. */
+        bool defer_decode;                      /**< Hand out BLE_PB_EVT_RAW instead of decoding in the observer. */
     } ble_protobuf_init_t;
 
     /**@brief Protobuf Service structure. This contains various status information for the service. */
@@ -134,15 +233,107 @@ extern "C"
     {
         ble_protobuf_evt_handler_t evt_handler;   /**< Event handler to be called for handling events in the Protobuf Service. */
         uint16_t service_handle;                  /**< Handle of Protobuf Service (as provided by the BLE stack). */
-        ble_gatts_char_handles_t command_handles; /**< Handles related to the Command characteristic. */
-        //TODO: Above is RX handle. Need a TX handle.
-        uint8_t uuid_type;    /**< UUID type for the Protobuf Service. */
-        uint16_t conn_handle; /**< Handle of the current connection (as provided by the BLE stack, is BLE_CONN_HANDLE_INVALID if not in a connection). */
+        ble_gatts_char_handles_t command_handles; /**< Handles related to the legacy Command characteristic. */
+        ble_gatts_char_handles_t rx_handles;      /**< Handles related to the RX characteristic. */
+        ble_gatts_char_handles_t tx_handles;      /**< Handles related to the TX characteristic. */
+        ble_gatts_char_handles_t caps_handles;    /**< Handles related to the capability characteristic. */
+        ble_gatts_char_handles_t snapshot_handles; /**< Handles related to the snapshot characteristic. */
+        uint8_t uuid_type;                      /**< UUID type for the Protobuf Service. */
+        ble_pb_link_t links[BLE_PB_LINK_COUNT]; /**< Connected centrals. */
+        nrf_queue_t const *const *p_tx_queues;  /**< Notifications waiting for room in the SoftDevice. One queue per link. */
+        ble_pb_tx_overflow_t tx_overflow;       /**< Policy when a TX queue is full. */
+        ble_pb_tx_stats_t tx_stats;             /**< Notification TX statistics. */
+        bool defer_decode;                      /**< Hand out BLE_PB_EVT_RAW instead of decoding. */
+        util_cycles_stats_t rx_cycles;          /**< Time spent in the observer on received data. */
+        ble_pb_snapshot_topic_t snapshot_topics[BLE_PB_SNAPSHOT_TOPICS]; /**< Topics in the snapshot. */
+        uint8_t snapshot_topic_count;                                    /**< Topics in use. */
+        uint16_t snapshot_len;                                           /**< Bytes of records in the snapshot. */
+        uint8_t snapshot[BLE_PB_SNAPSHOT_SIZE];                          /**< Last event of every topic. */
+        uint8_t snapshot_read[BLE_PB_SNAPSHOT_SIZE];                     /**< Value of the characteristic. Copy of the snapshot as of the last read. */
     };
 
-    // TODO: fill out more info on this call
+    /**@brief Function for sending data as a notification to every subscribed central.
+ *
+ * @details The data is queued per link and sent as soon as the SoftDevice has room.
+ *          A queue is drained again on every BLE_GATTS_EVT_HVN_TX_COMPLETE of its link.
+ *          Centrals on the TX characteristic get it split into as many PDUs as needed.
+ *          Only whole events are queued, the overflow policy never splits one.
+ *
+ * @param[in]   p_protobuf  Protobuf Service structure.
+ * @param[in]   data        Encoded data.
+ * @param[in]   size        Size of the data. At most BLE_FRAG_DATA_MAX_LEN, or one ATT payload
+ *                          for centrals on the legacy Command characteristic.
+ *
+ * @retval      NRF_SUCCESS             The data was sent or queued for at least one central.
+ * @retval      NRF_ERROR_INVALID_STATE No central is subscribed.
+ * @retval      NRF_ERROR_DATA_SIZE     The data does not fit in a notification.
+ * @retval      NRF_ERROR_NO_MEM        The queues are full and the data was dropped.
+ */
     uint32_t ble_protobuf_write(ble_protobuf_t *p_protobuf, uint8_t *data, size_t size);
 
+    /**@brief Function for keeping an encoded event as the last value of its topic.
+ *
+ * @details Centrals read all topics at once from the snapshot characteristic.
+ *
+ * @param[in]   p_protobuf  Protobuf Service structure.
+ * @param[in]   p_name      Topic.
+ * @param[in]   name_len    Length of the topic.
+ * @param[in]   data        Encoded event.
+ * @param[in]   size        Size of the encoded event.
+ *
+ * @retval      NRF_SUCCESS             Kept.
+ * @retval      NRF_ERROR_INVALID_PARAM The topic is too long.
+ * @retval      NRF_ERROR_NO_MEM        Out of topics or snapshot space. The previous value, if any, stays.
+ */
+    uint32_t ble_protobuf_snapshot_update(ble_protobuf_t *p_protobuf, uint8_t const *p_name, uint8_t name_len,
+                                          uint8_t const *data, size_t size);
+
+    /**@brief Function for setting the ATT MTU of a link.
+ *
+ * @details Call on NRF_BLE_GATT_EVT_ATT_MTU_UPDATED. Links start at BLE_GATT_ATT_MTU_DEFAULT.
+ */
+    void ble_protobuf_mtu_set(ble_protobuf_t *p_protobuf, uint16_t conn_handle, uint16_t mtu);
+
+    /**@brief Function for filling a capability characteristic value with those of this firmware.
+ *
+ * @param[out]  p_data  BLE_PB_CAPS_LEN bytes.
+ */
+    void ble_pb_caps_encode(uint8_t *p_data);
+
+    /**@brief Function for reading the capability characteristic value of a peer.
+ *
+ * @details BLE_PB_CAP_COMPRESS is left out unless the peer uses the same dictionary.
+ *
+ * @retval      true    p_version and p_caps are set.
+ * @retval      false   Too short to be a capability value.
+ */
+    bool ble_pb_caps_decode(uint8_t const *p_data, uint16_t len, uint8_t *p_version, uint8_t *p_caps);
+
+    /**@brief Function for setting what the central of a link handles.
+ *
+ * @details A central that sent a compressed frame gets BLE_PB_CAP_COMPRESS on its own.
+ */
+    void ble_protobuf_peer_caps_set(ble_protobuf_t *p_protobuf, uint16_t conn_handle, uint8_t caps);
+
+    /**@brief Function for getting what every subscribed central handles.
+ *
+ * @return      BLE_PB_CAP_* common to all of them. 0 if none is subscribed.
+ */
+    uint8_t ble_protobuf_peer_caps_get(ble_protobuf_t *p_protobuf);
+
+    /**@brief Function for getting the number of notifications waiting on a link.
+ *
+ * @param[in]   p_protobuf   Protobuf Service structure.
+ * @param[in]   conn_handle  Connection to check.
+ *
+ * @return      Queued notifications. 0 if the link is unknown.
+ */
+    size_t ble_protobuf_tx_pending(ble_protobuf_t *p_protobuf, uint16_t conn_handle);
+
+    /**@brief Function for getting the notification TX statistics.
+ */
+    void ble_protobuf_tx_stats_get(ble_protobuf_t *p_protobuf, ble_pb_tx_stats_t *p_stats);
+
     /**@brief Function for initializing the Protobuf Service.
  *
  * @param[out]  p_protobuf       Protobuf Service structure. This structure will have to be supplied by
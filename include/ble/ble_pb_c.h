@@ -62,12 +62,16 @@
 #define BLE_PB_C_H__
 
 #include "ble.h"
+#include "ble_comp.h"
+#include "ble_frag.h"
+#include "codec_fast.h"
 #include "pyrinas_codec.h"
 #include "ble_db_discovery.h"
 #include "ble_srv_common.h"
 #include "nrf_ble_gq.h"
 #include "nrf_sdh_ble.h"
 #include "sdk_config.h"
+#include "util.h"
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -77,6 +81,10 @@ extern "C"
 
 #define PB_SERVICE_UUID_TYPE BLE_UUID_TYPE_VENDOR_BEGIN /**< UUID type for the PB Service (vendor specific). */
 
+// Peripherals that can be served at the same time
+#define BLE_PB_C_LINK_COUNT NRF_SDH_BLE_CENTRAL_LINK_COUNT
+#define BLE_PB_C_LINK_INVALID 0xff /**< Conn handle without a slot in @ref ble_pb_c_s::link_index. */
+
 /**@brief   Macro for defining a ble_pb_c instance.
  *
  * @param   _name   Name of the instance.
@@ -97,7 +105,8 @@ extern "C"
   typedef enum
   {
     BLE_PB_C_EVT_DISCOVERY_COMPLETE = 1, /**< Event indicating that the Protobuf Service was discovered at the peer. */
-    BLE_PB_C_EVT_NOTIFICATION            /**< Event indicating that a notification of the Protobuf characteristic was received from the peer. */
+    BLE_PB_C_EVT_NOTIFICATION,           /**< Event indicating that a notification of the Protobuf characteristic was received from the peer. */
+    BLE_PB_C_EVT_RAW                     /**< Encoded notification. Only with @ref ble_pb_c_init_t::defer_decode. */
   } ble_pb_c_evt_type_t;
 
   /** @} */
@@ -110,12 +119,14 @@ extern "C"
   /**@brief Structure containing the handles related to the Protobuf Service found on the peer. */
   typedef struct
   {
-    uint16_t cccd_handle; /**< Handle of the CCCD of the Protobuf characteristic. */
-    uint16_t data_handle; /**< Handle of the Protobuf characteristic, as provided by the SoftDevice. */
+    uint16_t cccd_handle;  /**< Handle of the CCCD of the characteristic notifications come from. */
+    uint16_t data_handle;  /**< Handle of the characteristic notifications come from. TX, or Command on older peripherals. */
+    uint16_t write_handle; /**< Handle of the characteristic data is written to. RX, or Command on older peripherals. */
+    bool framed;           /**< RX and TX were found. Events are fragmented with a @ref BLE_FRAG_HEADER_SIZE header. */
+    uint16_t caps_handle;  /**< Handle of the capability characteristic. Invalid on older peripherals. */
+    uint16_t snapshot_handle; /**< Handle of the snapshot characteristic. Invalid on older peripherals. */
   } pb_db_t;
 
-  // TODO: Create a context array of these handles. As they are unique on a per-connection basis.
-
   /**@brief Protobuf Event structure. */
   typedef struct
   {
@@ -125,6 +136,11 @@ extern "C"
     {
       pb_db_t peer_db;      /**< Handles related to the Protobuf, found on the peer device. This is filled if the evt_type is @ref BLE_PB_C_EVT_DISCOVERY_COMPLETE.*/
       pyrinas_event_t data; /**< Protobuf data received. This is filled if the evt_type is @ref BLE_PB_C_EVT_NOTIFICATION. */
+      struct
+      {
+        uint8_t const *p_data; /**< Encoded event. Only valid during the handler. */
+        uint16_t len;          /**< Length of the encoded event. */
+      } raw;                   /**< Filled if the evt_type is @ref BLE_PB_C_EVT_RAW. */
     } params;
   } ble_pb_c_evt_t;
 
@@ -152,19 +168,44 @@ extern "C"
  * @{
  */
 
+  /**@brief Per connection state of the Protobuf Client. */
+  typedef struct
+  {
+    uint16_t conn_handle;         /**< Connection handle, as provided by the SoftDevice. */
+    bool assigned;                /**< The handles of the peer are known. */
+    bool notify_enable_on_secure; /**< Determines if a secure session has begun before discovery.. */
+    bool snapshot_pending;        /**< A snapshot read was asked for and did not start yet. */
+    int8_t rssi;                  /**< Last RSSI of the link. */
+    uint8_t tx_seq;               /**< Counter of the next PDU written to RX. */
+    uint8_t peer_caps;            /**< BLE_PB_CAP_* the peer handles. */
+    uint8_t peer_version;         /**< Protocol version of the peer. 0 until read or without the characteristic. */
+    uint16_t mtu;                 /**< ATT MTU negotiated on the link. */
+    pb_db_t char_handles;         /**< Handles related to PB on the peer. */
+    ble_frag_rx_t rx;             /**< Reassembly of events notified on TX. */
+    codec_fast_hdr_t hdr_tx;      /**< Header fields the peer has from us. */
+    codec_fast_hdr_t hdr_rx;      /**< Header fields we have from the peer. */
+  } ble_pb_c_link_t;
+
   /**@brief Protobuf Client structure.
+ *
+ * @details Links live in the first link_count slots and never move while connected. A free
+ *          slot among them has conn_handle BLE_CONN_HANDLE_INVALID and is reused first.
+ *          link_index finds the slot of a conn handle without a search.
  */
-  // TODO: this technically uses more memory than necssary.. May get hefty with more connections.
   struct ble_pb_c_s
   {
-    uint8_t uuid_type;                                          /**< UUID type for DFU UUID. */
-    int8_t rssi[NRF_SDH_BLE_TOTAL_LINK_COUNT];                  /**< RSSI values for each handle. */
-    uint16_t conn_handles[NRF_SDH_BLE_TOTAL_LINK_COUNT];        /**< Connection handle, as provided by the SoftDevice. */
-    pb_db_t char_handles[NRF_SDH_BLE_TOTAL_LINK_COUNT];         /**< Handles related to PB on the peer. */
-    bool notify_enable_on_secure[NRF_SDH_BLE_TOTAL_LINK_COUNT]; /**< Determines if a secure session has begun before discovery.. */
-    ble_pb_c_evt_handler_t evt_handler;                         /**< Application event handler to be called when there is an event related to the Protobuf Service. */
-    ble_srv_error_handler_t error_handler;                      /**< Function to be called in case of an error. */
-    nrf_ble_gq_t *p_gatt_queue;                                 /**< Pointer to the BLE GATT Queue instance. */
+    uint8_t uuid_type;                                /**< UUID type for DFU UUID. */
+    ble_pb_c_link_t links[BLE_PB_C_LINK_COUNT];       /**< Connected peripherals. */
+    uint8_t link_count;                               /**< Slots up to the last one in use. */
+    uint8_t link_index[NRF_SDH_BLE_TOTAL_LINK_COUNT]; /**< Slot of each conn handle, BLE_PB_C_LINK_INVALID if none. */
+    ble_pb_c_evt_handler_t evt_handler;               /**< Application event handler to be called when there is an event related to the Protobuf Service. */
+    ble_srv_error_handler_t error_handler;            /**< Function to be called in case of an error. */
+    nrf_ble_gq_t *p_gatt_queue;                       /**< Pointer to the BLE GATT Queue instance. */
+    bool defer_decode;                                /**< Hand out BLE_PB_C_EVT_RAW instead of decoding. */
+    util_cycles_stats_t rx_cycles;                    /**< Time spent in the observer on notifications. */
+    uint16_t snapshot_conn_handle;                    /**< Link whose snapshot is being read. BLE_CONN_HANDLE_INVALID if none. */
+    uint16_t snapshot_len;                            /**< Bytes of it so far. */
+    uint8_t snapshot[BLE_PB_SNAPSHOT_SIZE];           /**< Snapshot being read. */
   };
 
   /**@brief Protobuf Client initialization structure.
@@ -174,6 +215,7 @@ extern "C"
     ble_pb_c_evt_handler_t evt_handler;    /**< Event handler to be called by the Protobuf Client module when there is an event related to the Protobuf Service. */
     ble_srv_error_handler_t error_handler; /**< Function to be called in case of an error. */
     nrf_ble_gq_t *p_gatt_queue;            /**< Pointer to the BLE GATT Queue instance. */
+    bool defer_decode;                     /**< Hand out BLE_PB_C_EVT_RAW instead of decoding in the observer. */
   } ble_pb_c_init_t;
 
   /** @} */
@@ -183,9 +225,36 @@ extern "C"
  * @{
  */
 
-  // TODO: document this
+  /**@brief   Function for getting the state of a link.
+ *
+ * @return  The link, NULL if the connection is not one of this instance.
+ */
+  ble_pb_c_link_t *ble_pb_c_link_get(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle);
+
+  /**@brief   Function for writing an encoded event to the peer.
+ *
+ * @details Peers with the RX characteristic get it split into as many write commands as
+ *          the MTU needs. Older peers get a single write to the Command characteristic.
+ *
+ * @retval  NRF_SUCCESS          Every PDU was queued.
+ * @retval  NRF_ERROR_DATA_SIZE  Too large for the peer.
+ * @retval  err_code             Otherwise the error of @ref nrf_ble_gq_item_add. A partial event is
+ *                               dropped by the peer's reassembly.
+ */
   uint32_t ble_pb_c_write(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle, uint8_t *data, size_t size);
 
+  /**@brief   Function for setting the ATT MTU of a link.
+ *
+ * @details Call on NRF_BLE_GATT_EVT_ATT_MTU_UPDATED. Links start at BLE_GATT_ATT_MTU_DEFAULT.
+ */
+  void ble_pb_c_mtu_set(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle, uint16_t mtu);
+
+  /**@brief   Function for setting what the peer of a link handles.
+ *
+ * @details A peer that sent a compressed frame gets BLE_PB_CAP_COMPRESS on its own.
+ */
+  void ble_pb_c_peer_caps_set(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle, uint8_t caps);
+
   /**@brief     Function for initializing the Protobuf Client module.
  *
  * @details   This function registers with the Database Discovery module for the Protobuf Service.
@@ -227,6 +296,17 @@ extern "C"
  */
   uint32_t ble_pb_c_notif_enable(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle);
 
+  /**@brief   Function for fetching the last event of every topic of the peer.
+ *
+ * @details Long read of the snapshot characteristic. Every event in it is handed out like a
+ *          notification. Links are read one after the other.
+ *
+ * @retval  NRF_SUCCESS              Read started or queued behind another link.
+ * @retval  NRF_ERROR_INVALID_PARAM  The handles of the link are not assigned.
+ * @retval  NRF_ERROR_NOT_SUPPORTED  The peer has no snapshot characteristic.
+ */
+  uint32_t ble_pb_c_snapshot_read(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle);
+
   /**@brief     Function for handling events from the Database Discovery module.
  *
  * @details   Call this function when you get a callback event from the Database Discovery module.
@@ -254,6 +334,8 @@ extern "C"
  * @param[in] conn_handle        Connection handle to associate with the given Protobuf Client Instance.
  * @param[in] p_peer_pb_handles Attribute handles for the PB server you want this PB_C client to
  *                               interact with.
+ *
+ * @retval    NRF_ERROR_NO_MEM  All BLE_PB_C_LINK_COUNT links are taken.
  */
   uint32_t ble_pb_c_handles_assign(ble_pb_c_t *p_ble_pb_c,
                                    uint16_t conn_handle,
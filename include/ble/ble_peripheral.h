@@ -43,17 +43,116 @@
 #define BLE_M_PERIPHERAL_H
 
 #include "ble.h"
+#include "ble_handlers.h"
+#include "ble_pb.h"
 #include "peer_manager.h"
 
+#ifndef BLE_PERIPHERAL_DEFER_MAX
+#define BLE_PERIPHERAL_DEFER_MAX 4 /**< Deferred publishes held before they are flushed. */
+#endif
+
+#ifndef BLE_PERIPHERAL_DEFER_DEADLINE_MS
+#define BLE_PERIPHERAL_DEFER_DEADLINE_MS 5000 /**< Longest a deferred publish waits for a flush. */
+#endif
+
+typedef struct
+{
+    bool broadcast_listen;            /**< Listen for commands broadcast by a hub. */
+    ble_gap_addr_t hub_addr;          /**< Hub to take broadcast commands from. All zeros accepts any hub. */
+    ble_pb_tx_overflow_t tx_overflow; /**< What to drop when notifications back up. */
+    bool defer_enabled;               /**< Hold non-urgent publishes until the radio wakes up anyway. */
+    bool store_forward;               /**< Keep publishes in flash while no hub listens and replay them later. */
+} ble_peripheral_init_t;
+
+/**@brief Deferred publish statistics. */
+typedef struct
+{
+    uint32_t deferred;        /**< Publishes that were held back. */
+    uint32_t flushes_radio;   /**< Flushes riding on a radio wake-up. */
+    uint32_t flushes_full;    /**< Flushes because the buffer was full. */
+    uint32_t flushes_timeout; /**< Flushes because the deadline passed. */
+} ble_peripheral_defer_stats_t;
+
+/**@brief Advertising and reconnection statistics. */
+typedef struct
+{
+    uint32_t reconnects;        /**< Reconnections after losing a hub. */
+    uint32_t reconnect_ms_last; /**< Disconnect to connect time of the last reconnection. */
+    uint32_t reconnect_ms_max;  /**< Longest reconnection. */
+    uint32_t adv_ms;            /**< Time spent advertising. */
+    uint32_t adv_radio_on_ms;   /**< Estimated radio on time spent advertising. */
+} ble_peripheral_adv_stats_t;
+
+/**@brief Function for getting the notification TX statistics.
+ */
+void ble_peripheral_tx_stats_get(ble_pb_tx_stats_t *p_stats);
+
+/**@brief Function for getting the advertising and reconnection statistics.
+ */
+void ble_peripheral_adv_stats_get(ble_peripheral_adv_stats_t *p_stats);
+
+/**@brief Function for writing data that may wait for the next radio wake-up.
+ *
+ * @details Held in RAM until the radio becomes active for another reason, @ref
+ *          BLE_PERIPHERAL_DEFER_MAX publishes are waiting or @ref BLE_PERIPHERAL_DEFER_DEADLINE_MS
+ *          has passed. With slave latency this lets several readings share one connection event.
+ *          Written right away if @ref ble_peripheral_init_t::defer_enabled is not set.
+ */
+void ble_peripheral_write_deferred(uint8_t *data, size_t size);
+
+/**@brief Function for getting the deferred publish statistics.
+ */
+void ble_peripheral_defer_stats_get(ble_peripheral_defer_stats_t *p_stats);
+
+/**@brief Function for replaying stored publishes.
+ *
+ * @details Called from ble_process(). Sends up to @ref BLE_STORE_REPLAY_BURST stored publishes
+ *          per call while a hub has notifications enabled. Live publishes keep priority,
+ *          replay only uses the free half of the TX queue.
+ */
+void ble_peripheral_process(void);
+
+/**@brief Function for comparing GATT and bulk channel throughput on the same link.
+ *
+ * @details Sends size bytes as notifications, then size bytes over the bulk channel,
+ *          and logs the time and rate of both. Needs a hub that opened a bulk channel.
+ *
+ * @retval NRF_SUCCESS              Started. The result is logged from ble_process().
+ * @retval NRF_ERROR_BUSY           Already running.
+ * @retval NRF_ERROR_INVALID_STATE  No hub with a bulk channel.
+ */
+ret_code_t ble_peripheral_benchmark(size_t size);
+
 //TODO document
 int8_t ble_peripheral_get_rssi();
 bool ble_peripheral_is_connected(void);
 void ble_peripheral_disconnect(void);
 void ble_peripheral_pm_evt_handler(pm_evt_t const *p_evt);
 void ble_peripheral_attach_raw_handler(raw_susbcribe_handler_t raw_evt_handler);
+
+/**@brief Function for taking received events undecoded. Call before @ref ble_peripheral_init.
+ */
+void ble_peripheral_attach_raw_bytes_handler(raw_bytes_handler_t raw_bytes_handler);
+
+/**@brief Function for getting the time spent in the observer on received data.
+ */
+void ble_peripheral_rx_cycles_get(util_cycles_stats_t *p_stats);
 void ble_peripheral_write(uint8_t *data, size_t size);
+void ble_peripheral_mtu_set(uint16_t conn_handle, uint16_t mtu);
+
+/**@brief Function for getting what every subscribed hub handles.
+ *
+ * @return BLE_PB_CAP_* common to all of them. 0 if none is subscribed.
+ */
+uint8_t ble_peripheral_peer_caps_get(void);
+
+/**@brief Function for keeping the last encoded event of a topic in the snapshot characteristic.
+ *
+ * @return NRF_ERROR_NO_MEM if the snapshot has no room for it.
+ */
+ret_code_t ble_peripheral_snapshot_update(uint8_t const *name, uint8_t name_len, uint8_t const *data, size_t size);
 void ble_peripheral_evt_handler(ble_evt_t const *p_ble_evt, void *p_context);
 void ble_peripheral_advertising_start(bool erase_bonds);
-void ble_peripheral_init(void);
+void ble_peripheral_init(ble_peripheral_init_t *init);
 
 #endif
\ No newline at end of file
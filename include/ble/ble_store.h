@@ -0,0 +1,103 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef BLE_STORE_H
+#define BLE_STORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fs.h"
+#include "sdk_errors.h"
+
+#ifndef BLE_STORE_FILE
+#define BLE_STORE_FILE FS_RUN_DIR "/store" /**< Log of publishes waiting for a hub. */
+#endif
+
+#ifndef BLE_STORE_MAX_SIZE
+#define BLE_STORE_MAX_SIZE (64 * 1024) /**< Bytes the log may grow to. Newer publishes are dropped beyond that. */
+#endif
+
+#ifndef BLE_STORE_REPLAY_BURST
+#define BLE_STORE_REPLAY_BURST 4 /**< Stored publishes replayed per ble_process() pass. */
+#endif
+
+/**@brief Store-and-forward statistics. */
+typedef struct
+{
+    uint32_t stored;   /**< Publishes appended to the log. */
+    uint32_t replayed; /**< Publishes read back and sent. */
+    uint32_t dropped;  /**< Publishes lost because the log was full or corrupt. */
+} ble_store_stats_t;
+
+/**@brief Function for initializing the store.
+ *
+ * @details Picks up a log left from before a reset. The read position is only kept in RAM,
+ *          so a reset in the middle of a replay sends the replayed part again.
+ *          Requires fs_init() to have been called.
+ */
+void ble_store_init(void);
+
+/**@brief Function for appending an encoded publish to the log.
+ *
+ * @details The publish is replayed byte for byte. pyrinas_event_t has no timestamp, so
+ *          nothing records when it was captured and a hub can only tell the time it
+ *          arrived. Put the time in the data if it matters.
+ *
+ * @retval NRF_SUCCESS          Stored.
+ * @retval NRF_ERROR_NO_MEM     The log is full. The publish was dropped.
+ * @retval NRF_ERROR_DATA_SIZE  The publish is larger than a record can be.
+ */
+ret_code_t ble_store_append(uint8_t const *data, size_t size);
+
+/**@brief Function for reading the oldest publish without removing it.
+ *
+ * @retval NRF_SUCCESS          The publish was copied to data.
+ * @retval NRF_ERROR_NOT_FOUND  The log is empty. A corrupt log is discarded and reported as empty.
+ */
+ret_code_t ble_store_peek(uint8_t *data, size_t size_max, size_t *size);
+
+/**@brief Function for removing the publish returned by @ref ble_store_peek.
+ *
+ * @details The log is deleted once every publish in it has been consumed.
+ */
+void ble_store_consume(void);
+
+/**@brief Function for checking if publishes are waiting in the log.
+ */
+bool ble_store_is_empty(void);
+
+/**@brief Function for getting the store-and-forward statistics.
+ */
+void ble_store_stats_get(ble_store_stats_t *p_stats);
+
+#endif
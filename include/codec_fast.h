@@ -0,0 +1,203 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef CODEC_FAST_H
+#define CODEC_FAST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pyrinas_codec.h"
+#include "sdk_errors.h"
+#include "util.h"
+
+#ifndef CODEC_FAST_TEMPLATES
+#define CODEC_FAST_TEMPLATES 8 /**< Topics whose header is kept prebuilt. */
+#endif
+
+// Frames with a compressed header. Events start with a CBOR map, compressed frames with 0x00.
+// The marker is followed by a frame sequence number, then the event.
+#define CODEC_FAST_HDR_MARKER 0x01
+#define CODEC_FAST_HDR_SIZE 2
+
+#ifndef CODEC_FAST_HDR_REFRESH
+#define CODEC_FAST_HDR_REFRESH 16 /**< Frames between full headers. Bounds how long a lost change lasts. */
+#endif
+
+// Addresses and RSSI of an event
+#define CODEC_FAST_FIELD_PERIPHERAL_ADDR (1 << 0)
+#define CODEC_FAST_FIELD_CENTRAL_ADDR (1 << 1)
+#define CODEC_FAST_FIELD_PERIPHERAL_RSSI (1 << 2)
+#define CODEC_FAST_FIELD_CENTRAL_RSSI (1 << 3)
+#define CODEC_FAST_FIELDS_ALL 0x0f
+
+/**@brief Event decoded in place. Points into the buffer it was decoded from.
+ */
+typedef struct
+{
+    uint8_t const *p_name;            /**< Topic name. Not terminated. */
+    uint16_t name_len;                /**< Bytes of the name. */
+    uint8_t const *p_data;            /**< Data. Not terminated. */
+    uint16_t data_len;                /**< Bytes of the data. */
+    uint8_t const *p_peripheral_addr; /**< NULL if not in the event. */
+    uint8_t const *p_central_addr;    /**< NULL if not in the event. */
+    int8_t peripheral_rssi;
+    int8_t central_rssi;
+    uint8_t fields; /**< CODEC_FAST_FIELD_* found. */
+} codec_fast_view_t;
+
+/**@brief Header fields last sent or received on one direction of a link.
+ */
+typedef struct
+{
+    uint8_t peripheral_addr[member_size(pyrinas_event_t, peripheral_addr)];
+    uint8_t central_addr[member_size(pyrinas_event_t, central_addr)];
+    int8_t peripheral_rssi;
+    int8_t central_rssi;
+    uint8_t frames; /**< Sent since the last full header. */
+    uint8_t seq;    /**< Of the last frame sent or received. */
+    bool valid;     /**< A full header went through since the reset, and no frame went missing. */
+} codec_fast_hdr_t;
+
+/**@brief Encoder statistics. */
+typedef struct
+{
+    uint32_t fast;                      /**< Events encoded from a template. */
+    uint32_t generic;                   /**< Events encoded by pyrinas_codec_encode(). */
+    uint32_t templates;                 /**< Templates built. */
+    uint32_t mismatches;                /**< Templates that did not match the generic encoder. */
+    util_cycles_stats_t fast_cycles;    /**< Time spent in the template path. */
+    util_cycles_stats_t generic_cycles; /**< Time spent in pyrinas_codec_encode(). */
+} codec_fast_stats_t;
+
+/**@brief Function for encoding an event the way pyrinas_codec_encode() does, only faster.
+ *
+ * @details The map header, the name and the keys are kept per topic and only the data,
+ *          the addresses and the RSSI are written. The first event of a topic is also run
+ *          through pyrinas_codec_encode() and compared. If they differ, the topic stays on
+ *          the generic encoder.
+ *
+ * @retval NRF_SUCCESS        Encoded.
+ * @retval NRF_ERROR_NO_MEM   p_out is too small.
+ * @retval NRF_ERROR_INTERNAL The generic encoder failed.
+ */
+ret_code_t codec_fast_encode(pyrinas_event_t *p_event, uint8_t *p_out, size_t size, size_t *p_len);
+
+/**@brief Function for decoding an event without copying it.
+ *
+ * @details The view is valid as long as p_buf is. Names and data longer than
+ *          pyrinas_event_t holds are rejected, so a view always fits in one.
+ *
+ * @retval NRF_SUCCESS             Decoded.
+ * @retval NRF_ERROR_INVALID_DATA  Malformed or truncated, or name or data missing.
+ * @retval NRF_ERROR_NOT_SUPPORTED Encoding this decoder does not handle. Try pyrinas_codec_decode().
+ */
+ret_code_t codec_fast_view_decode(uint8_t const *p_buf, size_t len, codec_fast_view_t *p_view);
+
+/**@brief Function for copying a view into an event, for handlers that take one.
+ *
+ * @details The view must not point into p_event, it is cleared first.
+ */
+void codec_fast_view_to_event(codec_fast_view_t const *p_view, pyrinas_event_t *p_event);
+
+/**@brief Function for checking if a received frame has a compressed header.
+ */
+static inline bool codec_fast_hdr_is_compressed(uint8_t const *p_data, size_t len)
+{
+    return len >= CODEC_FAST_HDR_SIZE && p_data[0] == CODEC_FAST_HDR_MARKER;
+}
+
+/**@brief Function for starting over with a full header. On connection and when a frame is dropped.
+ */
+static inline void codec_fast_hdr_reset(codec_fast_hdr_t *p_hdr)
+{
+    p_hdr->valid = false;
+}
+
+/**@brief Function for leaving out the addresses and RSSI the peer already has.
+ *
+ * @details Every CODEC_FAST_HDR_REFRESH frames, and after a reset, all of them are sent.
+ *          Reset p_hdr when a frame is dropped, so the next one is full. Frames already
+ *          queued behind the dropped one are caught by the peer from the sequence number.
+ *
+ * @retval NRF_SUCCESS             Compressed. p_hdr holds what was sent.
+ * @retval NRF_ERROR_NO_MEM        p_out is too small.
+ * @retval NRF_ERROR_NOT_SUPPORTED Not an event this codec can rebuild. Send it as is.
+ */
+ret_code_t codec_fast_hdr_compress(codec_fast_hdr_t *p_hdr, uint8_t const *p_in, size_t len,
+                                   uint8_t *p_out, size_t size, size_t *p_len);
+
+/**@brief Function for filling in the fields the peer left out and encoding the full event.
+ *
+ * @retval NRF_SUCCESS             Full event in p_out.
+ * @retval NRF_ERROR_NO_MEM        p_out is too small.
+ * @retval NRF_ERROR_INVALID_STATE Fields missing, and no full header seen since the reset or
+ *                                 since a frame went missing. Dropped until the next full header.
+ * @retval NRF_ERROR_INVALID_DATA  Malformed frame.
+ */
+ret_code_t codec_fast_hdr_expand(codec_fast_hdr_t *p_hdr, uint8_t const *p_in, size_t len,
+                                 uint8_t *p_out, size_t size, size_t *p_len);
+
+/**@brief Function for writing the start of every event of a topic.
+ *
+ * @details The map head, the name and the key of the data. For seeding a compression dictionary.
+ *
+ * @return Bytes written. 0 if the name is too long or p_out too small.
+ */
+size_t codec_fast_head_encode(uint8_t const *p_name, size_t name_len, uint8_t *p_out, size_t size);
+
+/**@brief Function for writing the addresses and RSSI that follow the data, both RSSI 0.
+ *
+ * @details For seeding a compression dictionary.
+ *
+ * @return Bytes written. 0 if p_out is too small.
+ */
+size_t codec_fast_tail_encode(uint8_t const *p_peripheral_addr, uint8_t const *p_central_addr,
+                              uint8_t *p_out, size_t size);
+
+/**@brief Function for timing both encoders on the same event.
+ *
+ * @details Encodes p_event runs times with each and adds the cycles to the statistics.
+ *
+ * @retval NRF_SUCCESS        Both gave the same bytes.
+ * @retval NRF_ERROR_INTERNAL They did not, or the generic encoder failed.
+ */
+ret_code_t codec_fast_benchmark(pyrinas_event_t *p_event, uint32_t runs);
+
+/**@brief Function for forgetting every template. Call after changing the codec.
+ */
+void codec_fast_reset(void);
+
+void codec_fast_stats_get(codec_fast_stats_t *p_stats);
+
+#endif
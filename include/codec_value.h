@@ -0,0 +1,112 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef CODEC_VALUE_H
+#define CODEC_VALUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sdk_errors.h"
+
+// Strings never start with \0. Event data that does holds one CBOR item.
+#define CODEC_VALUE_MARKER 0x00
+
+// Fixed layout records generated by bin/schemagen start with this and their schema id.
+#define CODEC_VALUE_RECORD_MARKER 0x01
+
+#ifndef CODEC_VALUE_ARRAY_MAX
+#define CODEC_VALUE_ARRAY_MAX 8 /**< Items of an array value. */
+#endif
+
+/**@brief Types of event data. */
+typedef enum
+{
+    CODEC_VALUE_TEXT,        /**< Untyped data, as published with ble_publish(). */
+    CODEC_VALUE_INT,         /**< CBOR integer. */
+    CODEC_VALUE_FLOAT,       /**< CBOR single precision float. */
+    CODEC_VALUE_BYTES,       /**< CBOR byte string. */
+    CODEC_VALUE_INT_ARRAY,   /**< CBOR array of integers. */
+    CODEC_VALUE_FLOAT_ARRAY, /**< CBOR array of floats. */
+} codec_value_type_t;
+
+/**@brief Value of an event. Text and bytes point into the event data. */
+typedef struct
+{
+    codec_value_type_t type;
+    union
+    {
+        int32_t integer;
+        float real;
+        struct
+        {
+            uint8_t const *p_data;
+            uint16_t len;
+        } bytes; /**< Text or byte string. */
+        struct
+        {
+            union
+            {
+                int32_t integers[CODEC_VALUE_ARRAY_MAX];
+                float reals[CODEC_VALUE_ARRAY_MAX];
+            };
+            uint8_t count;
+        } array;
+    };
+} codec_value_t;
+
+/**@brief Function for checking if event data holds a typed value.
+ */
+static inline bool codec_value_is_typed(uint8_t const *p_data, size_t len)
+{
+    return len > 1 && p_data[0] == CODEC_VALUE_MARKER;
+}
+
+/**@brief Function for encoding a value as event data.
+ *
+ * @retval NRF_SUCCESS             Encoded.
+ * @retval NRF_ERROR_NO_MEM        p_out is too small.
+ * @retval NRF_ERROR_INVALID_PARAM Unknown type or too many items.
+ */
+ret_code_t codec_value_encode(codec_value_t const *p_value, uint8_t *p_out, size_t size, size_t *p_len);
+
+/**@brief Function for decoding event data.
+ *
+ * @details Data without the marker is handed out as CODEC_VALUE_TEXT.
+ *
+ * @retval NRF_SUCCESS            Decoded.
+ * @retval NRF_ERROR_INVALID_DATA Malformed, or an item that does not fit codec_value_t.
+ */
+ret_code_t codec_value_decode(uint8_t const *p_data, size_t len, codec_value_t *p_value);
+
+#endif
@@ -33,14 +33,81 @@
 #ifndef FLASH_H
 #define FLASH_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "lfs.h"
+#include "sdk_errors.h"
 
 #define QSPI_STD_CMD_WRSR 0x01
 #define QSPI_STD_CMD_RSTEN 0x66
 #define QSPI_STD_CMD_RST 0x99
 #define QSPI_MX25_CMD_RDP 0xab
 
+#ifndef FLASH_QUEUE_SIZE
+#define FLASH_QUEUE_SIZE 8 /**< Asynchronous requests that may be outstanding. */
+#endif
+
+#define FLASH_ERASE_SIZE 4096
+
+/**@brief Flash operations. */
+typedef enum
+{
+    FLASH_OP_READ,
+    FLASH_OP_PROG,
+    FLASH_OP_ERASE,
+} flash_op_t;
+
+/**@brief Completed flash request. */
+typedef struct
+{
+    flash_op_t op;
+    uint32_t addr;
+    void *p_data;      /**< Buffer given to the request, NULL for erase. */
+    uint32_t size;     /**< Bytes transferred, FLASH_ERASE_SIZE for erase. */
+    ret_code_t result; /**< NRF_SUCCESS, or the error from starting the transfer. */
+    void *p_context;
+} flash_evt_t;
+
+typedef void (*flash_evt_handler_t)(flash_evt_t const *p_evt);
+
 void flash_init(void);
+
+/**@brief Function for queuing a read.
+ *
+ * @details Requests run in order, one at a time, from the QSPI interrupt.
+ *          The handler is called from @ref flash_process once the request is done.
+ *          p_data must stay valid until then.
+ *
+ * @param[in] p_data Word aligned buffer in RAM.
+ * @param[in] size   Multiple of 4.
+ *
+ * @retval NRF_SUCCESS             Queued.
+ * @retval NRF_ERROR_NO_MEM        FLASH_QUEUE_SIZE requests are outstanding.
+ * @retval NRF_ERROR_INVALID_ADDR  p_data is not word aligned or not in RAM.
+ * @retval NRF_ERROR_INVALID_LENGTH size is 0 or not a multiple of 4.
+ */
+ret_code_t flash_read_async(uint32_t addr, void *p_data, uint32_t size,
+                            flash_evt_handler_t handler, void *p_context);
+
+/**@brief Function for queuing a write. Same as @ref flash_read_async. */
+ret_code_t flash_prog_async(uint32_t addr, void const *p_data, uint32_t size,
+                            flash_evt_handler_t handler, void *p_context);
+
+/**@brief Function for queuing the erase of the FLASH_ERASE_SIZE sector at addr.
+ *
+ * @retval NRF_ERROR_INVALID_ADDR addr is not sector aligned. Otherwise see @ref flash_read_async.
+ */
+ret_code_t flash_erase_async(uint32_t addr, flash_evt_handler_t handler, void *p_context);
+
+/**@brief Function for checking if a transfer is running or queued. */
+bool flash_busy(void);
+
+/**@brief Function for calling the handlers of completed requests. Call from the main loop. */
+void flash_process(void);
+
+// Synchronous, for littlefs. They sleep until the transfer is done, so call them from
+// the main context only.
 int flash_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size);
 int flash_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size);
 int flash_erase(const struct lfs_config *c, lfs_block_t block);
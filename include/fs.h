@@ -44,5 +44,8 @@ void fs_write(const char *filename, const void *data, size_t size);
 void fs_read(const char *filename, void *data, size_t size, size_t *bytes_read);
 void fs_delete(const char *filename);
 bool fs_file_exists(const char *filename);
+void fs_append(const char *filename, const void *data, size_t size);
+void fs_read_at(const char *filename, size_t offset, void *data, size_t size, size_t *bytes_read);
+size_t fs_size(const char *filename);
 
 #endif
\ No newline at end of file
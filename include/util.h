@@ -36,6 +36,7 @@
 #include <stdint.h>
 
 #include "app_timer.h"
+#include "nrf.h"
 #include "nrf_delay.h"
 
 // Delay wrapper
@@ -47,6 +48,42 @@
 #define STRX(a) #a
 #define STR(a) STRX(a)
 
+/**@brief Cycle count statistics of a code path. */
+typedef struct
+{
+    uint32_t count; /**< Runs measured. */
+    uint32_t last;  /**< Cycles of the last run. */
+    uint32_t max;   /**< Cycles of the longest run. */
+    uint64_t total; /**< Cycles of all runs. */
+} util_cycles_stats_t;
+
+/**@brief Function for starting the DWT cycle counter.
+ */
+void util_cycles_init(void);
+
+/**@brief Function for reading the DWT cycle counter. Wraps every 67 s at 64 MHz.
+ */
+static inline uint32_t util_cycles_get(void)
+{
+    return DWT->CYCCNT;
+}
+
+/**@brief Function for adding a run that started at begin to the statistics.
+ */
+static inline void util_cycles_stats_add(util_cycles_stats_t *p_stats, uint32_t begin)
+{
+    uint32_t cycles = DWT->CYCCNT - begin;
+
+    p_stats->count++;
+    p_stats->last = cycles;
+    p_stats->total += cycles;
+
+    if (cycles > p_stats->max)
+    {
+        p_stats->max = cycles;
+    }
+}
+
 void util_print_device_address(bool with_delim);
 void addr_strhex_delim(uint8_t *addr, int size, char *result);
 void addr_strhex_no_delim(uint8_t *addr, int size, char *result);
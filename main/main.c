@@ -117,6 +117,9 @@ int main(void)
         // Process timers
         timer_process();
 
+        // Hand out completed flash requests
+        flash_process();
+
         // App side related
         loop();
 
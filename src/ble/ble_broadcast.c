@@ -0,0 +1,419 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+
+#include "app_error.h"
+#include "app_util.h"
+#include "sdk_macros.h"
+
+#include "ble_advdata.h"
+#include "ble_broadcast.h"
+#include "ble_m.h"
+
+#include "nrf_soc.h"
+
+#include "pyrinas_codec.h"
+
+#define NRF_LOG_MODULE_NAME ble_broadcast
+#include "nrf_log.h"
+NRF_LOG_MODULE_REGISTER();
+
+STATIC_ASSERT(IS_POWER_OF_TWO(BLE_BROADCAST_SENDER_MAX));
+
+/**@brief Last frame seen from a sender. Used to drop repeated advertising events.
+ */
+typedef struct
+{
+    uint8_t addr[BLE_GAP_ADDR_LEN];
+    uint8_t seq;
+    bool valid;
+} ble_broadcast_sender_t;
+
+static uint8_t m_adv_handle = BLE_GAP_ADV_SET_HANDLE_NOT_SET;
+static uint8_t m_adv_buf[BLE_GAP_ADV_SET_DATA_SIZE_EXTENDED_MAX_SUPPORTED];
+static bool m_advertising = false;
+static uint8_t m_tx_seq = 0;
+
+static uint8_t m_scan_buf[BLE_GAP_SCAN_BUFFER_EXTENDED_MIN];
+static ble_data_t m_scan_data = {
+    .p_data = m_scan_buf,
+    .len = sizeof(m_scan_buf),
+};
+static bool m_listening = false;
+static bool m_hub_filter = false;
+static ble_gap_addr_t m_hub_addr;
+
+/**< Low duty cycle scan used to pick up commands. */
+static ble_gap_scan_params_t const m_listen_params = {
+    .active = 0,
+    .interval = BLE_BROADCAST_LISTEN_INTERVAL,
+    .window = BLE_BROADCAST_LISTEN_WINDOW,
+    .filter_policy = BLE_GAP_SCAN_FP_ACCEPT_ALL,
+    .timeout = BLE_GAP_SCAN_TIMEOUT_UNLIMITED,
+    .scan_phys = BLE_GAP_PHY_CODED,
+    .extended = 1,
+};
+
+static ble_broadcast_sender_t m_senders[BLE_BROADCAST_SENDER_MAX];
+
+static raw_susbcribe_handler_t m_raw_evt_handler = NULL;
+
+/**@brief Function for building the manufacturer specific AD structure of a frame.
+ *
+ * @return Length of the advertising data.
+ */
+static uint16_t frame_build(uint8_t *p_buf, uint8_t type, uint8_t seq, uint8_t const *data, size_t size)
+{
+    uint16_t offset = 0;
+
+    p_buf[offset++] = 1 + BLE_BROADCAST_HEADER_SIZE + size;
+    p_buf[offset++] = BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA;
+    offset += uint16_encode(BLE_BROADCAST_COMPANY_ID, &p_buf[offset]);
+    p_buf[offset++] = type;
+    p_buf[offset++] = seq;
+
+    memcpy(&p_buf[offset], data, size);
+
+    return offset + size;
+}
+
+/**@brief Function for (re)starting the advertising set with the contents of m_adv_buf.
+ *
+ * @param[in] len           Length of the advertising data.
+ * @param[in] max_adv_evts  Number of advertising events before stopping. 0 for no limit.
+ * @param[in] duration      Advertising duration in 10 ms units. 0 for no limit.
+ */
+static uint32_t frame_advertise(uint16_t len, uint8_t max_adv_evts, uint16_t duration)
+{
+    ret_code_t err_code;
+    ble_gap_adv_params_t adv_params;
+
+    ble_gap_adv_data_t adv_data = {
+        .adv_data = {
+            .p_data = m_adv_buf,
+            .len = len,
+        },
+        .scan_rsp_data = {
+            .p_data = NULL,
+            .len = 0,
+        },
+    };
+
+    memset(&adv_params, 0, sizeof(adv_params));
+
+    adv_params.properties.type = BLE_GAP_ADV_TYPE_EXTENDED_NONCONNECTABLE_NONSCANNABLE_UNDIRECTED;
+    adv_params.primary_phy = BLE_GAP_PHY_CODED;
+    adv_params.secondary_phy = BLE_GAP_PHY_CODED;
+    adv_params.interval = BLE_BROADCAST_ADV_INTERVAL;
+    adv_params.duration = duration;
+    adv_params.max_adv_evts = max_adv_evts;
+    adv_params.filter_policy = BLE_GAP_ADV_FP_ANY;
+
+    err_code = sd_ble_gap_adv_set_configure(&m_adv_handle, &adv_data, &adv_params);
+    VERIFY_SUCCESS(err_code);
+
+    err_code = sd_ble_gap_tx_power_set(BLE_GAP_TX_POWER_ROLE_ADV, m_adv_handle, APP_ADV_TX_POWER);
+    VERIFY_SUCCESS(err_code);
+
+    err_code = sd_ble_gap_adv_start(m_adv_handle, APP_BLE_CONN_CFG_TAG);
+    VERIFY_SUCCESS(err_code);
+
+    m_advertising = true;
+
+    return NRF_SUCCESS;
+}
+
+/**@brief Function for stopping the frame that is still being advertised (if any).
+ */
+static void frame_stop(void)
+{
+    if (m_advertising)
+    {
+        ret_code_t err_code = sd_ble_gap_adv_stop(m_adv_handle);
+        if (err_code != NRF_ERROR_INVALID_STATE)
+        {
+            APP_ERROR_CHECK(err_code);
+        }
+
+        m_advertising = false;
+    }
+}
+
+uint32_t ble_broadcast_write(uint8_t *data, size_t size)
+{
+    if (size > BLE_BROADCAST_PAYLOAD_MAX)
+    {
+        return NRF_ERROR_DATA_SIZE;
+    }
+
+    frame_stop();
+
+    uint16_t len = frame_build(m_adv_buf, BLE_BROADCAST_FRAME_TELEMETRY, m_tx_seq++, data, size);
+
+    return frame_advertise(len, BLE_BROADCAST_ADV_EVTS, BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED);
+}
+
+uint32_t ble_broadcast_command(uint8_t *data, size_t size)
+{
+    if (size > BLE_BROADCAST_PAYLOAD_MAX)
+    {
+        return NRF_ERROR_DATA_SIZE;
+    }
+
+    frame_stop();
+
+    uint16_t len = frame_build(m_adv_buf, BLE_BROADCAST_FRAME_COMMAND, m_tx_seq++, data, size);
+
+    NRF_LOG_DEBUG("Broadcasting command %d", (uint8_t)(m_tx_seq - 1));
+
+    return frame_advertise(len, 0, BLE_BROADCAST_CMD_DURATION);
+}
+
+/**@brief Function for checking if a frame was already seen from this sender.
+ *
+ * @details Direct mapped on the sender address. A collision evicts the older sender
+ *          which at worst lets one repeat through.
+ */
+static bool sender_is_duplicate(uint8_t const *addr, uint8_t seq)
+{
+    uint32_t hash = 0;
+
+    for (uint8_t i = 0; i < BLE_GAP_ADDR_LEN; i++)
+    {
+        hash = (hash * 31) + addr[i];
+    }
+
+    ble_broadcast_sender_t *p_sender = &m_senders[hash & (BLE_BROADCAST_SENDER_MAX - 1)];
+
+    if (p_sender->valid && p_sender->seq == seq &&
+        memcmp(p_sender->addr, addr, BLE_GAP_ADDR_LEN) == 0)
+    {
+        return true;
+    }
+
+    memcpy(p_sender->addr, addr, BLE_GAP_ADDR_LEN);
+    p_sender->seq = seq;
+    p_sender->valid = true;
+
+    return false;
+}
+
+/**@brief Function for decoding a telemetry frame and handing it to the raw handler.
+ */
+static void on_telemetry(ble_gap_evt_adv_report_t const *p_adv_report, uint8_t const *data, uint16_t size)
+{
+    // Where the data is going
+    static pyrinas_event_t evt;
+
+    int err = pyrinas_codec_decode(&evt, data, size);
+    if (err)
+    {
+        NRF_LOG_ERROR("Unable to decode broadcast data!");
+        return;
+    }
+
+    // The advertiser is the peripheral
+    memcpy(evt.peripheral_addr, p_adv_report->peer_addr.addr, sizeof(evt.peripheral_addr));
+    evt.central_rssi = p_adv_report->rssi;
+
+    // Set our address
+    ble_gap_addr_t gap_addr;
+    sd_ble_gap_addr_get(&gap_addr);
+    memcpy(evt.central_addr, gap_addr.addr, sizeof(evt.central_addr));
+
+    if (m_raw_evt_handler != NULL)
+    {
+        m_raw_evt_handler(&evt);
+    }
+}
+
+/**@brief Function for decoding a command frame and handing it to the raw handler.
+ */
+static void on_command(ble_gap_evt_adv_report_t const *p_adv_report, uint8_t const *data, uint16_t size)
+{
+    // Where the data is going
+    static pyrinas_event_t evt;
+
+    int err = pyrinas_codec_decode(&evt, data, size);
+    if (err)
+    {
+        NRF_LOG_ERROR("Unable to decode broadcast command!");
+        return;
+    }
+
+    // The advertiser is the hub
+    memcpy(evt.central_addr, p_adv_report->peer_addr.addr, sizeof(evt.central_addr));
+    evt.peripheral_rssi = p_adv_report->rssi;
+
+    // Set our address
+    ble_gap_addr_t gap_addr;
+    sd_ble_gap_addr_get(&gap_addr);
+    memcpy(evt.peripheral_addr, gap_addr.addr, sizeof(evt.peripheral_addr));
+
+    if (m_raw_evt_handler != NULL)
+    {
+        m_raw_evt_handler(&evt);
+    }
+}
+
+void ble_broadcast_on_adv_report(ble_gap_evt_adv_report_t const *p_adv_report)
+{
+    uint16_t offset = 0;
+
+    // Chained data that is still being received is ignored
+    if (p_adv_report->type.status != BLE_GAP_ADV_DATA_STATUS_COMPLETE)
+        return;
+
+    uint16_t len = ble_advdata_search(p_adv_report->data.p_data,
+                                      p_adv_report->data.len,
+                                      &offset,
+                                      BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA);
+    if (len < BLE_BROADCAST_HEADER_SIZE)
+        return;
+
+    uint8_t const *p_data = &p_adv_report->data.p_data[offset];
+
+    // Not one of ours
+    if (uint16_decode(p_data) != BLE_BROADCAST_COMPANY_ID)
+        return;
+
+    uint8_t type = p_data[2];
+    uint8_t seq = p_data[3];
+
+    // Listening sensors take commands, hubs take telemetry
+    if ((type == BLE_BROADCAST_FRAME_COMMAND) != m_listening)
+        return;
+
+    // Commands are only taken from our hub
+    if (m_listening && m_hub_filter &&
+        memcmp(p_adv_report->peer_addr.addr, m_hub_addr.addr, BLE_GAP_ADDR_LEN) != 0)
+        return;
+
+    if (sender_is_duplicate(p_adv_report->peer_addr.addr, seq))
+        return;
+
+    switch (type)
+    {
+    case BLE_BROADCAST_FRAME_TELEMETRY:
+        on_telemetry(p_adv_report, &p_data[BLE_BROADCAST_HEADER_SIZE], len - BLE_BROADCAST_HEADER_SIZE);
+        break;
+    case BLE_BROADCAST_FRAME_COMMAND:
+        NRF_LOG_DEBUG("Command %d from hub", seq);
+        on_command(p_adv_report, &p_data[BLE_BROADCAST_HEADER_SIZE], len - BLE_BROADCAST_HEADER_SIZE);
+        break;
+    default:
+        NRF_LOG_DEBUG("Unknown broadcast frame 0x%x", type);
+        break;
+    }
+}
+
+void ble_broadcast_evt_handler(ble_evt_t const *p_ble_evt, void *p_context)
+{
+    switch (p_ble_evt->header.evt_id)
+    {
+    case BLE_GAP_EVT_ADV_SET_TERMINATED:
+        if (p_ble_evt->evt.gap_evt.params.adv_set_terminated.adv_handle == m_adv_handle)
+        {
+            m_advertising = false;
+        }
+        break;
+    case BLE_GAP_EVT_ADV_REPORT:
+        // Only our own listener scan is resumed here. The scan module takes care of the hub.
+        if (m_listening)
+        {
+            ble_broadcast_on_adv_report(&p_ble_evt->evt.gap_evt.params.adv_report);
+
+            ret_code_t err_code = sd_ble_gap_scan_start(NULL, &m_scan_data);
+            if (err_code != NRF_ERROR_INVALID_STATE)
+            {
+                APP_ERROR_CHECK(err_code);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void ble_broadcast_listen_start(ble_gap_addr_t const *p_hub_addr)
+{
+    static uint8_t const any_addr[BLE_GAP_ADDR_LEN] = {0};
+
+    m_hub_filter = (p_hub_addr != NULL) &&
+                   (memcmp(p_hub_addr->addr, any_addr, BLE_GAP_ADDR_LEN) != 0);
+    if (m_hub_filter)
+    {
+        m_hub_addr = *p_hub_addr;
+    }
+
+    ret_code_t err_code = sd_ble_gap_scan_start(&m_listen_params, &m_scan_data);
+    APP_ERROR_CHECK(err_code);
+
+    m_listening = true;
+
+    NRF_LOG_INFO("Listening for broadcast commands.");
+}
+
+void ble_broadcast_listen_stop(void)
+{
+    if (!m_listening)
+        return;
+
+    m_listening = false;
+
+    ret_code_t err_code = sd_ble_gap_scan_stop();
+    if (err_code != NRF_ERROR_INVALID_STATE)
+    {
+        APP_ERROR_CHECK(err_code);
+    }
+}
+
+void ble_broadcast_attach_raw_handler(raw_susbcribe_handler_t raw_evt_handler)
+{
+    m_raw_evt_handler = raw_evt_handler;
+}
+
+void ble_broadcast_init(void)
+{
+    m_advertising = false;
+    memset(m_senders, 0, sizeof(m_senders));
+
+    // Random start so a rebooted sender does not repeat the last sequence number
+    uint8_t available = 0;
+    sd_rand_application_bytes_available_get(&available);
+    if (available)
+    {
+        ret_code_t err_code = sd_rand_application_vector_get(&m_tx_seq, sizeof(m_tx_seq));
+        APP_ERROR_CHECK(err_code);
+    }
+}
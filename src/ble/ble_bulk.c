@@ -0,0 +1,574 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+
+#include "app_error.h"
+#include "app_util.h"
+#include "app_util_platform.h"
+
+#include "ble_bulk.h"
+#include "ble_conn_mgr.h"
+#include "fs.h"
+#include "systick.h"
+
+#define NRF_LOG_MODULE_NAME ble_bulk
+#include "nrf_log.h"
+NRF_LOG_MODULE_REGISTER();
+
+/**@brief Where the bytes of a transfer come from. */
+typedef enum
+{
+    BULK_SRC_NONE,    /**< No transfer running. */
+    BULK_SRC_BUFFER,  /**< Straight from the caller's buffer. */
+    BULK_SRC_FILE,    /**< Read from littlefs into the TX buffers. */
+    BULK_SRC_PATTERN, /**< Generated into the TX buffers. */
+} bulk_src_t;
+
+/**@brief Bulk channel on one link. */
+typedef struct
+{
+    uint16_t conn_handle;                             /**< Handle of the connection, BLE_CONN_HANDLE_INVALID if the slot is free. */
+    uint16_t cid;                                     /**< Local channel ID. BLE_L2CAP_CID_INVALID until set up. */
+    bool connected;                                   /**< Setup completed. */
+    uint16_t tx_mtu;                                  /**< Largest SDU the peer takes, capped at BLE_BULK_MTU. */
+    uint8_t rx_buf[BLE_BULK_RX_BUFFERS][BLE_BULK_MTU]; /**< SDU buffers owned by the SoftDevice. */
+    uint8_t tx_buf[BLE_BULK_TX_BUFFERS][BLE_BULK_MTU]; /**< Copies of file and pattern data in flight. */
+    volatile uint8_t tx_in_flight;                    /**< SDUs handed to the SoftDevice and not released yet. */
+    uint8_t tx_slot;                                  /**< Next TX buffer. SDUs are released in order. */
+    uint16_t tx_slot_len;                             /**< Bytes already filled into the next TX buffer. */
+    bulk_src_t src;                                   /**< Source of the running transfer. */
+    uint8_t const *p_data;                            /**< Buffer of a BULK_SRC_BUFFER transfer. */
+    const char *filename;                             /**< File of a BULK_SRC_FILE transfer. */
+    size_t size;                                      /**< Bytes of the transfer. */
+    size_t offset;                                    /**< Bytes handed to the SoftDevice. */
+    systick_ticks_t start_ticks;                      /**< When the transfer started. */
+} bulk_channel_t;
+
+static bulk_channel_t m_channels[BLE_BULK_CHANNEL_COUNT];
+static ble_bulk_evt_handler_t m_evt_handler = NULL;
+static bool m_init_complete = false;
+static ble_bulk_stats_t m_stats;
+
+/**@brief Function for finding the channel of a link.
+ *
+ * @param[in] conn_handle  Connection handle. BLE_CONN_HANDLE_INVALID finds a free slot.
+ */
+static bulk_channel_t *channel_get(uint16_t conn_handle)
+{
+    for (int i = 0; i < BLE_BULK_CHANNEL_COUNT; i++)
+    {
+        if (m_channels[i].conn_handle == conn_handle)
+        {
+            return &m_channels[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void channel_reset(bulk_channel_t *p_ch)
+{
+    p_ch->conn_handle = BLE_CONN_HANDLE_INVALID;
+    p_ch->cid = BLE_L2CAP_CID_INVALID;
+    p_ch->connected = false;
+    p_ch->tx_mtu = 0;
+    p_ch->tx_in_flight = 0;
+    p_ch->tx_slot = 0;
+    p_ch->tx_slot_len = 0;
+    p_ch->src = BULK_SRC_NONE;
+}
+
+static void evt_send(ble_bulk_evt_t const *p_evt)
+{
+    if (m_evt_handler != NULL)
+    {
+        m_evt_handler(p_evt);
+    }
+}
+
+/**@brief Function for ending the running transfer of a channel.
+ */
+static void transfer_end(bulk_channel_t *p_ch, bool success)
+{
+    ble_bulk_evt_t evt;
+
+    evt.evt_type = success ? BLE_BULK_EVT_TX_DONE : BLE_BULK_EVT_TX_FAILED;
+    evt.conn_handle = p_ch->conn_handle;
+    evt.params.tx.bytes = p_ch->offset;
+    evt.params.tx.ms = systick_get_diff_now(p_ch->start_ticks);
+
+    p_ch->src = BULK_SRC_NONE;
+
+    if (success)
+    {
+        m_stats.transfers++;
+        m_stats.bytes = evt.params.tx.bytes;
+        m_stats.ms = evt.params.tx.ms;
+
+        NRF_LOG_INFO("Bulk: %d bytes in %d ms", evt.params.tx.bytes, evt.params.tx.ms);
+    }
+    else
+    {
+        NRF_LOG_WARNING("Bulk transfer failed after %d bytes", evt.params.tx.bytes);
+    }
+
+    evt_send(&evt);
+}
+
+/**@brief Function for handing the SoftDevice the receive buffers after setup.
+ *
+ * @details The first buffer was given with the setup itself.
+ */
+static void rx_buffers_give(bulk_channel_t *p_ch)
+{
+    for (int i = 1; i < BLE_BULK_RX_BUFFERS; i++)
+    {
+        ble_data_t sdu_buf = {.p_data = p_ch->rx_buf[i], .len = BLE_BULK_MTU};
+
+        ret_code_t err_code = sd_ble_l2cap_ch_rx(p_ch->conn_handle, p_ch->cid, &sdu_buf);
+        APP_ERROR_CHECK(err_code);
+    }
+
+    // Let the peer send a whole SDU per buffer without waiting for credits
+    ret_code_t err_code = sd_ble_l2cap_ch_flow_control(p_ch->conn_handle, p_ch->cid, BLE_BULK_RX_CREDITS, NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
+static void rx_params_get(bulk_channel_t *p_ch, ble_l2cap_ch_setup_params_t *p_params)
+{
+    memset(p_params, 0, sizeof(ble_l2cap_ch_setup_params_t));
+
+    p_params->rx_params.rx_mtu = BLE_BULK_MTU;
+    p_params->rx_params.rx_mps = BLE_BULK_MPS;
+    p_params->rx_params.sdu_buf.p_data = p_ch->rx_buf[0];
+    p_params->rx_params.sdu_buf.len = BLE_BULK_MTU;
+    p_params->le_psm = BLE_BULK_PSM;
+}
+
+void ble_bulk_cfg_set(uint8_t conn_cfg_tag, uint32_t ram_start)
+{
+    ble_cfg_t ble_cfg;
+
+    memset(&ble_cfg, 0, sizeof(ble_cfg));
+    ble_cfg.conn_cfg.conn_cfg_tag = conn_cfg_tag;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.rx_mps = BLE_BULK_MPS;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.tx_mps = BLE_BULK_MPS;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.rx_queue_size = BLE_BULK_RX_BUFFERS;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.tx_queue_size = BLE_BULK_TX_BUFFERS;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.ch_count = 1;
+
+    ret_code_t err_code = sd_ble_cfg_set(BLE_CONN_CFG_L2CAP, &ble_cfg, ram_start);
+    APP_ERROR_CHECK(err_code);
+}
+
+void ble_bulk_init(ble_bulk_evt_handler_t evt_handler)
+{
+    for (int i = 0; i < BLE_BULK_CHANNEL_COUNT; i++)
+    {
+        channel_reset(&m_channels[i]);
+    }
+
+    m_evt_handler = evt_handler;
+    m_init_complete = true;
+}
+
+ret_code_t ble_bulk_connect(uint16_t conn_handle)
+{
+    if (!m_init_complete)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    // Already up or on its way
+    if (channel_get(conn_handle) != NULL)
+    {
+        return NRF_SUCCESS;
+    }
+
+    bulk_channel_t *p_ch = channel_get(BLE_CONN_HANDLE_INVALID);
+    if (p_ch == NULL)
+    {
+        return NRF_ERROR_NO_MEM;
+    }
+
+    ble_l2cap_ch_setup_params_t params;
+    rx_params_get(p_ch, &params);
+
+    uint16_t cid = BLE_L2CAP_CID_INVALID;
+
+    ret_code_t err_code = sd_ble_l2cap_ch_setup(conn_handle, &cid, &params);
+    VERIFY_SUCCESS(err_code);
+
+    p_ch->conn_handle = conn_handle;
+    p_ch->cid = cid;
+
+    return NRF_SUCCESS;
+}
+
+bool ble_bulk_is_connected(uint16_t conn_handle)
+{
+    bulk_channel_t *p_ch = channel_get(conn_handle);
+
+    return (p_ch != NULL) && p_ch->connected;
+}
+
+bool ble_bulk_is_busy(uint16_t conn_handle)
+{
+    bulk_channel_t *p_ch = channel_get(conn_handle);
+
+    return (p_ch != NULL) && (p_ch->src != BULK_SRC_NONE);
+}
+
+/**@brief Function for starting a transfer. The SDUs go out from ble_bulk_process().
+ */
+static ret_code_t transfer_start(uint16_t conn_handle, bulk_src_t src, size_t size)
+{
+    bulk_channel_t *p_ch = channel_get(conn_handle);
+
+    if (conn_handle == BLE_CONN_HANDLE_INVALID || p_ch == NULL || !p_ch->connected)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    if (p_ch->src != BULK_SRC_NONE)
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    p_ch->size = size;
+    p_ch->offset = 0;
+    p_ch->tx_slot_len = 0;
+    p_ch->start_ticks = systick_get_ticks();
+    p_ch->src = src;
+
+    return NRF_SUCCESS;
+}
+
+ret_code_t ble_bulk_send(uint16_t conn_handle, uint8_t const *data, size_t size)
+{
+    bulk_channel_t *p_ch = channel_get(conn_handle);
+
+    if (p_ch != NULL && p_ch->src == BULK_SRC_NONE)
+    {
+        p_ch->p_data = data;
+    }
+
+    return transfer_start(conn_handle, BULK_SRC_BUFFER, size);
+}
+
+ret_code_t ble_bulk_send_file(uint16_t conn_handle, const char *filename)
+{
+    size_t size = fs_size(filename);
+    if (size == 0)
+    {
+        return NRF_ERROR_NOT_FOUND;
+    }
+
+    bulk_channel_t *p_ch = channel_get(conn_handle);
+
+    if (p_ch != NULL && p_ch->src == BULK_SRC_NONE)
+    {
+        p_ch->filename = filename;
+    }
+
+    return transfer_start(conn_handle, BULK_SRC_FILE, size);
+}
+
+ret_code_t ble_bulk_send_pattern(uint16_t conn_handle, size_t size)
+{
+    return transfer_start(conn_handle, BULK_SRC_PATTERN, size);
+}
+
+void ble_bulk_stats_get(ble_bulk_stats_t *p_stats)
+{
+    *p_stats = m_stats;
+}
+
+/**@brief Function for handing the SoftDevice as many SDUs of a transfer as it takes.
+ */
+static void channel_feed(bulk_channel_t *p_ch)
+{
+    while (p_ch->offset < p_ch->size && p_ch->tx_in_flight < BLE_BULK_TX_BUFFERS)
+    {
+        uint16_t len = MIN(p_ch->size - p_ch->offset, p_ch->tx_mtu);
+        uint8_t *p_slot = p_ch->tx_buf[p_ch->tx_slot];
+        ble_data_t sdu;
+
+        sdu.len = len;
+
+        switch (p_ch->src)
+        {
+        case BULK_SRC_BUFFER:
+            sdu.p_data = (uint8_t *)&p_ch->p_data[p_ch->offset];
+            break;
+
+        case BULK_SRC_FILE:
+            // Kept if the SoftDevice had no room last time
+            if (p_ch->tx_slot_len != len)
+            {
+                size_t bytes_read = 0;
+
+                fs_read_at(p_ch->filename, p_ch->offset, p_slot, len, &bytes_read);
+                if (bytes_read != len)
+                {
+                    transfer_end(p_ch, false);
+                    return;
+                }
+
+                p_ch->tx_slot_len = len;
+            }
+            sdu.p_data = p_slot;
+            break;
+
+        case BULK_SRC_PATTERN:
+            for (uint16_t i = 0; i < len; i++)
+            {
+                p_slot[i] = (uint8_t)(p_ch->offset + i);
+            }
+            sdu.p_data = p_slot;
+            break;
+
+        default:
+            return;
+        }
+
+        ret_code_t err_code = sd_ble_l2cap_ch_tx(p_ch->conn_handle, p_ch->cid, &sdu);
+
+        // Out of credits or queue space. Try again after CH_CREDIT or CH_TX.
+        if (err_code == NRF_ERROR_RESOURCES)
+        {
+            m_stats.tx_stalled++;
+            break;
+        }
+        else if (err_code != NRF_SUCCESS)
+        {
+            NRF_LOG_WARNING("Bulk TX error 0x%x", err_code);
+            transfer_end(p_ch, false);
+            return;
+        }
+
+        CRITICAL_REGION_ENTER();
+        p_ch->tx_in_flight++;
+        CRITICAL_REGION_EXIT();
+
+        p_ch->tx_slot = (p_ch->tx_slot + 1) % BLE_BULK_TX_BUFFERS;
+        p_ch->tx_slot_len = 0;
+        p_ch->offset += len;
+    }
+
+    // Keep the connection interval short until the end
+    ble_conn_mgr_demand(p_ch->conn_handle);
+
+    if (p_ch->offset == p_ch->size && p_ch->tx_in_flight == 0)
+    {
+        transfer_end(p_ch, true);
+    }
+}
+
+void ble_bulk_process(void)
+{
+    if (!m_init_complete)
+    {
+        return;
+    }
+
+    for (int i = 0; i < BLE_BULK_CHANNEL_COUNT; i++)
+    {
+        bulk_channel_t *p_ch = &m_channels[i];
+
+        if (p_ch->connected && p_ch->src != BULK_SRC_NONE)
+        {
+            channel_feed(p_ch);
+        }
+    }
+}
+
+/**@brief Function for answering a channel request of the peer.
+ */
+static void on_ch_setup_request(ble_l2cap_evt_t const *p_evt)
+{
+    ble_l2cap_ch_setup_params_t params;
+    uint16_t cid = p_evt->local_cid;
+    bulk_channel_t *p_ch = NULL;
+
+    memset(&params, 0, sizeof(params));
+
+    if (p_evt->params.ch_setup_request.le_psm != BLE_BULK_PSM)
+    {
+        params.status = BLE_L2CAP_CH_STATUS_CODE_LE_PSM_NOT_SUPPORTED;
+    }
+    else if ((p_ch = channel_get(BLE_CONN_HANDLE_INVALID)) == NULL)
+    {
+        params.status = BLE_L2CAP_CH_STATUS_CODE_NO_RESOURCES;
+    }
+    else
+    {
+        rx_params_get(p_ch, &params);
+        params.status = BLE_L2CAP_CH_STATUS_CODE_SUCCESS;
+    }
+
+    ret_code_t err_code = sd_ble_l2cap_ch_setup(p_evt->conn_handle, &cid, &params);
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Bulk setup reply failed. Err: 0x%x", err_code);
+        return;
+    }
+
+    if (params.status == BLE_L2CAP_CH_STATUS_CODE_SUCCESS)
+    {
+        p_ch->conn_handle = p_evt->conn_handle;
+        p_ch->cid = cid;
+    }
+}
+
+/**@brief Function for releasing the channel of a link.
+ */
+static void on_ch_released(uint16_t conn_handle)
+{
+    bulk_channel_t *p_ch = channel_get(conn_handle);
+    if (p_ch == NULL || conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        return;
+    }
+
+    bool connected = p_ch->connected;
+
+    if (p_ch->src != BULK_SRC_NONE)
+    {
+        transfer_end(p_ch, false);
+    }
+
+    channel_reset(p_ch);
+
+    if (connected)
+    {
+        ble_bulk_evt_t evt = {.evt_type = BLE_BULK_EVT_DISCONNECTED, .conn_handle = conn_handle};
+        evt_send(&evt);
+    }
+}
+
+void ble_bulk_on_ble_evt(ble_evt_t const *p_ble_evt)
+{
+    if (!m_init_complete)
+    {
+        return;
+    }
+
+    ble_l2cap_evt_t const *p_evt = &p_ble_evt->evt.l2cap_evt;
+    bulk_channel_t *p_ch;
+
+    switch (p_ble_evt->header.evt_id)
+    {
+    case BLE_L2CAP_EVT_CH_SETUP_REQUEST:
+        on_ch_setup_request(p_evt);
+        break;
+
+    case BLE_L2CAP_EVT_CH_SETUP:
+        p_ch = channel_get(p_evt->conn_handle);
+        if (p_ch == NULL)
+        {
+            break;
+        }
+
+        p_ch->cid = p_evt->local_cid;
+        p_ch->tx_mtu = MIN(p_evt->params.ch_setup.tx_params.tx_mtu, BLE_BULK_MTU);
+        p_ch->connected = true;
+
+        rx_buffers_give(p_ch);
+
+        NRF_LOG_INFO("Bulk channel up on 0x%x. TX MTU %d", p_evt->conn_handle, p_ch->tx_mtu);
+
+        {
+            ble_bulk_evt_t evt = {.evt_type = BLE_BULK_EVT_CONNECTED, .conn_handle = p_evt->conn_handle};
+            evt_send(&evt);
+        }
+        break;
+
+    case BLE_L2CAP_EVT_CH_SETUP_REFUSED:
+        NRF_LOG_INFO("Bulk channel refused by 0x%x", p_evt->conn_handle);
+        on_ch_released(p_evt->conn_handle);
+        break;
+
+    case BLE_L2CAP_EVT_CH_RELEASED:
+        on_ch_released(p_evt->conn_handle);
+        break;
+
+    case BLE_L2CAP_EVT_CH_RX:
+        p_ch = channel_get(p_evt->conn_handle);
+        if (p_ch == NULL)
+        {
+            break;
+        }
+
+        m_stats.rx_bytes += p_evt->params.rx.sdu_len;
+
+        {
+            ble_bulk_evt_t evt;
+
+            evt.evt_type = BLE_BULK_EVT_RX;
+            evt.conn_handle = p_evt->conn_handle;
+            evt.params.rx.p_data = p_evt->params.rx.sdu_buf.p_data;
+            evt.params.rx.len = p_evt->params.rx.sdu_len;
+
+            evt_send(&evt);
+        }
+
+        // The handler is done with it. Back to the SoftDevice.
+        {
+            ble_data_t sdu_buf = {.p_data = p_evt->params.rx.sdu_buf.p_data, .len = BLE_BULK_MTU};
+
+            ret_code_t err_code = sd_ble_l2cap_ch_rx(p_evt->conn_handle, p_evt->local_cid, &sdu_buf);
+            if (err_code != NRF_SUCCESS)
+            {
+                NRF_LOG_WARNING("Bulk RX buffer lost. Err: 0x%x", err_code);
+            }
+        }
+        break;
+
+    case BLE_L2CAP_EVT_CH_TX:
+        p_ch = channel_get(p_evt->conn_handle);
+        if (p_ch != NULL && p_ch->tx_in_flight > 0)
+        {
+            p_ch->tx_in_flight--;
+        }
+        break;
+
+    case BLE_GAP_EVT_DISCONNECTED:
+        on_ch_released(p_ble_evt->evt.gap_evt.conn_handle);
+        break;
+
+    default:
+        // Credits are picked up by the next ble_bulk_process()
+        break;
+    }
+}
@@ -41,13 +41,16 @@
 
 #include "app_timer.h"
 #include "bsp.h"
+#include "systick.h"
 #include "util.h"
 
-#include "ble_advdata.h"
+#include "ble_broadcast.h"
+#include "ble_bulk.h"
 #include "ble_central.h"
 #include "ble_conn_state.h"
 #include "ble_db_discovery.h"
 #include "ble_m.h"
+#include "ble_pb.h"
 #include "ble_pb_c.h"
 
 #include "nrf_ble_qwr.h"
@@ -61,16 +64,31 @@
 #include "nrf_log.h"
 NRF_LOG_MODULE_REGISTER();
 
-#define FIRST_CONN_PARAMS_UPDATE_DELAY APP_TIMER_TICKS(5000) /**< Time from initiating event (connect or start of notification) to first time sd_ble_gap_conn_param_update is called (5 seconds). */
-#define NEXT_CONN_PARAMS_UPDATE_DELAY APP_TIMER_TICKS(30000) /**< Time between each call to sd_ble_gap_conn_param_update after the first call (30 seconds). */
-#define MAX_CONN_PARAMS_UPDATE_COUNT 3                       /**< Number of attempts before giving up the connection parameter negotiation. */
-
 #define APP_SOC_OBSERVER_PRIO 1 /**< SoC observer priority of the application. There is no need to modify this value. */
-#define DEV_NAME_LEN ((BLE_GAP_ADV_SET_DATA_SIZE_MAX + 1) - \
-                      AD_DATA_OFFSET) /**< Determines the device name length. */
 
-BLE_DB_DISCOVERY_DEF(m_db_discovery);                  /**< Database Discovery module instance. */
-NRF_BLE_SCAN_DEF(m_scan);                              /**< Scanning Module instance. */
+#define ADV_CACHE_SIZE 32       /**< Recently seen advertising reports. Power of two. */
+#define ADV_CACHE_WINDOW_MS 500 /**< Identical reports within this window are dropped. */
+
+STATIC_ASSERT(IS_POWER_OF_TWO(ADV_CACHE_SIZE));
+
+#define SCAN_CANDIDATE_WINDOW_MS 300 /**< How long matches are collected before connecting to the strongest. */
+
+/**@brief Entry of the advertising report cache.
+ */
+typedef struct
+{
+    uint32_t hash;        /**< Hash of address and advertising data. 0 if unused. */
+    systick_ticks_t seen; /**< When the report was last let through. */
+} adv_cache_entry_t;
+
+static void scan_on_ble_evt(ble_evt_t const *p_ble_evt, void *p_context);
+
+BLE_DB_DISCOVERY_DEF(m_db_discovery); /**< Database Discovery module instance. */
+
+// Scanning Module instance. Events pass through the report cache before reaching the module.
+static nrf_ble_scan_t m_scan;
+NRF_SDH_BLE_OBSERVER(m_scan_ble_obs, NRF_BLE_SCAN_OBSERVER_PRIO, scan_on_ble_evt, &m_scan);
+
 BLE_PB_C_DEF(m_pb_c);                                  /**< Protobuf service client module instance. */
 NRF_BLE_QWRS_DEF(m_qwr, NRF_SDH_BLE_TOTAL_LINK_COUNT); /**< Context for the Queued Write module.*/
 NRF_BLE_GQ_DEF(m_ble_gatt_queue,                       /**< BLE GATT Queue instance. */
@@ -79,10 +97,21 @@ NRF_BLE_GQ_DEF(m_ble_gatt_queue,                       /**< BLE GATT Queue insta
 
 static bool m_memory_access_in_progress = false; /**< Flag to keep track of the ongoing operations on persistent memory. */
 static bool m_scan_on_disconnect_enabled = true;
+static bool m_scan_initialized = false; /**< m_scan is set up. Only then are its events handled here. */
+static bool m_scanning = false;         /**< m_scan was started and has not stopped since. */
 
 static ble_central_init_t m_config;
 
 static raw_susbcribe_handler_t m_raw_evt_handler = NULL;
+static raw_bytes_handler_t m_raw_bytes_handler = NULL; /**< Takes encoded events when decoding is deferred. */
+
+static adv_cache_entry_t m_adv_cache[ADV_CACHE_SIZE];
+static ble_central_scan_stats_t m_scan_stats;
+
+APP_TIMER_DEF(m_candidate_timer);          /**< Closes the candidate window when connecting strongest first. */
+static bool m_candidate_valid = false;     /**< A candidate was seen in the current window. */
+static ble_gap_addr_t m_candidate_addr;    /**< Address of the strongest candidate so far. */
+static int8_t m_candidate_rssi;            /**< RSSI of the strongest candidate so far. */
 
 /**< Scan parameters requested for scanning and connection. */
 static ble_gap_scan_params_t const m_scan_param =
@@ -118,6 +147,25 @@ static void db_disc_handler(ble_db_discovery_evt_t *p_evt)
     ble_pb_on_db_disc_evt(&m_pb_c, p_evt);
 }
 
+/**@brief Function for fetching the last event of every topic from a peer, if configured.
+ *
+ * @param[in] conn_handle Link whose notifications were just enabled.
+ */
+static void snapshot_read(uint16_t conn_handle)
+{
+    if (!m_config.snapshot_read)
+    {
+        return;
+    }
+
+    // Older peripherals have no snapshot
+    ret_code_t err_code = ble_pb_c_snapshot_read(&m_pb_c, conn_handle);
+    if (err_code != NRF_ERROR_NOT_SUPPORTED)
+    {
+        APP_ERROR_CHECK(err_code);
+    }
+}
+
 /**@brief Function for handling Heart Rate Collector events.
  *
  * @param[in] p_pb_c       Pointer to Heart Rate Client structure.
@@ -158,6 +206,8 @@ static void pb_c_evt_handler(ble_pb_c_t *p_pb_c, ble_pb_c_evt_t *p_evt)
             err_code = ble_pb_c_notif_enable(p_pb_c, p_evt->conn_handle);
             APP_ERROR_CHECK(err_code);
 
+            snapshot_read(p_evt->conn_handle);
+
             // Get RSSI data
             err_code = sd_ble_gap_rssi_start(p_evt->conn_handle, 0, 100);
             APP_ERROR_CHECK(err_code);
@@ -165,12 +215,20 @@ static void pb_c_evt_handler(ble_pb_c_t *p_pb_c, ble_pb_c_evt_t *p_evt)
         else
         {
             // Set the flag to be handled later in the pm_evt
-            m_pb_c.notify_enable_on_secure[p_evt->conn_handle] = true;
+            ble_pb_c_link_get(p_pb_c, p_evt->conn_handle)->notify_enable_on_secure = true;
         }
 
-        // Continue scan if not full yet.
-        if ((ble_conn_state_central_conn_count() < m_config.device_count) &&
-            (ble_conn_state_central_conn_count() < NRF_SDH_BLE_CENTRAL_LINK_COUNT))
+        // Open the bulk channel if the stack has one
+        err_code = ble_bulk_connect(p_evt->conn_handle);
+        if (err_code != NRF_SUCCESS && err_code != NRF_ERROR_INVALID_STATE)
+        {
+            NRF_LOG_WARNING("Unable to open bulk channel. Err: 0x%x", err_code);
+        }
+
+        // Continue scan if not full yet or when listening for broadcasts.
+        if (m_config.broadcast_ingest ||
+            ((ble_conn_state_central_conn_count() < m_config.device_count) &&
+             (ble_conn_state_central_conn_count() < NRF_SDH_BLE_CENTRAL_LINK_COUNT)))
         {
             ble_central_scan_start();
         }
@@ -183,7 +241,7 @@ static void pb_c_evt_handler(ble_pb_c_t *p_pb_c, ble_pb_c_evt_t *p_evt)
         if (m_raw_evt_handler != NULL)
         {
             // Tag on RSSI
-            p_evt->params.data.central_rssi = p_pb_c->rssi[p_evt->conn_handle];
+            p_evt->params.data.central_rssi = ble_pb_c_link_get(p_pb_c, p_evt->conn_handle)->rssi;
 
             // Set the address
             ble_gap_addr_t gap_addr;
@@ -198,6 +256,16 @@ static void pb_c_evt_handler(ble_pb_c_t *p_pb_c, ble_pb_c_evt_t *p_evt)
 
         break;
 
+    case BLE_PB_C_EVT_RAW:
+        // Decoded and tagged in the main context
+        if (m_raw_bytes_handler != NULL)
+        {
+            m_raw_bytes_handler(p_evt->params.raw.p_data, p_evt->params.raw.len,
+                                ble_pb_c_link_get(p_pb_c, p_evt->conn_handle)->rssi);
+        }
+
+        break;
+
     default:
         break;
     }
@@ -220,10 +288,88 @@ static void multi_qwr_conn_handle_assign(uint16_t conn_handle)
     }
 }
 
+/**@brief Function for forgetting the strongest candidate of the current window.
+ */
+static void candidate_clear(void)
+{
+    m_candidate_valid = false;
+
+    ret_code_t err_code = app_timer_stop(m_candidate_timer);
+    APP_ERROR_CHECK(err_code);
+}
+
+/**@brief Function for handling the end of the candidate window.
+ *
+ * @details Scanning is stopped and a connection is made to the strongest peer
+ *          that matched the filters during the window.
+ */
+static void candidate_timer_handler(void *p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    if (!m_candidate_valid)
+    {
+        return;
+    }
+
+    m_candidate_valid = false;
+
+    nrf_ble_scan_stop();
+    m_scanning = false;
+
+    NRF_LOG_INFO("Connecting to strongest candidate. RSSI: %i", m_candidate_rssi);
+
+    ret_code_t err_code = sd_ble_gap_connect(&m_candidate_addr,
+                                             &m_scan_param,
+                                             &m_scan.conn_params,
+                                             APP_BLE_CONN_CFG_TAG);
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Unable to connect. Err: 0x%x", err_code);
+        ble_central_scan_start();
+    }
+}
+
+/**@brief Function for handling a peer that passed the scan filters.
+ *
+ * @details Only used when connecting strongest first. The first match opens the
+ *          candidate window, later ones replace the candidate if they are stronger.
+ *
+ * @param[in] p_adv_report  Advertising report that matched.
+ */
+static void on_filter_match(ble_gap_evt_adv_report_t const *p_adv_report)
+{
+    if (!m_config.strongest_first || !p_adv_report->type.connectable)
+    {
+        return;
+    }
+
+    m_scan_stats.candidates++;
+
+    if (!m_candidate_valid)
+    {
+        m_candidate_valid = true;
+        m_candidate_rssi = p_adv_report->rssi;
+        m_candidate_addr = p_adv_report->peer_addr;
+
+        ret_code_t err_code = app_timer_start(m_candidate_timer, APP_TIMER_TICKS(SCAN_CANDIDATE_WINDOW_MS), NULL);
+        APP_ERROR_CHECK(err_code);
+    }
+    else if (p_adv_report->rssi > m_candidate_rssi)
+    {
+        m_candidate_rssi = p_adv_report->rssi;
+        m_candidate_addr = p_adv_report->peer_addr;
+    }
+}
+
 static void scan_evt_handler(scan_evt_t const *p_scan_evt)
 {
     switch (p_scan_evt->scan_evt_id)
     {
+    case NRF_BLE_SCAN_EVT_FILTER_MATCH:
+        on_filter_match(p_scan_evt->params.filter_match.p_adv_report);
+        break;
+
     case NRF_BLE_SCAN_EVT_SCAN_TIMEOUT:
         NRF_LOG_DEBUG("Scan timed out.");
         ble_central_scan_start();
@@ -245,6 +391,7 @@ static void pb_c_init(void)
     pb_c_init_obj.evt_handler = pb_c_evt_handler;
     pb_c_init_obj.error_handler = service_error_handler;
     pb_c_init_obj.p_gatt_queue = &m_ble_gatt_queue;
+    pb_c_init_obj.defer_decode = (m_raw_bytes_handler != NULL);
 
     ret_code_t err_code = ble_pb_c_init(&m_pb_c, &pb_c_init_obj);
     APP_ERROR_CHECK(err_code);
@@ -267,53 +414,144 @@ static void db_discovery_init(void)
 }
 
 /**@brief Function for handling the advertising report BLE event.
+ *
+ * @details Connections are made by the scan module. Here we only pick up
+ *          connectionless telemetry from broadcasting sensors.
  *
  * @param[in] p_adv_report  Advertising report from the SoftDevice.
  */
 static void on_adv_report(ble_gap_evt_adv_report_t const *p_adv_report)
 {
-    // uint32_t err_code;
-    uint8_t *p_adv_data;
-    uint16_t data_len;
-    uint16_t field_len;
-    uint16_t dev_name_offset = 0;
-    char dev_name[DEV_NAME_LEN];
-
-    // Initialize advertisement report for parsing.
-    p_adv_data = (uint8_t *)p_adv_report->data.p_data;
-    data_len = p_adv_report->data.len;
-
-    // Search for advertising names.
-    field_len = ble_advdata_search(p_adv_data,
-                                   data_len,
-                                   &dev_name_offset,
-                                   BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME);
-    if (field_len == 0)
+    // Non-connectable extended reports only
+    if (p_adv_report->type.connectable || !p_adv_report->type.extended_pdu)
+        return;
+
+    ble_broadcast_on_adv_report(p_adv_report);
+}
+
+/**@brief Function for checking if an identical report was let through recently.
+ *
+ * @details Hashes the peer address and advertising data (FNV-1a) into a direct
+ *          mapped cache. Reports that match within ADV_CACHE_WINDOW_MS are duplicates.
+ *
+ * @param[in] p_adv_report  Advertising report from the SoftDevice.
+ *
+ * @retval true if the report should be dropped.
+ */
+static bool adv_cache_is_duplicate(ble_gap_evt_adv_report_t const *p_adv_report)
+{
+    uint32_t hash = 2166136261u;
+
+    hash = (hash ^ p_adv_report->peer_addr.addr_type) * 16777619u;
+
+    for (uint8_t i = 0; i < BLE_GAP_ADDR_LEN; i++)
+    {
+        hash = (hash ^ p_adv_report->peer_addr.addr[i]) * 16777619u;
+    }
+
+    for (uint16_t i = 0; i < p_adv_report->data.len; i++)
+    {
+        hash = (hash ^ p_adv_report->data.p_data[i]) * 16777619u;
+    }
+
+    // Keep 0 free to mark unused entries
+    hash |= 1;
+
+    adv_cache_entry_t *p_entry = &m_adv_cache[hash & (ADV_CACHE_SIZE - 1)];
+
+    if (p_entry->hash == hash && systick_get_diff_now(p_entry->seen) < ADV_CACHE_WINDOW_MS)
+    {
+        m_scan_stats.cache_hits++;
+        return true;
+    }
+
+    p_entry->hash = hash;
+    p_entry->seen = systick_get_ticks();
+    m_scan_stats.cache_misses++;
+
+    return false;
+}
+
+/**@brief Function for resuming scanning after a report was dropped.
+ *
+ * @details Only called while m_scan is running, so it never restarts another module's scan.
+ */
+static void scan_resume(nrf_ble_scan_t *p_scan)
+{
+    ret_code_t err_code = sd_ble_gap_scan_start(NULL, &p_scan->scan_buffer);
+    if (err_code != NRF_ERROR_INVALID_STATE)
     {
-        // Look for the short local name if it was not found as complete.
-        field_len = ble_advdata_search(p_adv_data,
-                                       data_len,
-                                       &dev_name_offset,
-                                       BLE_GAP_AD_TYPE_SHORT_LOCAL_NAME);
-        if (field_len == 0)
+        APP_ERROR_CHECK(err_code);
+    }
+}
+
+/**@brief Function for handling BLE events for the Scanning Module.
+ *
+ * @details Duplicate advertising reports are dropped before they are parsed by
+ *          the broadcast ingest and the scan filters. Connectable peers below the
+ *          RSSI floor never reach the filters either. The SoftDevice pauses
+ *          scanning on every report, so it has to be resumed here for dropped ones.
+ */
+static void scan_on_ble_evt(ble_evt_t const *p_ble_evt, void *p_context)
+{
+    nrf_ble_scan_t *p_scan = (nrf_ble_scan_t *)p_context;
+
+    // Reports from another module's scan, ble_broadcast's for one, are not ours to resume
+    if (!m_scan_initialized)
+    {
+        return;
+    }
+
+    switch (p_ble_evt->header.evt_id)
+    {
+    case BLE_GAP_EVT_CONNECTED:
+        // Connecting stops the scan
+        if (p_ble_evt->evt.gap_evt.params.connected.role == BLE_GAP_ROLE_CENTRAL)
         {
-            // Exit if the data cannot be parsed.
-            return;
+            m_scanning = false;
+        }
+        break;
+
+    case BLE_GAP_EVT_TIMEOUT:
+        if (p_ble_evt->evt.gap_evt.params.timeout.src == BLE_GAP_TIMEOUT_SRC_SCAN)
+        {
+            m_scanning = false;
         }
+        break;
+
+    default:
+        break;
     }
 
-    memcpy(dev_name, &p_adv_data[dev_name_offset], field_len);
-    dev_name[field_len] = 0;
+    if (p_ble_evt->header.evt_id == BLE_GAP_EVT_ADV_REPORT)
+    {
+        if (!m_scanning)
+        {
+            return;
+        }
 
-    NRF_LOG_INFO("Found advertising device: %s", nrf_log_push((char *)dev_name));
-    NRF_LOG_HEXDUMP_INFO(p_adv_report->peer_addr.addr, BLE_GAP_ADDR_LEN);
+        ble_gap_evt_adv_report_t const *p_adv_report = &p_ble_evt->evt.gap_evt.params.adv_report;
 
-    // TODO: Connect to the peer
-    // err_code = sd_ble_gap_connect(&p_adv_report->peer_addr,
-    //                               &m_scan.scan_params,
-    //                               &m_scan.conn_params,
-    //                               APP_BLE_CONN_CFG_TAG);
-    // APP_ERROR_CHECK(err_code);
+        if (adv_cache_is_duplicate(p_adv_report))
+        {
+            scan_resume(p_scan);
+            return;
+        }
+
+        on_adv_report(p_adv_report);
+
+        // A weak peer would only give a marginal link
+        if (p_adv_report->type.connectable &&
+            (m_config.min_rssi != 0) &&
+            (p_adv_report->rssi < m_config.min_rssi))
+        {
+            m_scan_stats.rssi_dropped++;
+            scan_resume(p_scan);
+            return;
+        }
+    }
+
+    nrf_ble_scan_on_ble_evt(p_ble_evt, p_context);
 }
 
 /**@brief Function for initializing scanning.
@@ -325,13 +563,25 @@ static void scan_init(void)
 
     memset(&init_scan, 0, sizeof(init_scan));
 
-    init_scan.connect_if_match = true;
+    // Strongest first connects from the candidate window instead
+    init_scan.connect_if_match = !m_config.strongest_first;
     init_scan.conn_cfg_tag = APP_BLE_CONN_CFG_TAG;
 
     err_code = nrf_ble_scan_init(&m_scan, &init_scan, scan_evt_handler);
     APP_ERROR_CHECK(err_code);
 
-    // Only enable filters if there are devices.
+    // Only peers running the Protobuf service are worth connecting to.
+    ble_uuid_t pb_uuid = {
+        .uuid = PROTOBUF_UUID_SERVICE,
+        .type = m_pb_c.uuid_type,
+    };
+
+    err_code = nrf_ble_scan_filter_set(&m_scan, SCAN_UUID_FILTER, &pb_uuid);
+    APP_ERROR_CHECK(err_code);
+
+    uint8_t filters = NRF_BLE_SCAN_UUID_FILTER;
+
+    // Narrow it down to the configured devices if there are any.
     if (m_config.device_count)
     {
         // Iterate through all the available addresses
@@ -344,16 +594,14 @@ static void scan_init(void)
             APP_ERROR_CHECK(err_code);
         }
 
-        // TODO: scan by UUID also?
-        // err_code = nrf_ble_scan_filter_set(&m_scan, SCAN_UUID_FILTER, &m_nus_uuid);
-        // APP_ERROR_CHECK(err_code);
-
-        // Eanble the filters.
-        err_code = nrf_ble_scan_filters_enable(&m_scan,
-                                               NRF_BLE_SCAN_ALL_FILTER,
-                                               false);
-        APP_ERROR_CHECK(err_code);
+        filters |= NRF_BLE_SCAN_ADDR_FILTER;
     }
+
+    // Enable the filters. Address and UUID both have to match.
+    err_code = nrf_ble_scan_filters_enable(&m_scan, filters, true);
+    APP_ERROR_CHECK(err_code);
+
+    m_scan_initialized = true;
 }
 
 void ble_central_evt_handler(ble_evt_t const *p_ble_evt, void *p_context)
@@ -411,16 +659,14 @@ void ble_central_evt_handler(ble_evt_t const *p_ble_evt, void *p_context)
             ble_central_scan_start();
         break;
 
-    case BLE_GAP_EVT_ADV_REPORT:
-        // TODO: necessary?
-        // on_adv_report(&p_gap_evt->params.adv_report);
-        UNUSED_VARIABLE(on_adv_report);
-        break;
-
     case BLE_GAP_EVT_TIMEOUT:
         if (p_gap_evt->params.timeout.src == BLE_GAP_TIMEOUT_SRC_CONN)
         {
             NRF_LOG_INFO("Connection Request timed out.");
+
+            // Look for another candidate
+            if (m_scan_on_disconnect_enabled)
+                ble_central_scan_start();
         }
         break;
 
@@ -478,8 +724,14 @@ void ble_central_evt_handler(ble_evt_t const *p_ble_evt, void *p_context)
         break;
     case BLE_GAP_EVT_RSSI_CHANGED:
         NRF_LOG_DEBUG("Rssi changed! %i on %i", p_ble_evt->evt.gap_evt.params.rssi_changed.rssi, p_ble_evt->evt.gap_evt.conn_handle);
-        m_pb_c.rssi[p_ble_evt->evt.gap_evt.conn_handle] = p_ble_evt->evt.gap_evt.params.rssi_changed.rssi;
-        break;
+    {
+        ble_pb_c_link_t *p_link = ble_pb_c_link_get(&m_pb_c, p_ble_evt->evt.gap_evt.conn_handle);
+        if (p_link != NULL)
+        {
+            p_link->rssi = p_ble_evt->evt.gap_evt.params.rssi_changed.rssi;
+        }
+    }
+    break;
     default:
         // No implementation needed.
         break;
@@ -500,11 +752,17 @@ void ble_central_scan_start(void)
         return;
     }
 
+    // Start fresh so a retried target is not held back by the cache
+    memset(m_adv_cache, 0, sizeof(m_adv_cache));
+    candidate_clear();
+
     err_code = nrf_ble_scan_params_set(&m_scan, &m_scan_param);
     APP_ERROR_CHECK(err_code);
 
     err_code = nrf_ble_scan_start(&m_scan);
     APP_ERROR_CHECK(err_code);
+
+    m_scanning = true;
 }
 
 /**@brief Function for handling the system events of the application.
@@ -581,6 +839,9 @@ void ble_central_init(ble_central_init_t *init)
 
     NRF_SDH_SOC_OBSERVER(m_soc_observer, APP_SOC_OBSERVER_PRIO, soc_evt_handler, NULL);
 
+    err_code = app_timer_create(&m_candidate_timer, APP_TIMER_MODE_SINGLE_SHOT, candidate_timer_handler);
+    APP_ERROR_CHECK(err_code);
+
     tx_power_init(); // Set TX power
     db_discovery_init();
     pb_c_init();
@@ -592,17 +853,25 @@ void ble_central_write(uint8_t *data, size_t size)
     // TODO: best way of handling non connection
     // Write to all connection handles
 
-    for (int i = 0; i < NRF_SDH_BLE_TOTAL_LINK_COUNT; i++)
+    for (int i = 0; i < m_pb_c.link_count; i++)
     {
-        uint16_t conn_handle = m_pb_c.conn_handles[i];
+        uint16_t conn_handle = m_pb_c.links[i].conn_handle;
 
-        if (conn_handle != BLE_CONN_HANDLE_INVALID)
+        if (m_pb_c.links[i].assigned)
         {
             ret_code_t err_code = ble_pb_c_write(&m_pb_c, conn_handle, data, size);
             if (err_code == NRF_ERROR_INVALID_STATE)
             {
                 NRF_LOG_WARNING("Not connected. Unable to send message.");
             }
+            else if (err_code == NRF_ERROR_DATA_SIZE)
+            {
+                NRF_LOG_WARNING("Message too large for 0x%x. Size: %d", conn_handle, size);
+            }
+            else if (err_code == NRF_ERROR_NO_MEM)
+            {
+                NRF_LOG_WARNING("GATT queue full. Message dropped.");
+            }
             else
             {
                 APP_ERROR_CHECK(err_code);
@@ -611,6 +880,38 @@ void ble_central_write(uint8_t *data, size_t size)
     }
 }
 
+void ble_central_attach_raw_bytes_handler(raw_bytes_handler_t raw_bytes_handler)
+{
+    m_raw_bytes_handler = raw_bytes_handler;
+}
+
+void ble_central_rx_cycles_get(util_cycles_stats_t *p_stats)
+{
+    *p_stats = m_pb_c.rx_cycles;
+}
+
+void ble_central_mtu_set(uint16_t conn_handle, uint16_t mtu)
+{
+    ble_pb_c_mtu_set(&m_pb_c, conn_handle, mtu);
+}
+
+uint8_t ble_central_peer_caps_get(void)
+{
+    uint8_t caps = 0xff;
+    bool any = false;
+
+    for (int i = 0; i < m_pb_c.link_count; i++)
+    {
+        if (m_pb_c.links[i].assigned)
+        {
+            caps &= m_pb_c.links[i].peer_caps;
+            any = true;
+        }
+    }
+
+    return any ? caps : 0;
+}
+
 void ble_central_attach_raw_handler(raw_susbcribe_handler_t raw_evt_handler)
 {
     m_raw_evt_handler = raw_evt_handler;
@@ -626,13 +927,15 @@ void ble_central_disconnect()
 
     // Stop scanning
     nrf_ble_scan_stop();
+    m_scanning = false;
+    candidate_clear();
 
     // Check all the handles. If one is valid, return true
-    for (int i = 0; i < NRF_SDH_BLE_TOTAL_LINK_COUNT; i++)
+    for (int i = 0; i < m_pb_c.link_count; i++)
     {
-        uint16_t conn_handle = m_pb_c.conn_handles[i];
+        uint16_t conn_handle = m_pb_c.links[i].conn_handle;
 
-        if (conn_handle != BLE_CONN_HANDLE_INVALID)
+        if (m_pb_c.links[i].assigned)
         {
             err_code = sd_ble_gap_disconnect(conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
             if (err_code != NRF_ERROR_INVALID_STATE)
@@ -651,20 +954,24 @@ void ble_central_pm_evt_handler(pm_evt_t const *p_evt)
     switch (p_evt->evt_id)
     {
     case PM_EVT_CONN_SEC_SUCCEEDED:
+    {
         NRF_LOG_INFO("Conn secure");
 
         // If the notification_enable flag is set do it here
-        if (m_pb_c.notify_enable_on_secure[p_evt->conn_handle])
+        ble_pb_c_link_t *p_link = ble_pb_c_link_get(&m_pb_c, p_evt->conn_handle);
+        if (p_link != NULL && p_link->notify_enable_on_secure)
         {
             // Enable notifications
             err_code = ble_pb_c_notif_enable(&m_pb_c, p_evt->conn_handle);
             APP_ERROR_CHECK(err_code);
 
+            snapshot_read(p_evt->conn_handle);
+
             // Disable
-            m_pb_c.notify_enable_on_secure[p_evt->conn_handle] = false;
+            p_link->notify_enable_on_secure = false;
         }
-
-        break;
+    }
+    break;
     case PM_EVT_CONN_SEC_FAILED:
         if (p_evt->params.conn_sec_failed.error == PM_CONN_SEC_ERROR_PIN_OR_KEY_MISSING)
         {
@@ -687,15 +994,18 @@ void ble_central_pm_evt_handler(pm_evt_t const *p_evt)
     }
 }
 
+void ble_central_scan_stats_get(ble_central_scan_stats_t *p_stats)
+{
+    *p_stats = m_scan_stats;
+}
+
 bool ble_central_is_connected(void)
 {
 
-    // Check all the handles. If one is valid, return true
-    for (int i = 0; i < NRF_SDH_BLE_TOTAL_LINK_COUNT; i++)
+    // Check the live links. If one has its handles, return true
+    for (int i = 0; i < m_pb_c.link_count; i++)
     {
-        uint16_t conn_handle = m_pb_c.conn_handles[i];
-
-        if (conn_handle != BLE_CONN_HANDLE_INVALID)
+        if (m_pb_c.links[i].assigned)
         {
             return true;
         }
@@ -0,0 +1,278 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+
+#include "app_util.h"
+#include "crc16.h"
+
+#include "ble_comp.h"
+
+#define NRF_LOG_MODULE_NAME ble_comp
+#include "nrf_log.h"
+NRF_LOG_MODULE_REGISTER();
+
+#define MATCH_SIZE 2 /**< Bytes of a match token. 12 bit distance, 4 bit length. */
+
+static uint8_t m_dict[BLE_COMP_DICT_SIZE];
+static size_t m_dict_len = 0;
+static uint16_t m_dict_id = 0xffff; /**< CRC16 of the empty dictionary. */
+
+static ble_comp_stats_t m_stats;
+
+/**@brief Function for reading the window, the dictionary followed by the data.
+ */
+static inline uint8_t window_get(uint8_t const *p_data, size_t pos)
+{
+    return pos < m_dict_len ? m_dict[pos] : p_data[pos - m_dict_len];
+}
+
+ret_code_t ble_comp_dict_add(uint8_t const *p_data, size_t len)
+{
+    if (m_dict_len + len > sizeof(m_dict))
+    {
+        return NRF_ERROR_NO_MEM;
+    }
+
+    memcpy(&m_dict[m_dict_len], p_data, len);
+    m_dict_len += len;
+    m_dict_id = crc16_compute(m_dict, m_dict_len, NULL);
+
+    return NRF_SUCCESS;
+}
+
+uint16_t ble_comp_dict_id(void)
+{
+    return m_dict_id;
+}
+
+/**@brief Function for finding the longest match for the data at pos.
+ *
+ * @details Plain search over the window. Events are a few hundred bytes so this stays
+ *          cheaper than the RAM of a hash chain.
+ *
+ * @return  Length of the match. Less than BLE_COMP_MATCH_MIN if there is none worth a token.
+ */
+static size_t match_find(uint8_t const *p_in, size_t in_len, size_t pos, size_t *p_distance)
+{
+    size_t cur = m_dict_len + pos;
+    size_t start = cur > BLE_COMP_DISTANCE_MAX ? cur - BLE_COMP_DISTANCE_MAX : 0;
+    size_t len_max = MIN(in_len - pos, BLE_COMP_MATCH_MAX);
+    size_t best = 0;
+
+    for (size_t i = start; i < cur; i++)
+    {
+        // Cheap reject before the full compare
+        if (window_get(p_in, i) != p_in[pos])
+        {
+            continue;
+        }
+
+        size_t len = 1;
+        while (len < len_max && window_get(p_in, i + len) == p_in[pos + len])
+        {
+            len++;
+        }
+
+        // Nearer wins on a tie
+        if (len >= best)
+        {
+            best = len;
+            *p_distance = cur - i;
+        }
+    }
+
+    return best;
+}
+
+ret_code_t ble_comp_compress(uint8_t const *p_in, size_t in_len, uint8_t *p_out, size_t out_size, size_t *p_out_len)
+{
+    uint32_t begin = util_cycles_get();
+
+    // Not worth it if it does not end up smaller
+    size_t out_max = MIN(out_size, in_len - 1);
+    size_t out = BLE_COMP_HEADER_SIZE;
+    size_t flags = 0;
+    uint8_t bit = 8;
+    size_t pos = 0;
+
+    m_stats.bytes_in += in_len;
+
+    if (in_len <= BLE_COMP_HEADER_SIZE || out_max <= BLE_COMP_HEADER_SIZE)
+    {
+        goto skip;
+    }
+
+    p_out[0] = BLE_COMP_MARKER;
+    uint16_encode(m_dict_id, &p_out[1]);
+
+    while (pos < in_len)
+    {
+        // Next flag byte every 8 tokens
+        if (bit == 8)
+        {
+            if (out >= out_max)
+            {
+                goto skip;
+            }
+
+            flags = out++;
+            p_out[flags] = 0;
+            bit = 0;
+        }
+
+        size_t distance = 0;
+        size_t len = match_find(p_in, in_len, pos, &distance);
+
+        if (len >= BLE_COMP_MATCH_MIN)
+        {
+            if (out + MATCH_SIZE > out_max)
+            {
+                goto skip;
+            }
+
+            p_out[flags] |= (1 << bit);
+            p_out[out++] = (uint8_t)(distance - 1);
+            p_out[out++] = (uint8_t)((((distance - 1) >> 8) << 4) | (len - BLE_COMP_MATCH_MIN));
+            pos += len;
+        }
+        else
+        {
+            if (out >= out_max)
+            {
+                goto skip;
+            }
+
+            p_out[out++] = p_in[pos++];
+        }
+
+        bit++;
+    }
+
+    *p_out_len = out;
+
+    m_stats.frames++;
+    m_stats.bytes_out += out;
+    util_cycles_stats_add(&m_stats.cycles, begin);
+
+    return NRF_SUCCESS;
+
+skip:
+    m_stats.skipped++;
+    m_stats.bytes_out += in_len;
+    util_cycles_stats_add(&m_stats.cycles, begin);
+
+    return NRF_ERROR_DATA_SIZE;
+}
+
+ret_code_t ble_comp_decompress(uint8_t const *p_in, size_t in_len, uint8_t *p_out, size_t out_size, size_t *p_out_len)
+{
+    if (!ble_comp_is_compressed(p_in, in_len))
+    {
+        return NRF_ERROR_INVALID_DATA;
+    }
+
+    if (uint16_decode(&p_in[1]) != m_dict_id)
+    {
+        return NRF_ERROR_NOT_FOUND;
+    }
+
+    size_t in = BLE_COMP_HEADER_SIZE;
+    size_t out = 0;
+    uint8_t flags = 0;
+    uint8_t bit = 8;
+
+    while (in < in_len)
+    {
+        if (bit == 8)
+        {
+            flags = p_in[in++];
+            bit = 0;
+
+            // A flag byte with no tokens after it only ends a frame
+            if (in == in_len)
+            {
+                break;
+            }
+        }
+
+        if (flags & (1 << bit))
+        {
+            if (in + MATCH_SIZE > in_len)
+            {
+                return NRF_ERROR_INVALID_DATA;
+            }
+
+            size_t distance = (p_in[in] | ((p_in[in + 1] >> 4) << 8)) + 1;
+            size_t len = (p_in[in + 1] & 0x0f) + BLE_COMP_MATCH_MIN;
+            size_t cur = m_dict_len + out;
+            in += MATCH_SIZE;
+
+            if (distance > cur)
+            {
+                return NRF_ERROR_INVALID_DATA;
+            }
+
+            if (out + len > out_size)
+            {
+                return NRF_ERROR_DATA_SIZE;
+            }
+
+            // Byte by byte. A match may overlap what it produces.
+            for (size_t i = 0; i < len; i++)
+            {
+                p_out[out] = window_get(p_out, cur - distance + i);
+                out++;
+            }
+        }
+        else
+        {
+            if (out >= out_size)
+            {
+                return NRF_ERROR_DATA_SIZE;
+            }
+
+            p_out[out++] = p_in[in++];
+        }
+
+        bit++;
+    }
+
+    *p_out_len = out;
+
+    return NRF_SUCCESS;
+}
+
+void ble_comp_stats_get(ble_comp_stats_t *p_stats)
+{
+    *p_stats = m_stats;
+}
@@ -0,0 +1,406 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+
+#include "app_error.h"
+#include "app_timer.h"
+#include "app_util.h"
+
+#include "ble_conn_mgr.h"
+#include "systick.h"
+
+#define NRF_LOG_MODULE_NAME ble_conn_mgr
+#include "nrf_log.h"
+NRF_LOG_MODULE_REGISTER();
+
+#define PARAM_UPDATE_TIMEOUT_MS 5000 /**< A central may reject a request without an event. Try again after this long. */
+
+/**@brief Managed link.
+ */
+typedef struct
+{
+    uint16_t conn_handle;          /**< Handle of the connection, BLE_CONN_HANDLE_INVALID if the slot is free. */
+    bool burst;                    /**< Burst parameters wanted. */
+    bool requested_burst;          /**< What the last request asked for. */
+    bool update_pending;           /**< Waiting for BLE_GAP_EVT_CONN_PARAM_UPDATE. */
+    bool retry_due;                /**< The central granted other parameters. Ask again on the retry timer. */
+    uint8_t retries;               /**< Requests for the same parameters that were not granted. */
+    systick_ticks_t request_ticks; /**< When the last update was requested. */
+    systick_ticks_t demand_ticks;  /**< Last time the link had a backlog. */
+    systick_ticks_t params_ticks;  /**< When the current parameters were last accounted. */
+    ble_gap_conn_params_t params;  /**< Parameters in use on the link. */
+} conn_mgr_link_t;
+
+APP_TIMER_DEF(m_hold_timer);
+APP_TIMER_DEF(m_retry_timer);
+
+static bool m_initialized = false;
+static conn_mgr_link_t m_links[NRF_SDH_BLE_PERIPHERAL_LINK_COUNT];
+static ble_conn_mgr_stats_t m_stats;
+
+static ble_gap_conn_params_t const m_burst_params = {
+    .min_conn_interval = BLE_CONN_MGR_BURST_MIN_INTERVAL,
+    .max_conn_interval = BLE_CONN_MGR_BURST_MAX_INTERVAL,
+    .slave_latency = 0,
+    .conn_sup_timeout = BLE_CONN_MGR_SUP_TIMEOUT,
+};
+
+static ble_gap_conn_params_t const m_idle_params = {
+    .min_conn_interval = BLE_CONN_MGR_IDLE_MIN_INTERVAL,
+    .max_conn_interval = BLE_CONN_MGR_IDLE_MAX_INTERVAL,
+    .slave_latency = BLE_CONN_MGR_IDLE_SLAVE_LATENCY,
+    .conn_sup_timeout = BLE_CONN_MGR_SUP_TIMEOUT,
+};
+
+/**@brief Function for finding a managed link.
+ *
+ * @param[in] conn_handle  Connection handle. BLE_CONN_HANDLE_INVALID finds a free slot.
+ *
+ * @return Pointer to the link, NULL if there is none.
+ */
+static conn_mgr_link_t *link_get(uint16_t conn_handle)
+{
+    for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+        if (m_links[i].conn_handle == conn_handle)
+        {
+            return &m_links[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**@brief Function for accounting the time a link spent on its current parameters.
+ */
+static void link_stats_update(conn_mgr_link_t *p_link)
+{
+    systick_ticks_t elapsed = systick_get_diff_now(p_link->params_ticks);
+    p_link->params_ticks = systick_get_ticks();
+
+    // Granted parameters have min == max
+    uint32_t interval_us = p_link->params.max_conn_interval * 1250;
+
+    if (interval_us == 0)
+    {
+        return;
+    }
+
+    if (p_link->params.max_conn_interval >= m_idle_params.min_conn_interval)
+    {
+        m_stats.idle_ms += elapsed;
+    }
+    else
+    {
+        m_stats.burst_ms += elapsed;
+    }
+
+    m_stats.conn_events += ((uint64_t)elapsed * 1000) / ((uint64_t)interval_us * (p_link->params.slave_latency + 1));
+}
+
+/**@brief Function for checking if a parameter update is still running on a link.
+ */
+static bool link_update_pending(conn_mgr_link_t *p_link)
+{
+    return p_link->update_pending && (systick_get_diff_now(p_link->request_ticks) < PARAM_UPDATE_TIMEOUT_MS);
+}
+
+/**@brief Function for checking if a link got an interval in the range it asked for.
+ */
+static bool link_params_met(conn_mgr_link_t const *p_link)
+{
+    ble_gap_conn_params_t const *p_params = p_link->burst ? &m_burst_params : &m_idle_params;
+
+    return p_link->params.max_conn_interval >= p_params->min_conn_interval &&
+           p_link->params.max_conn_interval <= p_params->max_conn_interval;
+}
+
+/**@brief Function for requesting the parameters a link should be on.
+ */
+static void link_params_request(conn_mgr_link_t *p_link)
+{
+    ble_gap_conn_params_t const *p_params = p_link->burst ? &m_burst_params : &m_idle_params;
+
+    // New demand, new tries
+    if (p_link->requested_burst != p_link->burst)
+    {
+        p_link->requested_burst = p_link->burst;
+        p_link->retries = 0;
+    }
+
+    p_link->retry_due = false;
+
+    ret_code_t err_code = sd_ble_gap_conn_param_update(p_link->conn_handle, p_params);
+    if (err_code == NRF_SUCCESS || err_code == NRF_ERROR_BUSY)
+    {
+        // Checked again once the running procedure completes
+        p_link->update_pending = true;
+        p_link->request_ticks = systick_get_ticks();
+    }
+    else if (err_code != NRF_ERROR_INVALID_STATE)
+    {
+        NRF_LOG_WARNING("Unable to update parameters. Err: 0x%x", err_code);
+        m_stats.update_failures++;
+    }
+}
+
+/**@brief Function for (re)starting the hold timer.
+ */
+static void hold_timer_start(uint32_t timeout_ms)
+{
+    ret_code_t err_code = app_timer_stop(m_hold_timer);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_start(m_hold_timer, APP_TIMER_TICKS(MAX(timeout_ms, 1)), NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
+/**@brief Function for asking again on links where the central granted other parameters.
+ */
+static void retry_timer_handler(void *p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+        conn_mgr_link_t *p_link = &m_links[i];
+
+        if (p_link->conn_handle != BLE_CONN_HANDLE_INVALID && p_link->retry_due &&
+            !link_update_pending(p_link) && !link_params_met(p_link))
+        {
+            link_params_request(p_link);
+        }
+    }
+}
+
+/**@brief Function for moving links without recent demand to the idle parameters.
+ */
+static void hold_timer_handler(void *p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    uint32_t next_ms = 0;
+
+    for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+        conn_mgr_link_t *p_link = &m_links[i];
+
+        if (p_link->conn_handle == BLE_CONN_HANDLE_INVALID || !p_link->burst)
+        {
+            continue;
+        }
+
+        uint32_t quiet_ms = systick_get_diff_now(p_link->demand_ticks);
+
+        if (quiet_ms >= BLE_CONN_MGR_IDLE_HOLD_MS)
+        {
+            NRF_LOG_DEBUG("Link 0x%x idle", p_link->conn_handle);
+
+            p_link->burst = false;
+            m_stats.switches_idle++;
+
+            if (!link_update_pending(p_link))
+            {
+                link_params_request(p_link);
+            }
+        }
+        else if (next_ms == 0 || (BLE_CONN_MGR_IDLE_HOLD_MS - quiet_ms) < next_ms)
+        {
+            next_ms = BLE_CONN_MGR_IDLE_HOLD_MS - quiet_ms;
+        }
+    }
+
+    // Some links are still busy
+    if (next_ms)
+    {
+        hold_timer_start(next_ms);
+    }
+}
+
+void ble_conn_mgr_demand(uint16_t conn_handle)
+{
+    if (!m_initialized)
+    {
+        return;
+    }
+
+    conn_mgr_link_t *p_link = link_get(conn_handle);
+    if (p_link == NULL || conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        return;
+    }
+
+    p_link->demand_ticks = systick_get_ticks();
+
+    if (!p_link->burst)
+    {
+        NRF_LOG_DEBUG("Link 0x%x burst", conn_handle);
+
+        p_link->burst = true;
+        m_stats.switches_burst++;
+
+        if (!link_update_pending(p_link))
+        {
+            link_params_request(p_link);
+        }
+
+        hold_timer_start(BLE_CONN_MGR_IDLE_HOLD_MS);
+    }
+}
+
+void ble_conn_mgr_stats_get(ble_conn_mgr_stats_t *p_stats)
+{
+    for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+        if (m_links[i].conn_handle != BLE_CONN_HANDLE_INVALID)
+        {
+            link_stats_update(&m_links[i]);
+        }
+    }
+
+    *p_stats = m_stats;
+}
+
+void ble_conn_mgr_evt_handler(ble_evt_t const *p_ble_evt, void *p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    if (!m_initialized)
+    {
+        return;
+    }
+
+    ble_gap_evt_t const *p_gap_evt = &p_ble_evt->evt.gap_evt;
+    conn_mgr_link_t *p_link;
+
+    switch (p_ble_evt->header.evt_id)
+    {
+    case BLE_GAP_EVT_CONNECTED:
+        // Only links where we are the peripheral
+        if (p_gap_evt->params.connected.role != BLE_GAP_ROLE_PERIPH)
+        {
+            break;
+        }
+
+        p_link = link_get(BLE_CONN_HANDLE_INVALID);
+        if (p_link == NULL)
+        {
+            break;
+        }
+
+        // Discovery and bonding follow. Go idle once they are done.
+        p_link->conn_handle = p_gap_evt->conn_handle;
+        p_link->burst = true;
+        p_link->requested_burst = true;
+        p_link->update_pending = false;
+        p_link->retry_due = false;
+        p_link->retries = 0;
+        p_link->demand_ticks = systick_get_ticks();
+        p_link->params_ticks = systick_get_ticks();
+        p_link->params = p_gap_evt->params.connected.conn_params;
+
+        hold_timer_start(BLE_CONN_MGR_IDLE_HOLD_MS);
+        break;
+
+    case BLE_GAP_EVT_DISCONNECTED:
+        p_link = link_get(p_gap_evt->conn_handle);
+        if (p_link != NULL)
+        {
+            link_stats_update(p_link);
+            p_link->conn_handle = BLE_CONN_HANDLE_INVALID;
+        }
+        break;
+
+    case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+        p_link = link_get(p_gap_evt->conn_handle);
+        if (p_link == NULL)
+        {
+            break;
+        }
+
+        link_stats_update(p_link);
+
+        p_link->params = p_gap_evt->params.conn_param_update.conn_params;
+        p_link->update_pending = false;
+
+        m_stats.wake_latency_ms = (p_link->params.max_conn_interval * 1250 * (p_link->params.slave_latency + 1)) / 1000;
+
+        NRF_LOG_DEBUG("Link 0x%x interval %d latency %d",
+                      p_link->conn_handle,
+                      p_link->params.max_conn_interval,
+                      p_link->params.slave_latency);
+
+        p_link->retry_due = false;
+
+        // Demand changed while the update was running
+        if (p_link->burst != p_link->requested_burst)
+        {
+            link_params_request(p_link);
+        }
+        // Refused, or something in between granted. Ask again later, a few times.
+        else if (!link_params_met(p_link) && p_link->retries < BLE_CONN_MGR_RETRY_MAX)
+        {
+            p_link->retries++;
+            p_link->retry_due = true;
+
+            ret_code_t err_code = app_timer_stop(m_retry_timer);
+            APP_ERROR_CHECK(err_code);
+
+            err_code = app_timer_start(m_retry_timer, APP_TIMER_TICKS(BLE_CONN_MGR_RETRY_MS), NULL);
+            APP_ERROR_CHECK(err_code);
+        }
+        break;
+
+    default:
+        // No implementation needed.
+        break;
+    }
+}
+
+void ble_conn_mgr_init(void)
+{
+    ret_code_t err_code = app_timer_create(&m_hold_timer, APP_TIMER_MODE_SINGLE_SHOT, hold_timer_handler);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_create(&m_retry_timer, APP_TIMER_MODE_SINGLE_SHOT, retry_timer_handler);
+    APP_ERROR_CHECK(err_code);
+
+    for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+        m_links[i].conn_handle = BLE_CONN_HANDLE_INVALID;
+    }
+
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    m_initialized = true;
+}
@@ -0,0 +1,125 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+
+#include "app_util.h"
+
+#include "ble_frag.h"
+
+#define NRF_LOG_MODULE_NAME ble_frag
+#include "nrf_log.h"
+NRF_LOG_MODULE_REGISTER();
+
+void ble_frag_rx_reset(ble_frag_rx_t *p_rx)
+{
+    p_rx->len = 0;
+    p_rx->seq = 0;
+    p_rx->active = false;
+}
+
+ble_frag_rx_result_t ble_frag_rx_put(ble_frag_rx_t *p_rx, uint8_t const *p_pdu, uint16_t len)
+{
+    if (len < BLE_FRAG_HEADER_SIZE)
+    {
+        return BLE_FRAG_RX_ERROR;
+    }
+
+    uint8_t header = p_pdu[0];
+    uint8_t seq = header & BLE_FRAG_SEQ_MASK;
+    uint16_t payload_len = len - BLE_FRAG_HEADER_SIZE;
+
+    // A stalled sender leaves a partial event behind
+    if (p_rx->active && systick_get_diff_now(p_rx->last_ticks) > BLE_FRAG_RX_TIMEOUT_MS)
+    {
+        NRF_LOG_WARNING("Reassembly timed out after %d bytes.", p_rx->len);
+        ble_frag_rx_reset(p_rx);
+    }
+
+    if (header & BLE_FRAG_START)
+    {
+        // A new event replaces an unfinished one
+        if (p_rx->active)
+        {
+            NRF_LOG_WARNING("Reassembly restarted after %d bytes.", p_rx->len);
+        }
+
+        p_rx->len = 0;
+        p_rx->active = true;
+    }
+    else if (!p_rx->active || seq != p_rx->seq)
+    {
+        // Lost the start or a PDU in between
+        ble_frag_rx_reset(p_rx);
+        return BLE_FRAG_RX_ERROR;
+    }
+
+    if (p_rx->len + payload_len > sizeof(p_rx->data))
+    {
+        ble_frag_rx_reset(p_rx);
+        return BLE_FRAG_RX_ERROR;
+    }
+
+    memcpy(&p_rx->data[p_rx->len], &p_pdu[BLE_FRAG_HEADER_SIZE], payload_len);
+    p_rx->len += payload_len;
+    p_rx->seq = (seq + 1) & BLE_FRAG_SEQ_MASK;
+    p_rx->last_ticks = systick_get_ticks();
+
+    if (header & BLE_FRAG_END)
+    {
+        p_rx->active = false;
+        return BLE_FRAG_RX_COMPLETE;
+    }
+
+    return BLE_FRAG_RX_PENDING;
+}
+
+uint16_t ble_frag_build(uint8_t *p_pdu, uint8_t const *data, size_t size, size_t offset, uint16_t payload_max, uint8_t seq)
+{
+    uint16_t payload_len = MIN(size - offset, payload_max);
+
+    p_pdu[0] = seq & BLE_FRAG_SEQ_MASK;
+
+    if (offset == 0)
+    {
+        p_pdu[0] |= BLE_FRAG_START;
+    }
+
+    if (offset + payload_len == size)
+    {
+        p_pdu[0] |= BLE_FRAG_END;
+    }
+
+    memcpy(&p_pdu[BLE_FRAG_HEADER_SIZE], &data[offset], payload_len);
+
+    return BLE_FRAG_HEADER_SIZE + payload_len;
+}
@@ -44,7 +44,11 @@
 #include "fds.h"
 #include "nordic_common.h"
 
+#include "ble_broadcast.h"
+#include "ble_bulk.h"
 #include "ble_central.h"
+#include "ble_comp.h"
+#include "ble_conn_mgr.h"
 #include "ble_m.h"
 #include "ble_peripheral.h"
 
@@ -56,6 +60,7 @@
 
 #include "util.h"
 
+#include "codec_fast.h"
 #include "pyrinas_codec.h"
 
 #define NRF_LOG_MODULE_NAME ble_m
@@ -68,14 +73,62 @@ NRF_LOG_MODULE_REGISTER();
 
 NRF_QUEUE_DEF(pyrinas_event_t, m_event_queue, 20, NRF_QUEUE_MODE_OVERFLOW);
 
+// Received events, encoded, each behind a RAW_RECORD_HEADER_SIZE header. Filled from the observer,
+// drained in ble_process(). Empty when head and tail are equal.
+static uint8_t m_raw_ring[BLE_M_RAW_RING_SIZE];
+static volatile uint16_t m_raw_head = 0; /**< Where the observer writes next. */
+static volatile uint16_t m_raw_tail = 0; /**< Oldest record. */
+
+#define RAW_RECORD_HEADER_SIZE 3 /**< Little endian length and the RSSI of the link. */
+#define RAW_RECORD_WRAP 0xffff   /**< Length that sends the reader back to the start. */
+
+/**@brief SoftDevice resources for a resource profile.
+ */
+typedef struct
+{
+    uint16_t event_length;           /**< Connection event length in 1.25 ms units. */
+    uint8_t hvn_tx_queue_size;       /**< Handle Value Notifications that can be queued per link. */
+    uint8_t write_cmd_tx_queue_size; /**< Write Commands that can be queued per link. */
+    bool conn_evt_ext;               /**< Extend connection events while there is data to send. */
+} ble_resource_cfg_t;
+
+static const ble_resource_cfg_t m_resource_cfgs[] = {
+    [ble_resource_profile_default] = {
+        .event_length = NRF_SDH_BLE_GAP_EVENT_LENGTH,
+        .hvn_tx_queue_size = BLE_GATTS_HVN_TX_QUEUE_SIZE_DEFAULT,
+        .write_cmd_tx_queue_size = BLE_GATTC_WRITE_CMD_TX_QUEUE_SIZE_DEFAULT,
+        .conn_evt_ext = false,
+    },
+    [ble_resource_profile_low_power] = {
+        .event_length = BLE_GAP_EVENT_LENGTH_MIN,
+        .hvn_tx_queue_size = 1,
+        .write_cmd_tx_queue_size = 1,
+        .conn_evt_ext = false,
+    },
+    [ble_resource_profile_balanced] = {
+        .event_length = 6,
+        .hvn_tx_queue_size = 4,
+        .write_cmd_tx_queue_size = 4,
+        .conn_evt_ext = true,
+    },
+    [ble_resource_profile_max_throughput] = {
+        .event_length = 320,
+        .hvn_tx_queue_size = 16,
+        .write_cmd_tx_queue_size = 16,
+        .conn_evt_ext = true,
+    },
+};
+
 NRF_BLE_GATT_DEF(m_gatt); /**< GATT module instance. */
 
 static ble_subscription_list_t m_subscribe_list; /**< Use for adding/removing subscriptions */
 static ble_stack_init_t m_config;                /**< Init config */
 static raw_susbcribe_handler_t m_raw_handler_ext;
 static bool m_init_complete = false;
+static uint32_t m_ram_start = 0;
 
-static int subscriber_search(pyrinas_event_name_data_t *event_name); // Forward declaration of subscriber_search
+static int subscriber_search(uint8_t const *p_name, size_t size);   // Forward declaration of subscriber_search
+static void publish(pyrinas_event_t *p_event, bool deferred);       // Forward declaration of publish
 
 bool ble_is_connected(void)
 {
@@ -90,6 +143,8 @@ bool ble_is_connected(void)
     case ble_mode_central:
         is_connected = ble_central_is_connected();
         break;
+    case ble_mode_broadcast:
+        break;
     }
 
     return is_connected;
@@ -105,12 +160,17 @@ void ble_disconnect(void)
     case ble_mode_central:
         ble_central_disconnect();
         break;
+    case ble_mode_broadcast:
+        break;
     }
 }
 
-void ble_publish(char *name, char *data)
+/**@brief Function for creating an event from a name and data string.
+ *
+ * @return false if either one does not fit.
+ */
+static bool event_from_strings(char *name, char *data, pyrinas_event_t *p_event)
 {
-
     uint8_t name_length = strlen(name);
     uint8_t data_length = strlen(data);
 
@@ -118,32 +178,166 @@ void ble_publish(char *name, char *data)
     if (name_length >= member_size(pyrinas_event_name_data_t, bytes))
     {
         NRF_LOG_WARNING("Name must be <= %d characters.", member_size(pyrinas_event_name_data_t, bytes));
-        return;
+        return false;
     }
 
     // Check size
     if (data_length >= member_size(pyrinas_event_data_t, bytes))
     {
         NRF_LOG_WARNING("Data must be <= %d characters.", member_size(pyrinas_event_data_t, bytes));
-        return;
+        return false;
     }
 
     // Create an event.
-    pyrinas_event_t event = {
-        .name.size = name_length,
-        .data.size = data_length,
-    };
+    memset(p_event, 0, sizeof(pyrinas_event_t));
+    p_event->name.size = name_length;
+    p_event->data.size = data_length;
 
     // Copy contents of message over
-    memcpy(event.name.bytes, name, name_length);
-    memcpy(event.data.bytes, data, data_length);
+    memcpy(p_event->name.bytes, name, name_length);
+    memcpy(p_event->data.bytes, data, data_length);
+
+    return true;
+}
+
+void ble_publish(char *name, char *data)
+{
+    pyrinas_event_t event;
+
+    if (!event_from_strings(name, data, &event))
+        return;
 
     // Then publish it as a raw format.
     ble_publish_raw(event);
 }
 
+void ble_publish_deferred(char *name, char *data)
+{
+    pyrinas_event_t event;
+
+    if (!event_from_strings(name, data, &event))
+        return;
+
+    publish(&event, true);
+}
+
+void ble_publish_broadcast(char *name, char *data)
+{
+    pyrinas_event_t event;
+
+    if (m_config.mode != ble_mode_central)
+    {
+        NRF_LOG_WARNING("Commands can only be broadcast in central mode.");
+        return;
+    }
+
+    if (!event_from_strings(name, data, &event))
+        return;
+
+    ble_gap_addr_t gap_addr;
+    sd_ble_gap_addr_get(&gap_addr);
+    memcpy(event.central_addr, gap_addr.addr, sizeof(event.central_addr));
+
+    // Encode value
+    uint8_t output[sizeof(pyrinas_event_t)];
+    size_t bytes_buffered = 0;
+
+    int err = codec_fast_encode(&event, output, sizeof(output), &bytes_buffered);
+    if (err)
+    {
+        NRF_LOG_ERROR("Unable to encode data!");
+        return;
+    }
+
+    // One advertising set reaches every listening sensor
+    err = ble_broadcast_command(output, bytes_buffered);
+    if (err)
+    {
+        NRF_LOG_WARNING("Unable to broadcast. Error: 0x%x", err);
+    }
+}
+
 void ble_publish_raw(pyrinas_event_t event)
 {
+    publish(&event, false);
+}
+
+void ble_publish_value(char *name, codec_value_t const *p_value)
+{
+    pyrinas_event_t event;
+    uint8_t name_length = strlen(name);
+    size_t data_length;
+
+    // Check size
+    if (name_length >= member_size(pyrinas_event_name_data_t, bytes))
+    {
+        NRF_LOG_WARNING("Name must be <= %d characters.", member_size(pyrinas_event_name_data_t, bytes));
+        return;
+    }
+
+    memset(&event, 0, sizeof(pyrinas_event_t));
+    event.name.size = name_length;
+    memcpy(event.name.bytes, name, name_length);
+
+    // One byte spare like strings, the receiver may terminate it
+    ret_code_t err_code = codec_value_encode(p_value, event.data.bytes,
+                                             member_size(pyrinas_event_data_t, bytes) - 1, &data_length);
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Unable to encode value. Err: 0x%x", err_code);
+        return;
+    }
+
+    event.data.size = data_length;
+
+    publish(&event, false);
+}
+
+void ble_publish_int(char *name, int32_t value)
+{
+    codec_value_t typed = {
+        .type = CODEC_VALUE_INT,
+        .integer = value,
+    };
+
+    ble_publish_value(name, &typed);
+}
+
+void ble_publish_float(char *name, float value)
+{
+    codec_value_t typed = {
+        .type = CODEC_VALUE_FLOAT,
+        .real = value,
+    };
+
+    ble_publish_value(name, &typed);
+}
+
+/**@brief Function for checking if the peers of the current mode take compressed frames.
+ *
+ * @details Broadcasts go to whoever listens, so they never are.
+ */
+static bool publish_compress_allowed(void)
+{
+    switch (m_config.mode)
+    {
+    case ble_mode_peripheral:
+        return ble_peripheral_peer_caps_get() & BLE_PB_CAP_COMPRESS;
+    case ble_mode_central:
+        return ble_central_peer_caps_get() & BLE_PB_CAP_COMPRESS;
+    default:
+        return false;
+    }
+}
+
+/**@brief Function for tagging, encoding and sending an event.
+ *
+ * @param[in] p_event   Event to send. Tagged with the address and RSSI.
+ * @param[in] deferred  Allow the peripheral to hold it for the next radio wake-up.
+ */
+static void publish(pyrinas_event_t *p_event, bool deferred)
+{
+    pyrinas_event_t event = *p_event;
 
     NRF_LOG_DEBUG("publish raw: %d %d", event.name.size, event.data.size);
 
@@ -157,6 +351,9 @@ void ble_publish_raw(pyrinas_event_t event)
         event.peripheral_rssi = ble_peripheral_get_rssi();
         memcpy(event.peripheral_addr, gap_addr.addr, sizeof(event.peripheral_addr));
         break;
+    case ble_mode_broadcast:
+        memcpy(event.peripheral_addr, gap_addr.addr, sizeof(event.peripheral_addr));
+        break;
     case ble_mode_central:
         memcpy(event.central_addr, gap_addr.addr, sizeof(event.central_addr));
         break;
@@ -166,8 +363,8 @@ void ble_publish_raw(pyrinas_event_t event)
     uint8_t output[sizeof(pyrinas_event_t)];
     size_t bytes_buffered = 0;
 
-    // Encode
-    int err = pyrinas_codec_encode(&event, output, sizeof(output), &bytes_buffered);
+    // Encode. Only the fields that change are written.
+    int err = codec_fast_encode(&event, output, sizeof(output), &bytes_buffered);
 
     // Output buffer
     if (err)
@@ -178,19 +375,54 @@ void ble_publish_raw(pyrinas_event_t event)
 
     NRF_LOG_DEBUG("buffered: %d", bytes_buffered);
 
+    // Hubs that connect later read it from the snapshot
+    if (m_config.mode == ble_mode_peripheral)
+    {
+        err = ble_peripheral_snapshot_update(event.name.bytes, event.name.size, output, bytes_buffered);
+        if (err)
+            NRF_LOG_WARNING("Snapshot full. Err: 0x%x", err);
+    }
+
+    // Only when every peer can take it. Mixed fleets get the encoded event.
+    uint8_t *p_frame = output;
+
+    if (m_config.compress && publish_compress_allowed())
+    {
+        static uint8_t packed[sizeof(pyrinas_event_t)];
+        size_t packed_len;
+
+        if (ble_comp_compress(output, bytes_buffered, packed, sizeof(packed), &packed_len) == NRF_SUCCESS)
+        {
+            p_frame = packed;
+            bytes_buffered = packed_len;
+        }
+    }
+
     // TODO: send to connected device(s)
     switch (m_config.mode)
     {
     case ble_mode_peripheral:
-        ble_peripheral_write(output, bytes_buffered);
+        if (deferred)
+            ble_peripheral_write_deferred(p_frame, bytes_buffered);
+        else
+            ble_peripheral_write(p_frame, bytes_buffered);
         break;
     case ble_mode_central:
-        ble_central_write(output, bytes_buffered);
+        ble_central_write(p_frame, bytes_buffered);
+        break;
+    case ble_mode_broadcast:
+        err = ble_broadcast_write(output, bytes_buffered);
+        if (err)
+        {
+            NRF_LOG_WARNING("Unable to broadcast. Error: 0x%x", err);
+        }
         break;
     }
 }
 
-void ble_subscribe(char *name, susbcribe_handler_t handler)
+/**@brief Function for adding or replacing the subscription of a topic. One of the handlers is NULL.
+ */
+static void subscribe(char *name, susbcribe_handler_t handler, value_subscribe_handler_t value_handler)
 {
 
     uint8_t name_length = strlen(name);
@@ -211,7 +443,8 @@ void ble_subscribe(char *name, susbcribe_handler_t handler)
     }
 
     ble_subscription_handler_t subscriber = {
-        .evt_handler = handler};
+        .evt_handler = handler,
+        .value_handler = value_handler};
 
     // Copy over info to structure.
     subscriber.name.size = name_length_nl;
@@ -221,7 +454,7 @@ void ble_subscribe(char *name, susbcribe_handler_t handler)
     subscriber.name.bytes[name_length] = 0;
 
     // Check if exists
-    int index = subscriber_search(&subscriber.name);
+    int index = subscriber_search(subscriber.name.bytes, subscriber.name.size);
 
     // If index is >= 0, we have an entry
     if (index != -1)
@@ -236,6 +469,16 @@ void ble_subscribe(char *name, susbcribe_handler_t handler)
     }
 }
 
+void ble_subscribe(char *name, susbcribe_handler_t handler)
+{
+    subscribe(name, handler, NULL);
+}
+
+void ble_subscribe_value(char *name, value_subscribe_handler_t handler)
+{
+    subscribe(name, NULL, handler);
+}
+
 void advertising_start(void)
 {
 
@@ -272,6 +515,15 @@ static void ble_evt_handler(ble_evt_t const *p_ble_evt, void *p_context)
 
     // TODO: enqueue this in the main context as well.
 
+    // Broadcast advertising set events
+    ble_broadcast_evt_handler(p_ble_evt, p_context);
+
+    // Connection parameter switching
+    ble_conn_mgr_evt_handler(p_ble_evt, p_context);
+
+    // L2CAP bulk channels
+    ble_bulk_on_ble_evt(p_ble_evt);
+
     switch (m_config.mode)
     {
     case ble_mode_peripheral:
@@ -280,6 +532,8 @@ static void ble_evt_handler(ble_evt_t const *p_ble_evt, void *p_context)
     case ble_mode_central:
         ble_central_evt_handler(p_ble_evt, p_context);
         break;
+    case ble_mode_broadcast:
+        break;
     }
 }
 
@@ -312,11 +566,37 @@ static void gap_params_init(void)
     APP_ERROR_CHECK(err_code);
 }
 
+/**@brief Function for handling events from the GATT module.
+ *
+ * @details Events are fragmented to the MTU of each link.
+ */
+static void gatt_evt_handler(nrf_ble_gatt_t *p_gatt, nrf_ble_gatt_evt_t const *p_evt)
+{
+    if (p_evt->evt_id != NRF_BLE_GATT_EVT_ATT_MTU_UPDATED)
+    {
+        return;
+    }
+
+    NRF_LOG_DEBUG("MTU on 0x%x: %d", p_evt->conn_handle, p_evt->params.att_mtu_effective);
+
+    switch (m_config.mode)
+    {
+    case ble_mode_peripheral:
+        ble_peripheral_mtu_set(p_evt->conn_handle, p_evt->params.att_mtu_effective);
+        break;
+    case ble_mode_central:
+        ble_central_mtu_set(p_evt->conn_handle, p_evt->params.att_mtu_effective);
+        break;
+    default:
+        break;
+    }
+}
+
 /**@brief Function for initializing the GATT module.
  */
 static void gatt_init(void)
 {
-    ret_code_t err_code = nrf_ble_gatt_init(&m_gatt, NULL);
+    ret_code_t err_code = nrf_ble_gatt_init(&m_gatt, gatt_evt_handler);
     APP_ERROR_CHECK(err_code);
 }
 
@@ -329,6 +609,267 @@ static void ble_raw_evt_handler(pyrinas_event_t *evt)
     APP_ERROR_CHECK(ret);
 }
 
+/**@brief Function for queuing encoded events so they are decoded in main context.
+ *
+ * @details The only copy of a received event. Records never wrap so they can be decoded in
+ *          place. Called from the observer only, ble_process() only moves the tail.
+ */
+static void ble_raw_bytes_handler(uint8_t const *data, uint16_t len, int8_t rssi)
+{
+    uint16_t head = m_raw_head;
+    uint16_t tail = m_raw_tail;
+    uint16_t size = RAW_RECORD_HEADER_SIZE + len;
+    uint16_t at = head;
+
+    // The head may not catch up with the tail, that is an empty ring
+    if (head >= tail)
+    {
+        if (head + size > BLE_M_RAW_RING_SIZE || (head + size == BLE_M_RAW_RING_SIZE && tail == 0))
+        {
+            if (size >= tail)
+            {
+                NRF_LOG_WARNING("Raw ring full. Event dropped.");
+                return;
+            }
+
+            // Tell the reader to go back to the start
+            if (BLE_M_RAW_RING_SIZE - head >= RAW_RECORD_HEADER_SIZE)
+            {
+                uint16_encode(RAW_RECORD_WRAP, &m_raw_ring[head]);
+            }
+
+            at = 0;
+        }
+    }
+    else if (head + size >= tail)
+    {
+        NRF_LOG_WARNING("Raw ring full. Event dropped.");
+        return;
+    }
+
+    uint16_encode(len, &m_raw_ring[at]);
+    m_raw_ring[at + 2] = (uint8_t)rssi;
+    memcpy(&m_raw_ring[at + RAW_RECORD_HEADER_SIZE], data, len);
+
+    // Record first, then the head
+    __DMB();
+    m_raw_head = (at + size) % BLE_M_RAW_RING_SIZE;
+}
+
+/**@brief Function for handing received data to the subscriber of its topic.
+ *
+ * @details name and data are terminated. data_len does not count the terminator.
+ */
+static void subscriber_notify(uint8_t *p_name, size_t name_size, uint8_t *p_data, size_t data_len)
+{
+    int index = subscriber_search(p_name, name_size);
+
+    // If index is >= 0, we have an entry
+    if (index == -1)
+    {
+        return;
+    }
+
+    ble_subscription_handler_t *p_subscriber = &m_subscribe_list.subscribers[index];
+
+    if (p_subscriber->value_handler == NULL)
+    {
+        // Push to susbscription context
+        p_subscriber->evt_handler((char *)p_name, (char *)p_data);
+        return;
+    }
+
+    codec_value_t value;
+
+    if (codec_value_decode(p_data, data_len, &value) != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Unable to decode value of %s.", p_name);
+        return;
+    }
+
+    p_subscriber->value_handler((char *)p_name, &value);
+}
+
+/**@brief Function for handing a received event to the raw handler and its subscriber.
+ */
+static void event_dispatch(pyrinas_event_t *p_evt)
+{
+    // Forward to raw handler if it exists
+    if (m_raw_handler_ext != NULL)
+    {
+        m_raw_handler_ext(p_evt);
+    }
+
+    // adding \0 terminating char so printing, strlen, etc works
+    // TODO necessary?
+    p_evt->name.bytes[p_evt->name.size++] = 0;
+    p_evt->data.bytes[p_evt->data.size++] = 0;
+
+    subscriber_notify(p_evt->name.bytes, p_evt->name.size, p_evt->data.bytes, p_evt->data.size - 1);
+}
+
+/**@brief Function for decoding an encoded event where it is and handing it out.
+ *
+ * @param[in] p_data Encoded event. Writable up to p_end, the terminators go in there.
+ */
+static void raw_event_dispatch(uint8_t *p_data, uint16_t len, uint8_t *p_end, int8_t rssi)
+{
+    static pyrinas_event_t evt;
+    codec_fast_view_t view;
+
+    // Restore the encoded event
+    if (ble_comp_is_compressed(p_data, len))
+    {
+        static uint8_t unpacked[sizeof(pyrinas_event_t)];
+        size_t unpacked_len;
+
+        // One spare byte to terminate the last field
+        if (ble_comp_decompress(p_data, len, unpacked, sizeof(unpacked) - 1, &unpacked_len) != NRF_SUCCESS)
+        {
+            NRF_LOG_ERROR("Unable to decompress ble data!");
+            return;
+        }
+
+        p_data = unpacked;
+        len = unpacked_len;
+        p_end = &unpacked[sizeof(unpacked)];
+    }
+
+    if (codec_fast_view_decode(p_data, len, &view) == NRF_SUCCESS)
+    {
+        uint8_t *p_name = (uint8_t *)view.p_name;
+        uint8_t *p_value = (uint8_t *)view.p_data;
+
+        // A string is followed by the head of the next item, which can take the terminator.
+        // Not if it is the last one, or for a raw handler that wants the whole event.
+        if (m_raw_handler_ext == NULL && p_name + view.name_len < p_end && p_value + view.data_len < p_end)
+        {
+            p_name[view.name_len] = 0;
+            p_value[view.data_len] = 0;
+
+            subscriber_notify(p_name, view.name_len + 1, p_value, view.data_len);
+            return;
+        }
+
+        codec_fast_view_to_event(&view, &evt);
+    }
+    // Encodings the view does not handle go through the full decoder
+    else if (pyrinas_codec_decode(&evt, p_data, len))
+    {
+        NRF_LOG_ERROR("Unable to decode ble data!");
+        return;
+    }
+
+    ble_gap_addr_t gap_addr;
+    sd_ble_gap_addr_get(&gap_addr);
+
+    // Same tags as the peripheral and central handlers
+    if (m_config.mode == ble_mode_peripheral)
+    {
+        evt.peripheral_rssi = rssi;
+        memcpy(evt.peripheral_addr, gap_addr.addr, sizeof(evt.peripheral_addr));
+    }
+    else
+    {
+        evt.central_rssi = rssi;
+        memcpy(evt.central_addr, gap_addr.addr, sizeof(evt.central_addr));
+    }
+
+    event_dispatch(&evt);
+}
+
+/**@brief Function for handing out the oldest received event, straight from the ring.
+ */
+static void raw_ring_process(void)
+{
+    uint16_t tail = m_raw_tail;
+
+    if (tail == m_raw_head)
+    {
+        return;
+    }
+
+    // The writer went back to the start
+    if (BLE_M_RAW_RING_SIZE - tail < RAW_RECORD_HEADER_SIZE || uint16_decode(&m_raw_ring[tail]) == RAW_RECORD_WRAP)
+    {
+        tail = 0;
+    }
+
+    uint8_t *p_record = &m_raw_ring[tail];
+    uint16_t len = uint16_decode(p_record);
+    int8_t rssi = (int8_t)p_record[2];
+    uint16_t size = RAW_RECORD_HEADER_SIZE + len;
+
+    // Longer than anything the observer puts in
+    if (tail + size > BLE_M_RAW_RING_SIZE)
+    {
+        NRF_LOG_ERROR("Raw ring corrupt. Resetting.");
+        m_raw_tail = m_raw_head;
+        return;
+    }
+
+    raw_event_dispatch(&p_record[RAW_RECORD_HEADER_SIZE], len, &p_record[size], rssi);
+
+    // Only now, the handlers were given pointers into it
+    __DMB();
+    m_raw_tail = (tail + size) % BLE_M_RAW_RING_SIZE;
+}
+
+void ble_rx_cycles_get(util_cycles_stats_t *p_stats)
+{
+    memset(p_stats, 0, sizeof(util_cycles_stats_t));
+
+    switch (m_config.mode)
+    {
+    case ble_mode_peripheral:
+        ble_peripheral_rx_cycles_get(p_stats);
+        break;
+    case ble_mode_central:
+        ble_central_rx_cycles_get(p_stats);
+        break;
+    default:
+        break;
+    }
+}
+
+/**@brief Function for seeding the compression dictionary with the fields every event has.
+ *
+ * @details A publish only sets the address of the side that sends it, the other one stays 0.
+ *          The sender's own address differs per device, so it can't be in a shared dictionary.
+ */
+static void compress_dict_init(void)
+{
+    static const uint8_t no_addr[member_size(pyrinas_event_t, peripheral_addr)] = {0};
+    uint8_t tail[32];
+
+    size_t len = codec_fast_tail_encode(no_addr, no_addr, tail, sizeof(tail));
+    ret_code_t err_code = ble_comp_dict_add(tail, len);
+    APP_ERROR_CHECK(err_code);
+}
+
+void ble_compress_topic_add(char *name)
+{
+    uint8_t head[member_size(pyrinas_event_name_data_t, bytes) + 8];
+
+    // A publish of the topic starts with these bytes
+    size_t len = codec_fast_head_encode((uint8_t *)name, strlen(name), head, sizeof(head));
+
+    if (len == 0 || ble_comp_dict_add(head, len) != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Compression dictionary full. %s not added.", name);
+    }
+}
+
+void ble_compress_stats_get(ble_comp_stats_t *p_stats)
+{
+    ble_comp_stats_get(p_stats);
+}
+
+void ble_encode_stats_get(codec_fast_stats_t *p_stats)
+{
+    codec_fast_stats_get(p_stats);
+}
+
 void ble_external_antenna(bool enabled)
 {
 
@@ -369,6 +910,7 @@ void ble_reload_config(ble_stack_init_t *init)
     switch (m_config.mode)
     {
     case ble_mode_peripheral:
+    case ble_mode_broadcast:
         break;
     case ble_mode_central:
         // Disconnect
@@ -380,6 +922,69 @@ void ble_reload_config(ble_stack_init_t *init)
     }
 }
 
+/**@brief Function for applying the connection configuration of a resource profile.
+ *
+ * @details Must be called after nrf_sdh_ble_default_cfg_set() and before the stack is enabled.
+ *          The default profile puts back what a previous call changed.
+ *
+ * @retval NRF_ERROR_NO_MEM if ram_start leaves the SoftDevice too little RAM for the profile.
+ */
+static ret_code_t resource_profile_cfg_set(ble_resource_profile_t profile, uint32_t ram_start)
+{
+    ret_code_t err_code;
+    ble_cfg_t ble_cfg;
+
+    ble_resource_cfg_t const *p_res = &m_resource_cfgs[profile];
+
+    // Connection count and event length
+    memset(&ble_cfg, 0, sizeof(ble_cfg));
+    ble_cfg.conn_cfg.conn_cfg_tag = APP_BLE_CONN_CFG_TAG;
+    ble_cfg.conn_cfg.params.gap_conn_cfg.conn_count = NRF_SDH_BLE_TOTAL_LINK_COUNT;
+    ble_cfg.conn_cfg.params.gap_conn_cfg.event_length = p_res->event_length;
+    err_code = sd_ble_cfg_set(BLE_CONN_CFG_GAP, &ble_cfg, ram_start);
+    VERIFY_SUCCESS(err_code);
+
+    // Notification queue
+    memset(&ble_cfg, 0, sizeof(ble_cfg));
+    ble_cfg.conn_cfg.conn_cfg_tag = APP_BLE_CONN_CFG_TAG;
+    ble_cfg.conn_cfg.params.gatts_conn_cfg.hvn_tx_queue_size = p_res->hvn_tx_queue_size;
+    err_code = sd_ble_cfg_set(BLE_CONN_CFG_GATTS, &ble_cfg, ram_start);
+    VERIFY_SUCCESS(err_code);
+
+    // Write command queue
+    memset(&ble_cfg, 0, sizeof(ble_cfg));
+    ble_cfg.conn_cfg.conn_cfg_tag = APP_BLE_CONN_CFG_TAG;
+    ble_cfg.conn_cfg.params.gattc_conn_cfg.write_cmd_tx_queue_size = p_res->write_cmd_tx_queue_size;
+    err_code = sd_ble_cfg_set(BLE_CONN_CFG_GATTC, &ble_cfg, ram_start);
+    VERIFY_SUCCESS(err_code);
+
+    NRF_LOG_INFO("Resource profile %d: event length %d, hvn queue %d, write cmd queue %d",
+                 profile, p_res->event_length, p_res->hvn_tx_queue_size, p_res->write_cmd_tx_queue_size);
+
+    return NRF_SUCCESS;
+}
+
+/**@brief Function for applying the options of a resource profile once the stack is enabled.
+ */
+static void resource_profile_opt_set(ble_resource_profile_t profile)
+{
+    ble_opt_t opt;
+
+    if (profile == ble_resource_profile_default)
+        return;
+
+    memset(&opt, 0, sizeof(opt));
+    opt.common_opt.conn_evt_ext.enable = m_resource_cfgs[profile].conn_evt_ext;
+
+    ret_code_t err_code = sd_ble_opt_set(BLE_COMMON_OPT_CONN_EVT_EXT, &opt);
+    APP_ERROR_CHECK(err_code);
+}
+
+uint32_t ble_ram_start_get(void)
+{
+    return m_ram_start;
+}
+
 // TODO: transmit power
 void ble_stack_init(ble_stack_init_t *init)
 {
@@ -401,33 +1006,103 @@ void ble_stack_init(ble_stack_init_t *init)
     err_code = nrf_sdh_ble_default_cfg_set(APP_BLE_CONN_CFG_TAG, &ram_start);
     APP_ERROR_CHECK(err_code);
 
-    // Enable BLE stack.
-    err_code = nrf_sdh_ble_enable(&ram_start);
+    // L2CAP channels come out of the same RAM
+    if (m_config.bulk_enabled)
+    {
+        ble_bulk_cfg_set(APP_BLE_CONN_CFG_TAG, ram_start);
+    }
+
+    // Override with the selected resource profile and enable the BLE stack.
+    // On success or NRF_ERROR_NO_MEM ram_start holds the minimum required RAM start.
+    uint32_t app_ram_start = ram_start;
+    err_code = resource_profile_cfg_set(m_config.resource_profile, app_ram_start);
+    if (err_code == NRF_SUCCESS)
+    {
+        err_code = nrf_sdh_ble_enable(&ram_start);
+    }
+
+    // The linker script is sized for the default profile. Rather than fault, run with that.
+    if (err_code == NRF_ERROR_NO_MEM && m_config.resource_profile != ble_resource_profile_default)
+    {
+        if (ram_start != app_ram_start)
+        {
+            NRF_LOG_WARNING("Resource profile %d needs RAM start 0x%x, have 0x%x. Using the default profile.",
+                            m_config.resource_profile, ram_start, app_ram_start);
+        }
+        else
+        {
+            NRF_LOG_WARNING("Not enough RAM for resource profile %d. Using the default profile.",
+                            m_config.resource_profile);
+        }
+
+        m_config.resource_profile = ble_resource_profile_default;
+        ram_start = app_ram_start;
+
+        err_code = resource_profile_cfg_set(m_config.resource_profile, ram_start);
+        APP_ERROR_CHECK(err_code);
+
+        err_code = nrf_sdh_ble_enable(&ram_start);
+    }
     APP_ERROR_CHECK(err_code);
 
+    m_ram_start = ram_start;
+    NRF_LOG_INFO("App RAM start 0x%x, required 0x%x (%d bytes spare)",
+                 app_ram_start, m_ram_start, app_ram_start - m_ram_start);
+
+    resource_profile_opt_set(m_config.resource_profile);
+
+    // Before any topic, the same on every device
+    compress_dict_init();
+
     // Register handlers for BLE and SoC events.
     NRF_SDH_BLE_OBSERVER(m_ble_observer, APP_BLE_OBSERVER_PRIO, ble_evt_handler, NULL);
 
+    // Observer execution time is measured in cycles
+    util_cycles_init();
+
     gatt_init();
     gap_params_init();
 
     switch (m_config.mode)
     {
     case ble_mode_peripheral:
-        // Attach handler
+        // Attach handlers
         ble_peripheral_attach_raw_handler(ble_raw_evt_handler);
+        ble_broadcast_attach_raw_handler(ble_raw_evt_handler);
+        ble_peripheral_attach_raw_bytes_handler(ble_raw_bytes_handler);
 
         // Init peripheral mode
-        ble_peripheral_init();
+        ble_broadcast_init();
+        ble_peripheral_init(&m_config.peripheral);
         break;
 
     case ble_mode_central:
-        // First, attach handler
+        // First, attach handlers
         ble_central_attach_raw_handler(ble_raw_evt_handler);
+        ble_broadcast_attach_raw_handler(ble_raw_evt_handler);
+        ble_central_attach_raw_bytes_handler(ble_raw_bytes_handler);
 
         // Initialize
+        ble_broadcast_init();
         ble_central_init(&m_config.config);
         break;
+
+    case ble_mode_broadcast:
+        // Nothing to connect to. Publishes go straight to advertising.
+        ble_broadcast_attach_raw_handler(ble_raw_evt_handler);
+        ble_broadcast_init();
+
+        if (m_config.peripheral.broadcast_listen)
+        {
+            ble_broadcast_listen_start(&m_config.peripheral.hub_addr);
+        }
+        break;
+    }
+
+    // Bulk channels on top of either connected mode
+    if (m_config.bulk_enabled && m_config.mode != ble_mode_broadcast)
+    {
+        ble_bulk_init(m_config.bulk_evt_handler);
     }
 
     // Init complete
@@ -449,6 +1124,18 @@ void ble_process()
     if (!m_init_complete)
         return;
 
+    // Forward what was stored while no hub listened
+    if (m_config.mode == ble_mode_peripheral)
+    {
+        ble_peripheral_process();
+    }
+
+    // Feed the bulk channels
+    ble_bulk_process();
+
+    // Hand out one received event, decoded where it sits
+    raw_ring_process();
+
     // Dequeue one item if not empty
     if (!nrf_queue_is_empty(&m_event_queue))
     {
@@ -457,31 +1144,12 @@ void ble_process()
         ret_code_t ret = nrf_queue_pop(&m_event_queue, &evt);
         APP_ERROR_CHECK(ret);
 
-        // Forward to raw handler if it exists
-        if (m_raw_handler_ext != NULL)
-        {
-            m_raw_handler_ext(&evt);
-        }
-
-        // adding \0 terminating char so printing, strlen, etc works
-        // TODO necessary?
-        evt.name.bytes[evt.name.size++] = 0;
-        evt.data.bytes[evt.data.size++] = 0;
-
-        // Check if exists
-        int index = subscriber_search(&evt.name);
-
-        // If index is >= 0, we have an entry
-        if (index != -1)
-        {
-            // Push to susbscription context
-            m_subscribe_list.subscribers[index].evt_handler((char *)evt.name.bytes, (char *)evt.data.bytes);
-        }
+        event_dispatch(&evt);
     }
 }
 
 // TODO: more optimized way of doing this?
-static int subscriber_search(pyrinas_event_name_data_t *event_name)
+static int subscriber_search(uint8_t const *p_name, size_t size)
 {
 
     int index = 0;
@@ -490,9 +1158,9 @@ static int subscriber_search(pyrinas_event_name_data_t *event_name)
     {
         pyrinas_event_name_data_t *name = &m_subscribe_list.subscribers[index].name;
 
-        if (name->size == event_name->size)
+        if (name->size == size)
         {
-            if (memcmp(name->bytes, event_name->bytes, name->size) == 0)
+            if (memcmp(name->bytes, p_name, name->size) == 0)
             {
                 return index;
             }
@@ -512,5 +1180,7 @@ void ble_pm_evt_handler(pm_evt_t const *p_evt)
     case ble_mode_central:
         ble_central_pm_evt_handler(p_evt);
         break;
+    case ble_mode_broadcast:
+        break;
     }
 }
\ No newline at end of file
@@ -45,6 +45,7 @@
 #include "sdk_common.h"
 #if NRF_MODULE_ENABLED(BLE_PB)
 #include "app_error.h"
+#include "app_util_platform.h"
 #include "ble_conn_state.h"
 #include "ble_pb.h"
 #include "ble_srv_common.h"
@@ -62,28 +63,76 @@
 #include "nrf_log.h"
 NRF_LOG_MODULE_REGISTER();
 
-/**@brief Function for handling write events to the Heart Rate Measurement characteristic.
+/**@brief Function for finding the link slot of a connection.
  *
- * @param[in]   p_protobuf         Heart Rate Service structure.
- * @param[in]   p_evt_write   Write event received from the BLE stack.
+ * @param[in]   p_protobuf   Protobuf Service structure.
+ * @param[in]   conn_handle  Connection handle. BLE_CONN_HANDLE_INVALID finds a free slot.
+ *
+ * @return      Index of the slot, -1 if there is none.
  */
-static void on_pb_cccd_write(ble_protobuf_t *p_protobuf, ble_gatts_evt_write_t const *p_evt_write)
+static int link_index_get(ble_protobuf_t *p_protobuf, uint16_t conn_handle)
 {
+    for (int i = 0; i < BLE_PB_LINK_COUNT; i++)
+    {
+        if (p_protobuf->links[i].conn_handle == conn_handle)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**@brief Function for handling CCCD writes of the TX and Command characteristics.
+ *
+ * @param[in]   p_protobuf     Protobuf Service structure.
+ * @param[in]   p_ble_evt      Event received from the BLE stack.
+ * @param[in]   value_handle   Value handle of the characteristic the CCCD belongs to.
+ */
+static void on_pb_cccd_write(ble_protobuf_t *p_protobuf, ble_evt_t const *p_ble_evt, uint16_t value_handle)
+{
+    ble_gatts_evt_write_t const *p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
+    uint16_t conn_handle = p_ble_evt->evt.gatts_evt.conn_handle;
+
     if (p_evt_write->len == 2)
     {
+        bool enabled = ble_srv_is_notification_enabled(p_evt_write->data);
+
+        // Track the subscription of this central
+        int index = link_index_get(p_protobuf, conn_handle);
+        if (index >= 0)
+        {
+            ble_pb_link_t *p_link = &p_protobuf->links[index];
+
+            if (value_handle == p_protobuf->tx_handles.value_handle)
+            {
+                p_link->tx_subscribed = enabled;
+            }
+            else
+            {
+                p_link->command_subscribed = enabled;
+            }
+
+            // Still subscribed as long as one of them is
+            enabled = p_link->tx_subscribed || p_link->command_subscribed;
+            p_link->notifications_enabled = enabled;
+        }
+
         // CCCD written, update notification state
         if (p_protobuf->evt_handler != NULL)
         {
             ble_pb_evt_t evt;
 
-            if (ble_srv_is_notification_enabled(p_evt_write->data))
+            evt.conn_handle = conn_handle;
+
+            if (enabled)
             {
                 evt.evt_type = BLE_PB_EVT_NOTIFICATION_ENABLED;
-                NRF_LOG_DEBUG("Notifications enabled!");
+                NRF_LOG_DEBUG("Notifications enabled on 0x%x!", conn_handle);
             }
             else
             {
-                NRF_LOG_DEBUG("Notifications disabled!");
+                NRF_LOG_DEBUG("Notifications disabled on 0x%x!", conn_handle);
                 evt.evt_type = BLE_PB_EVT_NOTIFICATION_DISABLED;
             }
 
@@ -92,6 +141,239 @@ static void on_pb_cccd_write(ble_protobuf_t *p_protobuf, ble_gatts_evt_write_t c
     }
 }
 
+/**@brief Function for handling data written to the RX or Command characteristic.
+ *
+ * @param[in]   p_protobuf   Protobuf Service structure.
+ * @param[in]   p_ble_evt    Event received from the BLE stack.
+ */
+static void on_data_write(ble_protobuf_t *p_protobuf, ble_evt_t const *p_ble_evt)
+{
+    ble_gatts_evt_write_t const *p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
+    uint8_t const *p_data = p_evt_write->data;
+    uint16_t len = p_evt_write->len;
+    uint32_t begin = util_cycles_get();
+    int err;
+
+    // Too large for the stack of the observer
+    static ble_pb_evt_t evt;
+    evt.evt_type = BLE_PB_EVT_DATA;
+    evt.conn_handle = p_ble_evt->evt.gatts_evt.conn_handle;
+
+    // Events on the RX characteristic may span several writes
+    if (p_evt_write->handle == p_protobuf->rx_handles.value_handle)
+    {
+        int index = link_index_get(p_protobuf, evt.conn_handle);
+        if (index < 0)
+        {
+            return;
+        }
+
+        ble_frag_rx_t *p_rx = &p_protobuf->links[index].rx;
+
+        ble_frag_rx_result_t result = ble_frag_rx_put(p_rx, p_data, len);
+        if (result == BLE_FRAG_RX_ERROR)
+        {
+            NRF_LOG_WARNING("Fragment dropped on 0x%x", evt.conn_handle);
+            return;
+        }
+        else if (result == BLE_FRAG_RX_PENDING)
+        {
+            return;
+        }
+
+        p_data = p_rx->data;
+        len = p_rx->len;
+    }
+
+    // Fill in what the central left out of the header
+    if (codec_fast_hdr_is_compressed(p_data, len))
+    {
+        static uint8_t expanded[sizeof(pyrinas_event_t)];
+        size_t expanded_len;
+
+        int index = link_index_get(p_protobuf, evt.conn_handle);
+        if (index < 0)
+        {
+            return;
+        }
+
+        ble_pb_link_t *p_link = &p_protobuf->links[index];
+        p_link->peer_caps |= BLE_PB_CAP_HEADER;
+
+        ret_code_t err_code = codec_fast_hdr_expand(&p_link->hdr_rx, p_data, len,
+                                                    expanded, sizeof(expanded), &expanded_len);
+        if (err_code != NRF_SUCCESS)
+        {
+            NRF_LOG_WARNING("Header from 0x%x not restored. Err: 0x%x", evt.conn_handle, err_code);
+            return;
+        }
+
+        p_data = expanded;
+        len = expanded_len;
+    }
+
+    // A central that compresses also takes compressed frames
+    if (ble_comp_is_compressed(p_data, len))
+    {
+        int index = link_index_get(p_protobuf, evt.conn_handle);
+        if (index >= 0)
+        {
+            p_protobuf->links[index].peer_caps |= BLE_PB_CAP_COMPRESS;
+        }
+    }
+
+    // Leave the decoding to the main context
+    if (p_protobuf->defer_decode)
+    {
+        evt.evt_type = BLE_PB_EVT_RAW;
+        evt.params.raw.p_data = p_data;
+        evt.params.raw.len = len;
+
+        p_protobuf->evt_handler(p_protobuf, &evt);
+        util_cycles_stats_add(&p_protobuf->rx_cycles, begin);
+        return;
+    }
+
+    // Restore the encoded event
+    if (ble_comp_is_compressed(p_data, len))
+    {
+        static uint8_t unpacked[sizeof(pyrinas_event_t)];
+        size_t unpacked_len;
+
+        if (ble_comp_decompress(p_data, len, unpacked, sizeof(unpacked), &unpacked_len) != NRF_SUCCESS)
+        {
+            NRF_LOG_ERROR("Unable to decompress ble data!");
+            return;
+        }
+
+        p_data = unpacked;
+        len = unpacked_len;
+    }
+
+    // Read in buffer
+    err = pyrinas_codec_decode(&evt.params.data, p_data, len);
+    if (err)
+    {
+        NRF_LOG_ERROR("Unable to decode ble data!");
+        return;
+    }
+
+    // Event to the main context
+    p_protobuf->evt_handler(p_protobuf, &evt);
+    util_cycles_stats_add(&p_protobuf->rx_cycles, begin);
+}
+
+void ble_pb_caps_encode(uint8_t *p_data)
+{
+    p_data[0] = BLE_PB_PROTOCOL_VERSION;
+    p_data[1] = BLE_PB_CAPS_LOCAL;
+    uint16_encode(ble_comp_dict_id(), &p_data[2]);
+}
+
+bool ble_pb_caps_decode(uint8_t const *p_data, uint16_t len, uint8_t *p_version, uint8_t *p_caps)
+{
+    if (len < BLE_PB_CAPS_LEN)
+    {
+        return false;
+    }
+
+    *p_version = p_data[0];
+    *p_caps = p_data[1];
+
+    // Frames of another dictionary would be dropped
+    if (uint16_decode(&p_data[2]) != ble_comp_dict_id())
+    {
+        *p_caps &= ~BLE_PB_CAP_COMPRESS;
+    }
+
+    return true;
+}
+
+/**@brief Function for handling the central writing its capabilities.
+ */
+static void on_caps_write(ble_protobuf_t *p_protobuf, ble_evt_t const *p_ble_evt)
+{
+    ble_gatts_evt_write_t const *p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
+    uint16_t conn_handle = p_ble_evt->evt.gatts_evt.conn_handle;
+
+    int index = link_index_get(p_protobuf, conn_handle);
+    if (index < 0)
+    {
+        return;
+    }
+
+    ble_pb_link_t *p_link = &p_protobuf->links[index];
+
+    if (!ble_pb_caps_decode(p_evt_write->data, p_evt_write->len, &p_link->peer_version, &p_link->peer_caps))
+    {
+        NRF_LOG_WARNING("Invalid capabilities from 0x%x", conn_handle);
+        return;
+    }
+
+    NRF_LOG_INFO("Central 0x%x: version %d, caps 0x%x", conn_handle, p_link->peer_version, p_link->peer_caps);
+}
+
+/**@brief Function for allowing a read, replacing the value first if p_data is set.
+ */
+static void read_authorize_reply(uint16_t conn_handle, uint8_t const *p_data, uint16_t len)
+{
+    ble_gatts_rw_authorize_reply_params_t reply;
+    memset(&reply, 0, sizeof(reply));
+
+    reply.type = BLE_GATTS_AUTHORIZE_TYPE_READ;
+    reply.params.read.gatt_status = BLE_GATT_STATUS_SUCCESS;
+
+    if (p_data != NULL)
+    {
+        reply.params.read.update = 1;
+        reply.params.read.len = len;
+        reply.params.read.p_data = p_data;
+    }
+
+    ret_code_t err_code = sd_ble_gatts_rw_authorize_reply(conn_handle, &reply);
+    if (err_code != NRF_SUCCESS && err_code != NRF_ERROR_INVALID_STATE && err_code != BLE_ERROR_INVALID_CONN_HANDLE)
+    {
+        APP_ERROR_CHECK(err_code);
+    }
+}
+
+/**@brief Function for answering reads of the capability and snapshot characteristics.
+ *
+ * @details The capability value is built on every read. Centrals overwrite the stored one with
+ *          theirs, and the dictionary may grow after the service was added.
+ *          The snapshot is copied on the read at offset 0 only, so the blob reads that follow
+ *          see the same records even if a topic is published in between.
+ */
+static void on_rw_authorize_request(ble_protobuf_t *p_protobuf, ble_evt_t const *p_ble_evt)
+{
+    ble_gatts_evt_rw_authorize_request_t const *p_req = &p_ble_evt->evt.gatts_evt.params.authorize_request;
+    uint16_t conn_handle = p_ble_evt->evt.gatts_evt.conn_handle;
+
+    if (p_req->type != BLE_GATTS_AUTHORIZE_TYPE_READ)
+    {
+        return;
+    }
+
+    if (p_req->request.read.handle == p_protobuf->caps_handles.value_handle)
+    {
+        uint8_t value[BLE_PB_CAPS_LEN];
+        ble_pb_caps_encode(value);
+
+        read_authorize_reply(conn_handle, value, sizeof(value));
+    }
+    else if (p_req->request.read.handle == p_protobuf->snapshot_handles.value_handle)
+    {
+        if (p_req->request.read.offset == 0)
+        {
+            read_authorize_reply(conn_handle, p_protobuf->snapshot, p_protobuf->snapshot_len);
+        }
+        else
+        {
+            read_authorize_reply(conn_handle, NULL, 0);
+        }
+    }
+}
+
 /**@brief Function for handling the Write event.
  *
  * @param[in]   p_protobuf       Battery Service structure.
@@ -101,63 +383,406 @@ static void on_write(ble_protobuf_t *p_protobuf, ble_evt_t const *p_ble_evt)
 {
     ble_gatts_evt_write_t const *p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
 
-    if (p_evt_write->handle == p_protobuf->command_handles.cccd_handle)
+    if (p_evt_write->handle == p_protobuf->tx_handles.cccd_handle)
+    {
+        on_pb_cccd_write(p_protobuf, p_ble_evt, p_protobuf->tx_handles.value_handle);
+    }
+    else if (p_evt_write->handle == p_protobuf->command_handles.cccd_handle)
     {
-        on_pb_cccd_write(p_protobuf, p_evt_write);
+        on_pb_cccd_write(p_protobuf, p_ble_evt, p_protobuf->command_handles.value_handle);
     }
 
-    // Handle writning to the value handle
-    if (p_evt_write->handle == p_protobuf->command_handles.value_handle)
+    // Handle writing to the RX or the legacy value handle
+    if (p_evt_write->handle == p_protobuf->rx_handles.value_handle ||
+        p_evt_write->handle == p_protobuf->command_handles.value_handle)
     {
-        int err;
+        on_data_write(p_protobuf, p_ble_evt);
+    }
+    else if (p_evt_write->handle == p_protobuf->caps_handles.value_handle)
+    {
+        on_caps_write(p_protobuf, p_ble_evt);
+    }
+}
+
+/**@brief Function for sending a single notification.
+ *
+ * @param[in]   p_protobuf   Protobuf Service structure.
+ * @param[in]   p_link       Link to send on.
+ * @param[in]   p_item       Queued notification.
+ *
+ * @return      Error code from sd_ble_gatts_hvx.
+ */
+static uint32_t notify(ble_protobuf_t *p_protobuf, ble_pb_link_t const *p_link, ble_pb_tx_item_t *p_item)
+{
+    uint16_t hvx_len = p_item->len;
+    ble_gatts_hvx_params_t hvx_params;
 
-        ble_pb_evt_t evt;
-        evt.evt_type = BLE_PB_EVT_DATA;
+    memset(&hvx_params, 0, sizeof(hvx_params));
 
-        // Read in buffer
-        err = pyrinas_codec_decode(&evt.params.data, p_evt_write->data, p_evt_write->len);
-        if (err)
+    // Hubs that know the TX characteristic keep the legacy one free for writes
+    hvx_params.handle = p_link->tx_subscribed ? p_protobuf->tx_handles.value_handle
+                                              : p_protobuf->command_handles.value_handle;
+    hvx_params.type = BLE_GATT_HVX_NOTIFICATION;
+    hvx_params.offset = 0;
+    hvx_params.p_len = &hvx_len;
+    hvx_params.p_data = p_item->data;
+
+    return sd_ble_gatts_hvx(p_link->conn_handle, &hvx_params);
+}
+
+/**@brief Function for sending queued notifications of a link until the SoftDevice is full.
+ *
+ * @details Must not be preempted by itself. Called from the BLE event context
+ *          or from a critical region.
+ *
+ * @param[in]   p_protobuf  Protobuf Service structure.
+ * @param[in]   index       Link slot.
+ */
+static void tx_queue_drain(ble_protobuf_t *p_protobuf, int index)
+{
+    ble_pb_tx_item_t item;
+    nrf_queue_t const *p_queue = p_protobuf->p_tx_queues[index];
+
+    while (nrf_queue_peek(p_queue, &item) == NRF_SUCCESS)
+    {
+        uint32_t err_code = notify(p_protobuf, &p_protobuf->links[index], &item);
+
+        // Try again on the next HVN_TX_COMPLETE
+        if (err_code == NRF_ERROR_RESOURCES)
         {
-            NRF_LOG_ERROR("Unable to decode ble data!");
-            return;
+            break;
         }
 
-        // Event to the main context
-        p_protobuf->evt_handler(p_protobuf, &evt);
+        UNUSED_RETURN_VALUE(nrf_queue_pop(p_queue, &item));
+
+        if (err_code == NRF_SUCCESS)
+        {
+            p_protobuf->tx_stats.sent++;
+        }
+        else
+        {
+            NRF_LOG_WARNING("Notification dropped. Err: 0x%x", err_code);
+            p_protobuf->tx_stats.dropped++;
+
+            // The central missed whatever changed in it
+            codec_fast_hdr_reset(&p_protobuf->links[index].hdr_tx);
+        }
+    }
+}
+
+/**@brief Function for adding a notification to the TX queue of a link.
+ *
+ * @details Applies the overflow policy when the queue is full. Dropping the oldest
+ *          throws out all PDUs of the oldest event. If part of it is already sent,
+ *          the new notification is dropped instead, so no event is cut in half.
+ *
+ * @param[in]   p_protobuf  Protobuf Service structure.
+ * @param[in]   index       Link slot.
+ * @param[in]   p_item      Notification to queue.
+ *
+ * @retval      NRF_SUCCESS       The notification was queued.
+ * @retval      NRF_ERROR_NO_MEM  The queue is full and the notification was dropped.
+ */
+static uint32_t tx_queue_push(ble_protobuf_t *p_protobuf, int index, ble_pb_tx_item_t const *p_item)
+{
+    nrf_queue_t const *p_queue = p_protobuf->p_tx_queues[index];
+    ble_pb_tx_item_t oldest;
+
+    uint32_t err_code = nrf_queue_push(p_queue, p_item);
+
+    // Make room by throwing out the oldest event
+    if (err_code == NRF_ERROR_NO_MEM && p_protobuf->tx_overflow == BLE_PB_TX_DROP_OLDEST &&
+        nrf_queue_peek(p_queue, &oldest) == NRF_SUCCESS && oldest.first)
+    {
+        bool last = false;
+
+        while (!last && nrf_queue_pop(p_queue, &oldest) == NRF_SUCCESS)
+        {
+            last = oldest.last;
+        }
+
+        p_protobuf->tx_stats.dropped++;
+        codec_fast_hdr_reset(&p_protobuf->links[index].hdr_tx);
+
+        err_code = nrf_queue_push(p_queue, p_item);
+    }
+    else if (err_code == NRF_ERROR_NO_MEM)
+    {
+        p_protobuf->tx_stats.dropped++;
     }
+
+    size_t depth = nrf_queue_utilization_get(p_queue);
+    if (depth > p_protobuf->tx_stats.depth_max)
+    {
+        p_protobuf->tx_stats.depth_max = depth;
+    }
+
+    return err_code;
+}
+
+/**@brief Function for queuing an event for a link on the TX characteristic.
+ *
+ * @details Split into PDUs that fit the MTU of the link. Queued only if every PDU fits.
+ *
+ * @param[in]   p_protobuf  Protobuf Service structure.
+ * @param[in]   index       Link slot.
+ * @param[in]   data        Encoded data.
+ * @param[in]   size        Size of the data.
+ *
+ * @retval      NRF_SUCCESS       Every PDU was queued.
+ * @retval      NRF_ERROR_NO_MEM  Not enough room in the queue. Nothing was queued.
+ */
+static uint32_t tx_queue_push_fragments(ble_protobuf_t *p_protobuf, int index, uint8_t const *data, size_t size)
+{
+    ble_pb_link_t *p_link = &p_protobuf->links[index];
+    nrf_queue_t const *p_queue = p_protobuf->p_tx_queues[index];
+    uint16_t payload_max = MIN(p_link->mtu - 3, BLE_PB_TX_DATA_MAX_LEN) - BLE_FRAG_HEADER_SIZE;
+    uint16_t count = ble_frag_count(size, payload_max);
+    ble_pb_tx_item_t item;
+
+    // Events that fit in one PDU follow the overflow policy
+    if (count == 1)
+    {
+        item.len = ble_frag_build(item.data, data, size, 0, payload_max, p_link->tx_seq);
+        item.first = true;
+        item.last = true;
+
+        uint32_t err_code = tx_queue_push(p_protobuf, index, &item);
+        if (err_code == NRF_SUCCESS)
+        {
+            p_link->tx_seq++;
+        }
+
+        return err_code;
+    }
+
+    if (nrf_queue_available_get(p_queue) < count)
+    {
+        p_protobuf->tx_stats.dropped++;
+        return NRF_ERROR_NO_MEM;
+    }
+
+    for (size_t offset = 0; offset < size;)
+    {
+        item.len = ble_frag_build(item.data, data, size, offset, payload_max, p_link->tx_seq++);
+        item.first = (item.data[0] & BLE_FRAG_START) != 0;
+        item.last = (item.data[0] & BLE_FRAG_END) != 0;
+        offset += item.len - BLE_FRAG_HEADER_SIZE;
+
+        UNUSED_RETURN_VALUE(tx_queue_push(p_protobuf, index, &item));
+    }
+
+    return NRF_SUCCESS;
 }
 
-// TODO: add comment
 uint32_t ble_protobuf_write(ble_protobuf_t *p_protobuf, uint8_t *data, size_t size)
 {
 
-    ret_code_t err_code;
+    ret_code_t err_code = NRF_ERROR_INVALID_STATE;
+    ble_pb_tx_item_t item;
+    static uint8_t packed[BLE_FRAG_DATA_MAX_LEN];
 
-    // Send value if connected and notifying
-    if (p_protobuf->conn_handle != BLE_CONN_HANDLE_INVALID)
+    if (size == 0 || size > BLE_FRAG_DATA_MAX_LEN)
     {
+        return NRF_ERROR_DATA_SIZE;
+    }
 
-        uint16_t hvx_len = size;
-        ble_gatts_hvx_params_t hvx_params;
+    CRITICAL_REGION_ENTER();
 
-        memset(&hvx_params, 0, sizeof(hvx_params));
+    // The same encoded data goes out to every subscribed central
+    for (int i = 0; i < BLE_PB_LINK_COUNT; i++)
+    {
+        ble_pb_link_t *p_link = &p_protobuf->links[i];
+        uint32_t link_err_code;
 
-        hvx_params.handle = p_protobuf->command_handles.value_handle;
-        hvx_params.type = BLE_GATT_HVX_NOTIFICATION;
-        hvx_params.offset = 0;
-        hvx_params.p_len = &hvx_len;
-        hvx_params.p_data = data;
+        if (p_link->conn_handle == BLE_CONN_HANDLE_INVALID ||
+            !p_link->notifications_enabled)
+        {
+            continue;
+        }
 
-        err_code = sd_ble_gatts_hvx(p_protobuf->conn_handle, &hvx_params);
+        uint8_t *p_frame = data;
+        size_t frame_size = size;
+
+        // Only the header fields that changed on this link
+        if ((p_link->peer_caps & BLE_PB_CAP_HEADER) && !ble_comp_is_compressed(data, size) &&
+            codec_fast_hdr_compress(&p_link->hdr_tx, data, size, packed, sizeof(packed), &frame_size) == NRF_SUCCESS)
+        {
+            p_frame = packed;
+        }
+
+        if (p_link->tx_subscribed)
+        {
+            link_err_code = tx_queue_push_fragments(p_protobuf, i, p_frame, frame_size);
+        }
+        else if (frame_size > MIN(p_link->mtu - 3, sizeof(item.data)))
+        {
+            // The legacy characteristic has no framing
+            link_err_code = NRF_ERROR_DATA_SIZE;
+        }
+        else
+        {
+            item.len = frame_size;
+            item.first = true;
+            item.last = true;
+            memcpy(item.data, p_frame, frame_size);
+
+            link_err_code = tx_queue_push(p_protobuf, i, &item);
+        }
+
+        // Not sent, so not known to the central either
+        if (link_err_code != NRF_SUCCESS)
+        {
+            codec_fast_hdr_reset(&p_link->hdr_tx);
+        }
+
+        // Success if at least one central gets it
+        if (link_err_code == NRF_SUCCESS || err_code == NRF_ERROR_INVALID_STATE)
+        {
+            err_code = link_err_code;
+        }
+
+        tx_queue_drain(p_protobuf, i);
+    }
+
+    CRITICAL_REGION_EXIT();
+
+    return err_code;
+}
+
+void ble_protobuf_mtu_set(ble_protobuf_t *p_protobuf, uint16_t conn_handle, uint16_t mtu)
+{
+    int index = link_index_get(p_protobuf, conn_handle);
+    if (index < 0 || conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        return;
+    }
+
+    p_protobuf->links[index].mtu = mtu;
+}
+
+void ble_protobuf_peer_caps_set(ble_protobuf_t *p_protobuf, uint16_t conn_handle, uint8_t caps)
+{
+    int index = link_index_get(p_protobuf, conn_handle);
+    if (index < 0 || conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        return;
+    }
+
+    p_protobuf->links[index].peer_caps = caps;
+}
+
+uint8_t ble_protobuf_peer_caps_get(ble_protobuf_t *p_protobuf)
+{
+    uint8_t caps = 0xff;
+    bool any = false;
+
+    for (int i = 0; i < BLE_PB_LINK_COUNT; i++)
+    {
+        if (p_protobuf->links[i].conn_handle != BLE_CONN_HANDLE_INVALID &&
+            p_protobuf->links[i].notifications_enabled)
+        {
+            caps &= p_protobuf->links[i].peer_caps;
+            any = true;
+        }
+    }
+
+    return any ? caps : 0;
+}
+
+uint32_t ble_protobuf_snapshot_update(ble_protobuf_t *p_protobuf, uint8_t const *p_name, uint8_t name_len,
+                                      uint8_t const *data, size_t size)
+{
+    ble_pb_snapshot_topic_t *p_topic = NULL;
+    uint32_t err_code = NRF_SUCCESS;
+
+    if (name_len > member_size(ble_pb_snapshot_topic_t, name))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    // Read from the observer on every central read
+    CRITICAL_REGION_ENTER();
+
+    for (int i = 0; i < p_protobuf->snapshot_topic_count; i++)
+    {
+        if (p_protobuf->snapshot_topics[i].name_len == name_len &&
+            memcmp(p_protobuf->snapshot_topics[i].name, p_name, name_len) == 0)
+        {
+            p_topic = &p_protobuf->snapshot_topics[i];
+            break;
+        }
+    }
+
+    uint16_t record_len = BLE_PB_SNAPSHOT_RECORD_HEADER_SIZE + size;
+    uint16_t old_len = p_topic != NULL ? BLE_PB_SNAPSHOT_RECORD_HEADER_SIZE + p_topic->len : 0;
+
+    if (p_topic == NULL && p_protobuf->snapshot_topic_count >= BLE_PB_SNAPSHOT_TOPICS)
+    {
+        err_code = NRF_ERROR_NO_MEM;
+    }
+    else if (p_protobuf->snapshot_len - old_len + record_len > BLE_PB_SNAPSHOT_SIZE)
+    {
+        err_code = NRF_ERROR_NO_MEM;
     }
     else
     {
-        err_code = NRF_ERROR_INVALID_STATE;
+        // New topics go at the end
+        if (p_topic == NULL)
+        {
+            p_topic = &p_protobuf->snapshot_topics[p_protobuf->snapshot_topic_count++];
+            memcpy(p_topic->name, p_name, name_len);
+            p_topic->name_len = name_len;
+            p_topic->offset = p_protobuf->snapshot_len;
+            p_topic->len = 0;
+        }
+
+        // Move the records behind it if the size changed
+        uint16_t tail = p_topic->offset + old_len;
+
+        if (record_len != old_len)
+        {
+            memmove(&p_protobuf->snapshot[p_topic->offset + record_len],
+                    &p_protobuf->snapshot[tail],
+                    p_protobuf->snapshot_len - tail);
+
+            for (int i = 0; i < p_protobuf->snapshot_topic_count; i++)
+            {
+                if (p_protobuf->snapshot_topics[i].offset > p_topic->offset)
+                {
+                    p_protobuf->snapshot_topics[i].offset += record_len - old_len;
+                }
+            }
+
+            p_protobuf->snapshot_len += record_len - old_len;
+        }
+
+        uint16_encode(size, &p_protobuf->snapshot[p_topic->offset]);
+        memcpy(&p_protobuf->snapshot[p_topic->offset + BLE_PB_SNAPSHOT_RECORD_HEADER_SIZE], data, size);
+        p_topic->len = size;
     }
 
+    CRITICAL_REGION_EXIT();
+
     return err_code;
 }
 
+size_t ble_protobuf_tx_pending(ble_protobuf_t *p_protobuf, uint16_t conn_handle)
+{
+    int index = link_index_get(p_protobuf, conn_handle);
+    if (index < 0 || conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        return 0;
+    }
+
+    return nrf_queue_utilization_get(p_protobuf->p_tx_queues[index]);
+}
+
+void ble_protobuf_tx_stats_get(ble_protobuf_t *p_protobuf, ble_pb_tx_stats_t *p_stats)
+{
+    *p_stats = p_protobuf->tx_stats;
+}
+
 /**@brief Function for handling the Disconnect event.
  *
  * @param[in]   p_protobuf       Heart Rate Service structure.
@@ -165,8 +790,19 @@ uint32_t ble_protobuf_write(ble_protobuf_t *p_protobuf, uint8_t *data, size_t si
  */
 static void on_disconnect(ble_protobuf_t *p_protobuf, ble_evt_t const *p_ble_evt)
 {
-    UNUSED_PARAMETER(p_ble_evt);
-    p_protobuf->conn_handle = BLE_CONN_HANDLE_INVALID;
+    int index = link_index_get(p_protobuf, p_ble_evt->evt.gap_evt.conn_handle);
+    if (index < 0)
+    {
+        return;
+    }
+
+    p_protobuf->links[index].conn_handle = BLE_CONN_HANDLE_INVALID;
+    p_protobuf->links[index].notifications_enabled = false;
+    p_protobuf->links[index].tx_subscribed = false;
+    p_protobuf->links[index].command_subscribed = false;
+
+    // Nobody left to send to on this link
+    nrf_queue_reset(p_protobuf->p_tx_queues[index]);
 }
 
 /**@brief Function for handling the Connect event.
@@ -176,7 +812,31 @@ static void on_disconnect(ble_protobuf_t *p_protobuf, ble_evt_t const *p_ble_evt
  */
 static void on_connect(ble_protobuf_t *p_protobuf, ble_evt_t const *p_ble_evt)
 {
-    p_protobuf->conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+    // Only centrals talk to this service
+    if (p_ble_evt->evt.gap_evt.params.connected.role != BLE_GAP_ROLE_PERIPH)
+    {
+        return;
+    }
+
+    int index = link_index_get(p_protobuf, BLE_CONN_HANDLE_INVALID);
+    if (index < 0)
+    {
+        NRF_LOG_WARNING("No free link for 0x%x", p_ble_evt->evt.gap_evt.conn_handle);
+        return;
+    }
+
+    p_protobuf->links[index].conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+    p_protobuf->links[index].notifications_enabled = false;
+    p_protobuf->links[index].tx_subscribed = false;
+    p_protobuf->links[index].command_subscribed = false;
+    p_protobuf->links[index].mtu = BLE_GATT_ATT_MTU_DEFAULT;
+    p_protobuf->links[index].tx_seq = 0;
+    p_protobuf->links[index].peer_caps = 0;
+    p_protobuf->links[index].peer_version = 0;
+    codec_fast_hdr_reset(&p_protobuf->links[index].hdr_tx);
+    codec_fast_hdr_reset(&p_protobuf->links[index].hdr_rx);
+    ble_frag_rx_reset(&p_protobuf->links[index].rx);
+    nrf_queue_reset(p_protobuf->p_tx_queues[index]);
 }
 
 void ble_protobuf_on_ble_evt(ble_evt_t const *p_ble_evt, void *p_context)
@@ -199,6 +859,18 @@ void ble_protobuf_on_ble_evt(ble_evt_t const *p_ble_evt, void *p_context)
     case BLE_GATTS_EVT_WRITE:
         on_write(p_protobuf, p_ble_evt);
         break;
+    case BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST:
+        on_rw_authorize_request(p_protobuf, p_ble_evt);
+        break;
+    case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+    {
+        int index = link_index_get(p_protobuf, p_ble_evt->evt.gatts_evt.conn_handle);
+        if (index >= 0)
+        {
+            tx_queue_drain(p_protobuf, index);
+        }
+    }
+    break;
 
     default:
         // No implementation needed.
@@ -241,6 +913,129 @@ static ret_code_t command_char_add(ble_protobuf_t *p_protobuf, const ble_protobu
     return NRF_SUCCESS;
 }
 
+/**@brief Function for adding the RX characteristic.
+ *
+ * @details Write without response only, so the central can stream without waiting on the peripheral.
+ *
+ * @param[in]   p_protobuf        Protobuf Service structure.
+ * @param[in]   p_protobuf_init   Information needed to initialize the service.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+static ret_code_t rx_char_add(ble_protobuf_t *p_protobuf, const ble_protobuf_init_t *p_protobuf_init)
+{
+    ble_add_char_params_t add_char_params;
+
+    memset(&add_char_params, 0, sizeof(add_char_params));
+
+    add_char_params.uuid = PROTOBUF_UUID_RX_CHAR;
+    add_char_params.max_len = BLE_PB_TX_DATA_MAX_LEN; // One PDU. Events are reassembled.
+    add_char_params.is_var_len = true;
+
+    add_char_params.char_props.write_wo_resp = 1;
+
+    add_char_params.write_access = p_protobuf_init->bl_wr_sec;
+
+    return characteristic_add(p_protobuf->service_handle,
+                              &add_char_params,
+                              &(p_protobuf->rx_handles));
+}
+
+/**@brief Function for adding the TX characteristic.
+ *
+ * @param[in]   p_protobuf        Protobuf Service structure.
+ * @param[in]   p_protobuf_init   Information needed to initialize the service.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+static ret_code_t tx_char_add(ble_protobuf_t *p_protobuf, const ble_protobuf_init_t *p_protobuf_init)
+{
+    ble_add_char_params_t add_char_params;
+
+    memset(&add_char_params, 0, sizeof(add_char_params));
+
+    add_char_params.uuid = PROTOBUF_UUID_TX_CHAR;
+    add_char_params.max_len = BLE_PB_TX_DATA_MAX_LEN; // One PDU. Events are fragmented.
+    add_char_params.is_var_len = true;
+
+    add_char_params.char_props.notify = 1;
+
+    add_char_params.cccd_write_access = p_protobuf_init->bl_cccd_wr_sec;
+
+    return characteristic_add(p_protobuf->service_handle,
+                              &add_char_params,
+                              &(p_protobuf->tx_handles));
+}
+
+/**@brief Function for adding the capability characteristic.
+ *
+ * @details Open, so a central can find out what to speak before bonding. Reads are
+ *          answered by on_rw_authorize_request().
+ *
+ * @param[in]   p_protobuf        Protobuf Service structure.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+static ret_code_t caps_char_add(ble_protobuf_t *p_protobuf)
+{
+    ble_add_char_params_t add_char_params;
+    uint8_t value[BLE_PB_CAPS_LEN];
+
+    ble_pb_caps_encode(value);
+
+    memset(&add_char_params, 0, sizeof(add_char_params));
+
+    add_char_params.uuid = PROTOBUF_UUID_CAPS_CHAR;
+    add_char_params.max_len = BLE_PB_CAPS_LEN;
+    add_char_params.init_len = sizeof(value);
+    add_char_params.p_init_value = value;
+    add_char_params.is_defered_read = true;
+
+    add_char_params.char_props.read = 1;
+    add_char_params.char_props.write = 1;
+
+    add_char_params.read_access = SEC_OPEN;
+    add_char_params.write_access = SEC_OPEN;
+
+    return characteristic_add(p_protobuf->service_handle,
+                              &add_char_params,
+                              &(p_protobuf->caps_handles));
+}
+
+/**@brief Function for adding the snapshot characteristic.
+ *
+ * @details The value lives in snapshot_read. It is refreshed from the snapshot on every read at
+ *          offset 0, the blob reads after it are served from the stack.
+ *
+ * @param[in]   p_protobuf        Protobuf Service structure.
+ * @param[in]   p_protobuf_init   Information needed to initialize the service.
+ *
+ * @return      NRF_SUCCESS on success, otherwise an error code.
+ */
+static ret_code_t snapshot_char_add(ble_protobuf_t *p_protobuf, const ble_protobuf_init_t *p_protobuf_init)
+{
+    ble_add_char_params_t add_char_params;
+
+    memset(&add_char_params, 0, sizeof(add_char_params));
+
+    add_char_params.uuid = PROTOBUF_UUID_SNAPSHOT_CHAR;
+    add_char_params.max_len = BLE_PB_SNAPSHOT_SIZE;
+    add_char_params.init_len = 0;
+    add_char_params.p_init_value = p_protobuf->snapshot_read;
+    add_char_params.is_var_len = true;
+    add_char_params.is_value_user = true;
+    add_char_params.is_defered_read = true;
+
+    add_char_params.char_props.read = 1;
+
+    // Same data as the notifications
+    add_char_params.read_access = p_protobuf_init->bl_cccd_wr_sec;
+
+    return characteristic_add(p_protobuf->service_handle,
+                              &add_char_params,
+                              &(p_protobuf->snapshot_handles));
+}
+
 ret_code_t ble_protobuf_init(ble_protobuf_t *p_protobuf, const ble_protobuf_init_t *p_protobuf_init)
 {
     if (p_protobuf == NULL || p_protobuf_init == NULL)
@@ -254,7 +1049,26 @@ ret_code_t ble_protobuf_init(ble_protobuf_t *p_protobuf, const ble_protobuf_init
 
     // Initialize service structure
     p_protobuf->evt_handler = p_protobuf_init->evt_handler;
-    p_protobuf->conn_handle = BLE_CONN_HANDLE_INVALID;
+    p_protobuf->tx_overflow = p_protobuf_init->tx_overflow;
+    p_protobuf->defer_decode = p_protobuf_init->defer_decode;
+    memset(&p_protobuf->tx_stats, 0, sizeof(p_protobuf->tx_stats));
+    memset(&p_protobuf->rx_cycles, 0, sizeof(p_protobuf->rx_cycles));
+    p_protobuf->snapshot_topic_count = 0;
+    p_protobuf->snapshot_len = 0;
+
+    for (int i = 0; i < BLE_PB_LINK_COUNT; i++)
+    {
+        p_protobuf->links[i].conn_handle = BLE_CONN_HANDLE_INVALID;
+        p_protobuf->links[i].notifications_enabled = false;
+        p_protobuf->links[i].tx_subscribed = false;
+        p_protobuf->links[i].command_subscribed = false;
+        p_protobuf->links[i].mtu = BLE_GATT_ATT_MTU_DEFAULT;
+        p_protobuf->links[i].tx_seq = 0;
+        p_protobuf->links[i].peer_caps = 0;
+        p_protobuf->links[i].peer_version = 0;
+        ble_frag_rx_reset(&p_protobuf->links[i].rx);
+        nrf_queue_reset(p_protobuf->p_tx_queues[i]);
+    }
 
     // Add service
     err_code = sd_ble_uuid_vs_add(&base_uuid, &p_protobuf->uuid_type);
@@ -266,8 +1080,23 @@ ret_code_t ble_protobuf_init(ble_protobuf_t *p_protobuf, const ble_protobuf_init
     err_code = sd_ble_gatts_service_add(BLE_GATTS_SRVC_TYPE_PRIMARY, &ble_uuid, &p_protobuf->service_handle);
     VERIFY_SUCCESS(err_code);
 
-    // Add battery level characteristic
+    // Legacy characteristic for older hubs
     err_code = command_char_add(p_protobuf, p_protobuf_init);
+    VERIFY_SUCCESS(err_code);
+
+    // Uplink and downlink on their own characteristics
+    err_code = rx_char_add(p_protobuf, p_protobuf_init);
+    VERIFY_SUCCESS(err_code);
+
+    err_code = tx_char_add(p_protobuf, p_protobuf_init);
+    VERIFY_SUCCESS(err_code);
+
+    // What this firmware speaks
+    err_code = caps_char_add(p_protobuf);
+    VERIFY_SUCCESS(err_code);
+
+    // Last value of every topic for centrals that poll
+    err_code = snapshot_char_add(p_protobuf, p_protobuf_init);
     return err_code;
 }
 
@@ -53,22 +53,119 @@
 #include "nrf_log.h"
 NRF_LOG_MODULE_REGISTER();
 
-static bool handle_is_valid(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle)
+static void snapshot_done(ble_pb_c_t *p_ble_pb_c);
+
+ble_pb_c_link_t *ble_pb_c_link_get(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle)
+{
+    // Not one of ours, or not a connection at all
+    if (conn_handle >= NRF_SDH_BLE_TOTAL_LINK_COUNT)
+    {
+        return NULL;
+    }
+
+    // Also covers an instance that was never initialized
+    uint8_t index = p_ble_pb_c->link_index[conn_handle];
+    if (index == BLE_PB_C_LINK_INVALID || index >= p_ble_pb_c->link_count ||
+        p_ble_pb_c->links[index].conn_handle != conn_handle)
+    {
+        return NULL;
+    }
+
+    return &p_ble_pb_c->links[index];
+}
+
+/**@brief Function for getting a link whose handles are assigned.
+ */
+static ble_pb_c_link_t *assigned_link_get(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle)
+{
+    ble_pb_c_link_t *p_link = ble_pb_c_link_get(p_ble_pb_c, conn_handle);
+
+    if (p_link == NULL || !p_link->assigned)
+    {
+        return NULL;
+    }
+
+    return p_link;
+}
+
+/**@brief Function for taking a slot for a connection. Returns the one it has if any.
+ *
+ * @details A slot freed by a disconnect is reused before a new one is handed out.
+ *
+ * @return  The link, NULL if every slot is taken.
+ */
+static ble_pb_c_link_t *link_alloc(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle)
 {
+    ble_pb_c_link_t *p_link = ble_pb_c_link_get(p_ble_pb_c, conn_handle);
+
+    if (p_link != NULL)
+    {
+        return p_link;
+    }
 
-    // Return an error if the conn_handle is greater than the possible connections.
     if (conn_handle >= NRF_SDH_BLE_TOTAL_LINK_COUNT)
     {
-        // tODO: necessary?
-        APP_ERROR_CHECK(NRF_ERROR_INVALID_PARAM);
+        return NULL;
     }
 
-    if (p_ble_pb_c->conn_handles[conn_handle] != BLE_CONN_HANDLE_INVALID)
+    uint8_t index = 0;
+    while (index < p_ble_pb_c->link_count && p_ble_pb_c->links[index].conn_handle != BLE_CONN_HANDLE_INVALID)
     {
-        return true;
+        index++;
     }
 
-    return false;
+    if (index == BLE_PB_C_LINK_COUNT)
+    {
+        return NULL;
+    }
+
+    p_link = &p_ble_pb_c->links[index];
+
+    memset(p_link, 0, sizeof(ble_pb_c_link_t));
+    p_link->conn_handle = conn_handle;
+    p_link->mtu = BLE_GATT_ATT_MTU_DEFAULT;
+    p_link->char_handles.cccd_handle = BLE_GATT_HANDLE_INVALID;
+    p_link->char_handles.data_handle = BLE_GATT_HANDLE_INVALID;
+    p_link->char_handles.write_handle = BLE_GATT_HANDLE_INVALID;
+    p_link->char_handles.caps_handle = BLE_GATT_HANDLE_INVALID;
+    p_link->char_handles.snapshot_handle = BLE_GATT_HANDLE_INVALID;
+    ble_frag_rx_reset(&p_link->rx);
+
+    p_ble_pb_c->link_index[conn_handle] = index;
+
+    if (index == p_ble_pb_c->link_count)
+    {
+        p_ble_pb_c->link_count++;
+    }
+
+    return p_link;
+}
+
+/**@brief Function for giving back the slot of a connection.
+ *
+ * @details Runs from the SoftDevice observer, so no link is moved: main context may be
+ *          holding a pointer to one or walking the slots. The slot is only marked free,
+ *          and link_count drops past free slots at the end.
+ */
+static void link_free(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle)
+{
+    ble_pb_c_link_t *p_link = ble_pb_c_link_get(p_ble_pb_c, conn_handle);
+
+    if (p_link == NULL)
+    {
+        return;
+    }
+
+    p_link->assigned = false;
+    p_link->snapshot_pending = false;
+    p_link->conn_handle = BLE_CONN_HANDLE_INVALID;
+    p_ble_pb_c->link_index[conn_handle] = BLE_PB_C_LINK_INVALID;
+
+    while (p_ble_pb_c->link_count > 0 &&
+           p_ble_pb_c->links[p_ble_pb_c->link_count - 1].conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        p_ble_pb_c->link_count--;
+    }
 }
 
 /**@brief Function for interception of the errors of GATTC and the BLE GATT Queue.
@@ -82,15 +179,105 @@ static void gatt_error_handler(uint32_t nrf_error,
                                uint16_t conn_handle)
 {
     ble_pb_c_t *p_ble_pb_c = (ble_pb_c_t *)p_ctx;
+    ble_pb_c_link_t *p_link = ble_pb_c_link_get(p_ble_pb_c, conn_handle);
 
     NRF_LOG_DEBUG("A GATT Client error has occurred on conn_handle: 0X%X", conn_handle);
 
+    // A write may be lost. The next one carries the full header.
+    if (p_link != NULL)
+    {
+        codec_fast_hdr_reset(&p_link->hdr_tx);
+    }
+
     if (p_ble_pb_c->error_handler != NULL)
     {
         p_ble_pb_c->error_handler(nrf_error);
     }
 }
 
+/**@brief Function for handing a complete encoded event of a link to the application.
+ *
+ * @param[in] p_ble_pb_c Pointer to the Protobuf Client structure.
+ * @param[in] p_link     Link the event came from.
+ * @param[in] p_data     Encoded event, compressed or not.
+ * @param[in] len        Length of the encoded event.
+ */
+static void data_dispatch(ble_pb_c_t *p_ble_pb_c, ble_pb_c_link_t *p_link, uint8_t const *p_data, uint16_t len)
+{
+    // Where the data is going
+    static ble_pb_c_evt_t ble_pb_c_evt;
+
+    // Fill in what the peer left out of the header
+    if (codec_fast_hdr_is_compressed(p_data, len))
+    {
+        static uint8_t expanded[sizeof(pyrinas_event_t)];
+        size_t expanded_len;
+
+        p_link->peer_caps |= BLE_PB_CAP_HEADER;
+
+        ret_code_t err_code = codec_fast_hdr_expand(&p_link->hdr_rx, p_data, len,
+                                                    expanded, sizeof(expanded), &expanded_len);
+        if (err_code != NRF_SUCCESS)
+        {
+            NRF_LOG_WARNING("Header from 0x%x not restored. Err: 0x%x", p_link->conn_handle, err_code);
+            return;
+        }
+
+        p_data = expanded;
+        len = expanded_len;
+    }
+
+    // A peer that compresses also takes compressed frames
+    if (ble_comp_is_compressed(p_data, len))
+    {
+        p_link->peer_caps |= BLE_PB_CAP_COMPRESS;
+    }
+
+    ble_pb_c_evt.conn_handle = p_link->conn_handle;
+
+    // Leave the decoding to the main context
+    if (p_ble_pb_c->defer_decode)
+    {
+        ble_pb_c_evt.evt_type = BLE_PB_C_EVT_RAW;
+        ble_pb_c_evt.params.raw.p_data = p_data;
+        ble_pb_c_evt.params.raw.len = len;
+
+        p_ble_pb_c->evt_handler(p_ble_pb_c, &ble_pb_c_evt);
+        return;
+    }
+
+    // Restore the encoded event
+    if (ble_comp_is_compressed(p_data, len))
+    {
+        static uint8_t unpacked[sizeof(pyrinas_event_t)];
+        size_t unpacked_len;
+
+        if (ble_comp_decompress(p_data, len, unpacked, sizeof(unpacked), &unpacked_len) != NRF_SUCCESS)
+        {
+            NRF_LOG_ERROR("Unable to decompress ble data!");
+            return;
+        }
+
+        p_data = unpacked;
+        len = unpacked_len;
+    }
+
+    // Read in buffer
+    int err = pyrinas_codec_decode(&ble_pb_c_evt.params.data, p_data, len);
+    if (err)
+    {
+        NRF_LOG_ERROR("Unable to decode ble data!");
+        return;
+    }
+
+    NRF_LOG_DEBUG("%s %s", ble_pb_c_evt.params.data.name.bytes, ble_pb_c_evt.params.data.data.bytes);
+
+    // Set the event type
+    ble_pb_c_evt.evt_type = BLE_PB_C_EVT_NOTIFICATION;
+
+    p_ble_pb_c->evt_handler(p_ble_pb_c, &ble_pb_c_evt);
+}
+
 /**@brief     Function for handling Handle Value Notification received from the SoftDevice.
  *
  * @details   This function uses the Handle Value Notification received from the SoftDevice
@@ -104,9 +291,10 @@ static void gatt_error_handler(uint32_t nrf_error,
 static void on_hvx(ble_pb_c_t *p_ble_pb_c, const ble_evt_t *p_ble_evt)
 {
     uint16_t conn_handle = p_ble_evt->evt.gattc_evt.conn_handle;
+    ble_pb_c_link_t *p_link = assigned_link_get(p_ble_pb_c, conn_handle);
 
     // Check if the event is on the link for this instance.
-    if (!handle_is_valid(p_ble_pb_c, conn_handle))
+    if (p_link == NULL)
     {
         NRF_LOG_DEBUG("Received HVX on link 0x%x, not associated to this instance. Ignore.",
                       conn_handle);
@@ -118,29 +306,36 @@ static void on_hvx(ble_pb_c_t *p_ble_pb_c, const ble_evt_t *p_ble_evt)
                   p_ble_evt->evt.gattc_evt.params.hvx.handle);
 
     // Check if this is a protobuf notification.
-    if (p_ble_evt->evt.gattc_evt.params.hvx.handle == p_ble_pb_c->char_handles[conn_handle].data_handle)
+    if (p_ble_evt->evt.gattc_evt.params.hvx.handle == p_link->char_handles.data_handle)
     {
         // Decode the data
         ble_gattc_evt_hvx_t const *p_evt_data = &p_ble_evt->evt.gattc_evt.params.hvx;
+        uint8_t const *p_data = p_evt_data->data;
+        uint16_t len = p_evt_data->len;
+        uint32_t begin = util_cycles_get();
 
-        // Where the data is going
-        static ble_pb_c_evt_t ble_pb_c_evt;
-
-        // Read in buffer
-        int err = pyrinas_codec_decode(&ble_pb_c_evt.params.data, p_evt_data->data, p_evt_data->len);
-        if (err)
+        // Events on the TX characteristic may span several notifications
+        if (p_link->char_handles.framed)
         {
-            NRF_LOG_ERROR("Unable to decode ble data!");
-            return;
-        }
+            ble_frag_rx_t *p_rx = &p_link->rx;
 
-        NRF_LOG_DEBUG("%s %s", ble_pb_c_evt.params.data.name.bytes, ble_pb_c_evt.params.data.data.bytes);
+            ble_frag_rx_result_t result = ble_frag_rx_put(p_rx, p_data, len);
+            if (result == BLE_FRAG_RX_ERROR)
+            {
+                NRF_LOG_WARNING("Fragment dropped on 0x%x", conn_handle);
+                return;
+            }
+            else if (result == BLE_FRAG_RX_PENDING)
+            {
+                return;
+            }
 
-        // Set the event type
-        ble_pb_c_evt.evt_type = BLE_PB_C_EVT_NOTIFICATION;
-        ble_pb_c_evt.conn_handle = conn_handle;
+            p_data = p_rx->data;
+            len = p_rx->len;
+        }
 
-        p_ble_pb_c->evt_handler(p_ble_pb_c, &ble_pb_c_evt);
+        data_dispatch(p_ble_pb_c, p_link, p_data, len);
+        util_cycles_stats_add(&p_ble_pb_c->rx_cycles, begin);
     }
 }
 
@@ -158,13 +353,267 @@ static void on_disconnected(ble_pb_c_t *p_ble_pb_c, const ble_evt_t *p_ble_evt)
 
     uint16_t conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
 
-    // Check if the event is on the link for this instance.
-    if (handle_is_valid(p_ble_pb_c, conn_handle))
+    // The slot is free for the next peripheral
+    link_free(p_ble_pb_c, conn_handle);
+
+    // Its snapshot will not finish
+    if (conn_handle == p_ble_pb_c->snapshot_conn_handle)
+    {
+        snapshot_done(p_ble_pb_c);
+    }
+}
+
+/**@brief     Function for handling Connected event received from the SoftDevice.
+ *
+ * @details   The link gets its slot right away. The MTU may be exchanged before the handles are assigned.
+ *
+ * @param[in] p_ble_pb_c Pointer to the Protobuf Client structure.
+ * @param[in] p_ble_evt   Pointer to the BLE event received.
+ */
+static void on_connected(ble_pb_c_t *p_ble_pb_c, const ble_evt_t *p_ble_evt)
+{
+    // Only peripherals are served by this client
+    if (p_ble_evt->evt.gap_evt.params.connected.role != BLE_GAP_ROLE_CENTRAL)
+    {
+        return;
+    }
+
+    if (link_alloc(p_ble_pb_c, p_ble_evt->evt.gap_evt.conn_handle) == NULL)
+    {
+        NRF_LOG_WARNING("No free link for 0x%x", p_ble_evt->evt.gap_evt.conn_handle);
+    }
+}
+
+/**@brief Function for queuing a read of the capability characteristic.
+ */
+static uint32_t caps_read(ble_pb_c_t *p_ble_pb_c, ble_pb_c_link_t *p_link)
+{
+    nrf_ble_gq_req_t read_req;
+
+    memset(&read_req, 0, sizeof(nrf_ble_gq_req_t));
+
+    read_req.type = NRF_BLE_GQ_REQ_GATTC_READ;
+    read_req.error_handler.cb = gatt_error_handler;
+    read_req.error_handler.p_ctx = p_ble_pb_c;
+    read_req.params.gattc_read.handle = p_link->char_handles.caps_handle;
+    read_req.params.gattc_read.offset = 0;
+
+    return nrf_ble_gq_item_add(p_ble_pb_c->p_gatt_queue, &read_req, p_link->conn_handle);
+}
+
+/**@brief Function for queuing a write of our capabilities so the peer knows what to send.
+ */
+static uint32_t caps_write(ble_pb_c_t *p_ble_pb_c, ble_pb_c_link_t *p_link)
+{
+    nrf_ble_gq_req_t write_req;
+    uint8_t value[BLE_PB_CAPS_LEN];
+
+    ble_pb_caps_encode(value);
+
+    memset(&write_req, 0, sizeof(nrf_ble_gq_req_t));
+
+    write_req.type = NRF_BLE_GQ_REQ_GATTC_WRITE;
+    write_req.error_handler.cb = gatt_error_handler;
+    write_req.error_handler.p_ctx = p_ble_pb_c;
+    write_req.params.gattc_write.handle = p_link->char_handles.caps_handle;
+    write_req.params.gattc_write.len = sizeof(value);
+    write_req.params.gattc_write.p_value = value;
+    write_req.params.gattc_write.offset = 0;
+    write_req.params.gattc_write.write_op = BLE_GATT_OP_WRITE_REQ;
+
+    return nrf_ble_gq_item_add(p_ble_pb_c->p_gatt_queue, &write_req, p_link->conn_handle);
+}
+
+/**@brief Function for giving up on the snapshot read in progress when the queue fails it.
+ */
+static void snapshot_error_handler(uint32_t nrf_error,
+                                   void *p_ctx,
+                                   uint16_t conn_handle)
+{
+    ble_pb_c_t *p_ble_pb_c = (ble_pb_c_t *)p_ctx;
+
+    if (conn_handle == p_ble_pb_c->snapshot_conn_handle)
+    {
+        p_ble_pb_c->snapshot_conn_handle = BLE_CONN_HANDLE_INVALID;
+    }
+
+    gatt_error_handler(nrf_error, p_ctx, conn_handle);
+}
+
+/**@brief Function for queuing one read of the snapshot characteristic.
+ */
+static uint32_t snapshot_read(ble_pb_c_t *p_ble_pb_c, ble_pb_c_link_t *p_link, uint16_t offset)
+{
+    nrf_ble_gq_req_t read_req;
+
+    memset(&read_req, 0, sizeof(nrf_ble_gq_req_t));
+
+    read_req.type = NRF_BLE_GQ_REQ_GATTC_READ;
+    read_req.error_handler.cb = snapshot_error_handler;
+    read_req.error_handler.p_ctx = p_ble_pb_c;
+    read_req.params.gattc_read.handle = p_link->char_handles.snapshot_handle;
+    read_req.params.gattc_read.offset = offset;
+
+    return nrf_ble_gq_item_add(p_ble_pb_c->p_gatt_queue, &read_req, p_link->conn_handle);
+}
+
+/**@brief Function for starting the snapshot read of the next link that asked for one.
+ *
+ * @details One link at a time, they share the buffer.
+ */
+static void snapshot_next(ble_pb_c_t *p_ble_pb_c)
+{
+    if (p_ble_pb_c->snapshot_conn_handle != BLE_CONN_HANDLE_INVALID)
+    {
+        return;
+    }
+
+    for (int i = 0; i < p_ble_pb_c->link_count; i++)
+    {
+        ble_pb_c_link_t *p_link = &p_ble_pb_c->links[i];
+
+        if (!p_link->snapshot_pending)
+        {
+            continue;
+        }
+
+        p_link->snapshot_pending = false;
+        p_ble_pb_c->snapshot_len = 0;
+
+        ret_code_t err_code = snapshot_read(p_ble_pb_c, p_link, 0);
+        if (err_code == NRF_SUCCESS)
+        {
+            p_ble_pb_c->snapshot_conn_handle = p_link->conn_handle;
+            return;
+        }
+
+        NRF_LOG_WARNING("Unable to read snapshot of 0x%x. Err: 0x%x", p_link->conn_handle, err_code);
+    }
+}
+
+/**@brief Function for finishing the snapshot read in progress and starting the next.
+ */
+static void snapshot_done(ble_pb_c_t *p_ble_pb_c)
+{
+    p_ble_pb_c->snapshot_conn_handle = BLE_CONN_HANDLE_INVALID;
+    snapshot_next(p_ble_pb_c);
+}
+
+/**@brief Function for collecting the snapshot of a link and handing out its events.
+ *
+ * @details The peer sends at most ATT MTU - 1 bytes per read. A shorter answer is the last.
+ */
+static void on_snapshot_read_rsp(ble_pb_c_t *p_ble_pb_c, ble_pb_c_link_t *p_link, const ble_evt_t *p_ble_evt)
+{
+    ble_gattc_evt_read_rsp_t const *p_rsp = &p_ble_evt->evt.gattc_evt.params.read_rsp;
+
+    if (p_ble_evt->evt.gattc_evt.gatt_status != BLE_GATT_STATUS_SUCCESS)
+    {
+        NRF_LOG_WARNING("Snapshot read of 0x%x failed. Status: 0x%x",
+                        p_link->conn_handle, p_ble_evt->evt.gattc_evt.gatt_status);
+        snapshot_done(p_ble_pb_c);
+        return;
+    }
+
+    uint16_t len = MIN(p_rsp->len, sizeof(p_ble_pb_c->snapshot) - p_ble_pb_c->snapshot_len);
+    memcpy(&p_ble_pb_c->snapshot[p_ble_pb_c->snapshot_len], p_rsp->data, len);
+    p_ble_pb_c->snapshot_len += len;
+
+    // More to come
+    if (p_rsp->len == p_link->mtu - 1 && p_ble_pb_c->snapshot_len < sizeof(p_ble_pb_c->snapshot))
     {
-        p_ble_pb_c->conn_handles[conn_handle] = BLE_CONN_HANDLE_INVALID;
-        p_ble_pb_c->char_handles[conn_handle].cccd_handle = BLE_GATT_HANDLE_INVALID;
-        p_ble_pb_c->char_handles[conn_handle].data_handle = BLE_GATT_HANDLE_INVALID;
-        p_ble_pb_c->rssi[conn_handle] = 0;
+        ret_code_t err_code = snapshot_read(p_ble_pb_c, p_link, p_ble_pb_c->snapshot_len);
+        if (err_code == NRF_SUCCESS)
+        {
+            return;
+        }
+
+        NRF_LOG_WARNING("Snapshot of 0x%x cut short. Err: 0x%x", p_link->conn_handle, err_code);
+    }
+
+    NRF_LOG_INFO("Snapshot of 0x%x: %d bytes", p_link->conn_handle, p_ble_pb_c->snapshot_len);
+
+    // Same path as notifications
+    for (uint16_t offset = 0; offset + BLE_PB_SNAPSHOT_RECORD_HEADER_SIZE <= p_ble_pb_c->snapshot_len;)
+    {
+        uint16_t record_len = uint16_decode(&p_ble_pb_c->snapshot[offset]);
+        offset += BLE_PB_SNAPSHOT_RECORD_HEADER_SIZE;
+
+        if (offset + record_len > p_ble_pb_c->snapshot_len)
+        {
+            NRF_LOG_WARNING("Snapshot of 0x%x truncated.", p_link->conn_handle);
+            break;
+        }
+
+        data_dispatch(p_ble_pb_c, p_link, &p_ble_pb_c->snapshot[offset], record_len);
+        offset += record_len;
+    }
+
+    snapshot_done(p_ble_pb_c);
+}
+
+/**@brief Function for caching the capabilities read from the peer.
+ *
+ * @param[in] p_ble_pb_c Pointer to the Protobuf Client structure.
+ * @param[in] p_link     Link the answer came on.
+ * @param[in] p_ble_evt   Pointer to the BLE event received.
+ */
+static void on_caps_read_rsp(ble_pb_c_t *p_ble_pb_c, ble_pb_c_link_t *p_link, const ble_evt_t *p_ble_evt)
+{
+    uint16_t conn_handle = p_link->conn_handle;
+    ble_gattc_evt_read_rsp_t const *p_rsp = &p_ble_evt->evt.gattc_evt.params.read_rsp;
+
+    if (p_ble_evt->evt.gattc_evt.gatt_status != BLE_GATT_STATUS_SUCCESS)
+    {
+        return;
+    }
+
+    uint8_t version;
+    uint8_t caps;
+
+    if (!ble_pb_caps_decode(p_rsp->data, p_rsp->len, &version, &caps))
+    {
+        NRF_LOG_WARNING("Invalid capabilities from 0x%x", conn_handle);
+        return;
+    }
+
+    // Learned from received frames so far. Now the peer said it.
+    p_link->peer_version = version;
+    p_link->peer_caps = caps;
+
+    NRF_LOG_INFO("Peripheral 0x%x: version %d, caps 0x%x", conn_handle, version, caps);
+
+    // Tell the peer what we take in return
+    ret_code_t err_code = caps_write(p_ble_pb_c, p_link);
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Unable to write capabilities to 0x%x. Err: 0x%x", conn_handle, err_code);
+    }
+}
+
+/**@brief Function for handling the answer to a read of one of the characteristics.
+ *
+ * @param[in] p_ble_pb_c Pointer to the Protobuf Client structure.
+ * @param[in] p_ble_evt   Pointer to the BLE event received.
+ */
+static void on_read_rsp(ble_pb_c_t *p_ble_pb_c, const ble_evt_t *p_ble_evt)
+{
+    uint16_t handle = p_ble_evt->evt.gattc_evt.params.read_rsp.handle;
+    ble_pb_c_link_t *p_link = assigned_link_get(p_ble_pb_c, p_ble_evt->evt.gattc_evt.conn_handle);
+
+    if (p_link == NULL)
+    {
+        return;
+    }
+
+    if (handle == p_link->char_handles.caps_handle)
+    {
+        on_caps_read_rsp(p_ble_pb_c, p_link, p_ble_evt);
+    }
+    else if (handle == p_link->char_handles.snapshot_handle &&
+             p_link->conn_handle == p_ble_pb_c->snapshot_conn_handle)
+    {
+        on_snapshot_read_rsp(p_ble_pb_c, p_link, p_ble_evt);
     }
 }
 
@@ -186,34 +635,79 @@ void ble_pb_on_db_disc_evt(ble_pb_c_t *p_ble_pb_c, const ble_db_discovery_evt_t
         evt.evt_type = BLE_PB_C_EVT_DISCOVERY_COMPLETE;
         evt.conn_handle = conn_handle;
 
+        pb_db_t legacy = {BLE_GATT_HANDLE_INVALID, BLE_GATT_HANDLE_INVALID, BLE_GATT_HANDLE_INVALID, false,
+                          BLE_GATT_HANDLE_INVALID, BLE_GATT_HANDLE_INVALID};
+
+        evt.params.peer_db = legacy;
+
         for (i = 0; i < p_evt->params.discovered_db.char_count; i++)
         {
-            if (p_evt->params.discovered_db.charateristics[i].characteristic.uuid.uuid ==
-                PROTOBUF_UUID_CONFIG_CHAR)
+            ble_gatt_db_char_t const *p_char = &p_evt->params.discovered_db.charateristics[i];
+
+            switch (p_char->characteristic.uuid.uuid)
             {
-                // Found Protobuf characteristic. Store CCCD handle and break.
-                evt.params.peer_db.cccd_handle =
-                    p_evt->params.discovered_db.charateristics[i].cccd_handle;
-                evt.params.peer_db.data_handle =
-                    p_evt->params.discovered_db.charateristics[i].characteristic.handle_value;
+            case PROTOBUF_UUID_CONFIG_CHAR:
+                legacy.cccd_handle = p_char->cccd_handle;
+                legacy.data_handle = p_char->characteristic.handle_value;
+                legacy.write_handle = p_char->characteristic.handle_value;
+                break;
+            case PROTOBUF_UUID_RX_CHAR:
+                evt.params.peer_db.write_handle = p_char->characteristic.handle_value;
+                break;
+            case PROTOBUF_UUID_TX_CHAR:
+                evt.params.peer_db.cccd_handle = p_char->cccd_handle;
+                evt.params.peer_db.data_handle = p_char->characteristic.handle_value;
+                break;
+            case PROTOBUF_UUID_CAPS_CHAR:
+                evt.params.peer_db.caps_handle = p_char->characteristic.handle_value;
+                legacy.caps_handle = p_char->characteristic.handle_value;
+                break;
+            case PROTOBUF_UUID_SNAPSHOT_CHAR:
+                evt.params.peer_db.snapshot_handle = p_char->characteristic.handle_value;
+                legacy.snapshot_handle = p_char->characteristic.handle_value;
+                break;
+            default:
                 break;
             }
         }
 
+        // Framing is only spoken on RX and TX together. Older peripherals only have the Command characteristic.
+        if (evt.params.peer_db.data_handle != BLE_GATT_HANDLE_INVALID &&
+            evt.params.peer_db.write_handle != BLE_GATT_HANDLE_INVALID)
+        {
+            evt.params.peer_db.framed = true;
+        }
+        else
+        {
+            evt.params.peer_db = legacy;
+        }
+
         NRF_LOG_DEBUG("Protobuf Service discovered at peer.");
         //If the instance has been assigned prior to db_discovery, assign the db_handles.
 
         // Check if the event is on the link for this instance.
-        if (handle_is_valid(p_ble_pb_c, conn_handle))
+        ble_pb_c_link_t *p_link = assigned_link_get(p_ble_pb_c, conn_handle);
+        if (p_link != NULL)
         {
-            if ((p_ble_pb_c->char_handles[conn_handle].cccd_handle == BLE_GATT_HANDLE_INVALID) &&
-                (p_ble_pb_c->char_handles[conn_handle].data_handle == BLE_GATT_HANDLE_INVALID))
+            if ((p_link->char_handles.cccd_handle == BLE_GATT_HANDLE_INVALID) &&
+                (p_link->char_handles.data_handle == BLE_GATT_HANDLE_INVALID))
             {
-                p_ble_pb_c->char_handles[conn_handle] = evt.params.peer_db;
+                p_link->char_handles = evt.params.peer_db;
             }
         }
 
         p_ble_pb_c->evt_handler(p_ble_pb_c, &evt);
+
+        // Handles are assigned by now. Find out what the peer speaks.
+        p_link = assigned_link_get(p_ble_pb_c, conn_handle);
+        if (p_link != NULL && p_link->char_handles.caps_handle != BLE_GATT_HANDLE_INVALID)
+        {
+            ret_code_t err_code = caps_read(p_ble_pb_c, p_link);
+            if (err_code != NRF_SUCCESS)
+            {
+                NRF_LOG_WARNING("Unable to read capabilities of 0x%x. Err: 0x%x", conn_handle, err_code);
+            }
+        }
     }
 }
 
@@ -229,13 +723,14 @@ uint32_t ble_pb_c_init(ble_pb_c_t *p_ble_pb_c, ble_pb_c_init_t *p_ble_pb_c_init)
     p_ble_pb_c->evt_handler = p_ble_pb_c_init->evt_handler;
     p_ble_pb_c->error_handler = p_ble_pb_c_init->error_handler;
     p_ble_pb_c->p_gatt_queue = p_ble_pb_c_init->p_gatt_queue;
+    p_ble_pb_c->defer_decode = p_ble_pb_c_init->defer_decode;
+    memset(&p_ble_pb_c->rx_cycles, 0, sizeof(p_ble_pb_c->rx_cycles));
 
-    for (int i = 0; i < NRF_SDH_BLE_TOTAL_LINK_COUNT; i++)
-    {
-        p_ble_pb_c->conn_handles[i] = BLE_CONN_HANDLE_INVALID;
-        p_ble_pb_c->char_handles[i].cccd_handle = BLE_GATT_HANDLE_INVALID;
-        p_ble_pb_c->char_handles[i].data_handle = BLE_GATT_HANDLE_INVALID;
-    }
+    // No links yet
+    p_ble_pb_c->link_count = 0;
+    p_ble_pb_c->snapshot_conn_handle = BLE_CONN_HANDLE_INVALID;
+    p_ble_pb_c->snapshot_len = 0;
+    memset(p_ble_pb_c->link_index, BLE_PB_C_LINK_INVALID, sizeof(p_ble_pb_c->link_index));
 
     // Register longer uuid. Generates uuid_type
     err_code = sd_ble_uuid_vs_add(&pb_base_uuid, &p_ble_pb_c->uuid_type);
@@ -267,6 +762,14 @@ void ble_pb_c_on_ble_evt(ble_evt_t const *p_ble_evt, void *p_context)
         on_hvx(p_ble_pb_c, p_ble_evt);
         break;
 
+    case BLE_GATTC_EVT_READ_RSP:
+        on_read_rsp(p_ble_pb_c, p_ble_evt);
+        break;
+
+    case BLE_GAP_EVT_CONNECTED:
+        on_connected(p_ble_pb_c, p_ble_evt);
+        break;
+
     case BLE_GAP_EVT_DISCONNECTED:
         on_disconnected(p_ble_pb_c, p_ble_evt);
         break;
@@ -276,16 +779,10 @@ void ble_pb_c_on_ble_evt(ble_evt_t const *p_ble_evt, void *p_context)
     }
 }
 
-uint32_t ble_pb_c_write(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle, uint8_t *data, size_t size)
+/**@brief Function for queuing one write command.
+ */
+static uint32_t write_cmd(ble_pb_c_t *p_ble_pb_c, ble_pb_c_link_t *p_link, uint8_t *data, size_t size)
 {
-    VERIFY_PARAM_NOT_NULL(p_ble_pb_c);
-
-    // Return an error if the handle is not set.
-    if (!handle_is_valid(p_ble_pb_c, conn_handle))
-        return NRF_ERROR_INVALID_PARAM;
-
-    NRF_LOG_DEBUG("Writing %d bytes", size);
-
     nrf_ble_gq_req_t write_req;
 
     memset(&write_req, 0, sizeof(nrf_ble_gq_req_t));
@@ -293,13 +790,106 @@ uint32_t ble_pb_c_write(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle, uint8_t *d
     write_req.type = NRF_BLE_GQ_REQ_GATTC_WRITE;
     write_req.error_handler.cb = gatt_error_handler;
     write_req.error_handler.p_ctx = p_ble_pb_c;
-    write_req.params.gattc_write.handle = p_ble_pb_c->char_handles[conn_handle].data_handle;
+    write_req.params.gattc_write.handle = p_link->char_handles.write_handle;
     write_req.params.gattc_write.len = size;
     write_req.params.gattc_write.p_value = data;
     write_req.params.gattc_write.offset = 0;
     write_req.params.gattc_write.write_op = BLE_GATT_OP_WRITE_CMD;
 
-    return nrf_ble_gq_item_add(p_ble_pb_c->p_gatt_queue, &write_req, conn_handle);
+    return nrf_ble_gq_item_add(p_ble_pb_c->p_gatt_queue, &write_req, p_link->conn_handle);
+}
+
+/**@brief Function for writing one frame, split into PDUs on the framed characteristic.
+ */
+static uint32_t frame_write(ble_pb_c_t *p_ble_pb_c, ble_pb_c_link_t *p_link, uint8_t *data, size_t size,
+                            uint16_t pdu_max)
+{
+    // The legacy characteristic has no framing
+    if (!p_link->char_handles.framed)
+    {
+        if (size > pdu_max)
+            return NRF_ERROR_DATA_SIZE;
+
+        return write_cmd(p_ble_pb_c, p_link, data, size);
+    }
+
+    if (size == 0 || size > BLE_FRAG_DATA_MAX_LEN)
+        return NRF_ERROR_DATA_SIZE;
+
+    // The queue copies every PDU, so one buffer does
+    uint8_t pdu[NRF_BLE_GQ_GATTC_WRITE_MAX_DATA_LEN];
+    uint16_t payload_max = pdu_max - BLE_FRAG_HEADER_SIZE;
+    uint16_t conn_handle = p_link->conn_handle;
+
+    for (size_t offset = 0; offset < size;)
+    {
+        // Disconnected part way, and the slot may already belong to another peer
+        if (p_link->conn_handle != conn_handle)
+        {
+            return NRF_ERROR_INVALID_STATE;
+        }
+
+        uint16_t len = ble_frag_build(pdu, data, size, offset, payload_max, p_link->tx_seq++);
+        offset += len - BLE_FRAG_HEADER_SIZE;
+
+        uint32_t err_code = write_cmd(p_ble_pb_c, p_link, pdu, len);
+        VERIFY_SUCCESS(err_code);
+    }
+
+    return NRF_SUCCESS;
+}
+
+uint32_t ble_pb_c_write(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle, uint8_t *data, size_t size)
+{
+    VERIFY_PARAM_NOT_NULL(p_ble_pb_c);
+
+    // Return an error if the handle is not set.
+    ble_pb_c_link_t *p_link = assigned_link_get(p_ble_pb_c, conn_handle);
+    if (p_link == NULL)
+        return NRF_ERROR_INVALID_PARAM;
+
+    NRF_LOG_DEBUG("Writing %d bytes", size);
+
+    uint16_t pdu_max = MIN(p_link->mtu - 3, NRF_BLE_GQ_GATTC_WRITE_MAX_DATA_LEN);
+
+    // Only the header fields that changed on this link
+    static uint8_t packed[BLE_FRAG_DATA_MAX_LEN];
+    size_t packed_len;
+
+    if ((p_link->peer_caps & BLE_PB_CAP_HEADER) && !ble_comp_is_compressed(data, size) &&
+        codec_fast_hdr_compress(&p_link->hdr_tx, data, size, packed, sizeof(packed), &packed_len) == NRF_SUCCESS)
+    {
+        data = packed;
+        size = packed_len;
+    }
+
+    uint32_t err_code = frame_write(p_ble_pb_c, p_link, data, size, pdu_max);
+
+    // Not sent, so not known to the peer either
+    if (err_code != NRF_SUCCESS)
+    {
+        codec_fast_hdr_reset(&p_link->hdr_tx);
+    }
+
+    return err_code;
+}
+
+void ble_pb_c_mtu_set(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle, uint16_t mtu)
+{
+    ble_pb_c_link_t *p_link = ble_pb_c_link_get(p_ble_pb_c, conn_handle);
+    if (p_link == NULL)
+        return;
+
+    p_link->mtu = mtu;
+}
+
+void ble_pb_c_peer_caps_set(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle, uint8_t caps)
+{
+    ble_pb_c_link_t *p_link = ble_pb_c_link_get(p_ble_pb_c, conn_handle);
+    if (p_link == NULL)
+        return;
+
+    p_link->peer_caps = caps;
 }
 
 /**@brief Function for creating a message for writing to the CCCD.
@@ -308,11 +898,12 @@ static uint32_t cccd_configure(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle, boo
 {
 
     // Return an error if the handle is not set.
-    if (!handle_is_valid(p_ble_pb_c, conn_handle))
+    ble_pb_c_link_t *p_link = assigned_link_get(p_ble_pb_c, conn_handle);
+    if (p_link == NULL)
         return NRF_ERROR_INVALID_PARAM;
 
     NRF_LOG_DEBUG("Configuring CCCD. CCCD Handle = %d, Connection Handle = %d",
-                  p_ble_pb_c->char_handles[conn_handle].cccd_handle,
+                  p_link->char_handles.cccd_handle,
                   conn_handle);
 
     nrf_ble_gq_req_t pb_c_req;
@@ -327,7 +918,7 @@ static uint32_t cccd_configure(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle, boo
     pb_c_req.type = NRF_BLE_GQ_REQ_GATTC_WRITE;
     pb_c_req.error_handler.cb = gatt_error_handler;
     pb_c_req.error_handler.p_ctx = p_ble_pb_c;
-    pb_c_req.params.gattc_write.handle = p_ble_pb_c->char_handles[conn_handle].cccd_handle;
+    pb_c_req.params.gattc_write.handle = p_link->char_handles.cccd_handle;
     pb_c_req.params.gattc_write.len = BLE_CCCD_VALUE_LEN;
     pb_c_req.params.gattc_write.p_value = cccd;
     pb_c_req.params.gattc_write.write_op = BLE_GATT_OP_WRITE_REQ;
@@ -335,6 +926,24 @@ static uint32_t cccd_configure(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle, boo
     return nrf_ble_gq_item_add(p_ble_pb_c->p_gatt_queue, &pb_c_req, conn_handle);
 }
 
+uint32_t ble_pb_c_snapshot_read(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle)
+{
+    VERIFY_PARAM_NOT_NULL(p_ble_pb_c);
+
+    ble_pb_c_link_t *p_link = assigned_link_get(p_ble_pb_c, conn_handle);
+    if (p_link == NULL)
+        return NRF_ERROR_INVALID_PARAM;
+
+    // Older peripherals
+    if (p_link->char_handles.snapshot_handle == BLE_GATT_HANDLE_INVALID)
+        return NRF_ERROR_NOT_SUPPORTED;
+
+    p_link->snapshot_pending = true;
+    snapshot_next(p_ble_pb_c);
+
+    return NRF_SUCCESS;
+}
+
 uint32_t ble_pb_c_notif_enable(ble_pb_c_t *p_ble_pb_c, uint16_t conn_handle)
 {
     VERIFY_PARAM_NOT_NULL(p_ble_pb_c);
@@ -348,14 +957,23 @@ uint32_t ble_pb_c_handles_assign(ble_pb_c_t *p_ble_pb_c,
 {
     VERIFY_PARAM_NOT_NULL(p_ble_pb_c);
 
+    // Usually taken on connect already
+    ble_pb_c_link_t *p_link = link_alloc(p_ble_pb_c, conn_handle);
+    if (p_link == NULL)
+        return NRF_ERROR_NO_MEM;
+
     // Reset RSSI
-    p_ble_pb_c->rssi[conn_handle] = 0;
+    p_link->rssi = 0;
+
+    // Start a fresh stream
+    p_link->tx_seq = 0;
+    ble_frag_rx_reset(&p_link->rx);
 
-    // Set conn handle
-    p_ble_pb_c->conn_handles[conn_handle] = conn_handle;
+    // Handles are known
+    p_link->assigned = true;
     if (p_peer_data_handles != NULL)
     {
-        p_ble_pb_c->char_handles[conn_handle] = *p_peer_data_handles;
+        p_link->char_handles = *p_peer_data_handles;
     }
 
     return nrf_ble_gq_conn_handle_register(p_ble_pb_c->p_gatt_queue, conn_handle);
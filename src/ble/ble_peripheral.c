@@ -40,34 +40,167 @@
  */
 
 #include "app_error.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
 #include "bsp.h"
+#include "systick.h"
+#include "util.h"
 
 #include "ble_advdata.h"
 #include "ble_advertising.h"
+#include "ble_broadcast.h"
+#include "ble_bulk.h"
+#include "ble_conn_mgr.h"
 #include "ble_m.h"
 #include "ble_pb.h"
 #include "ble_peripheral.h"
+#include "ble_radio_notification.h"
+#include "ble_store.h"
 
 #include "nrf_ble_qwr.h"
 
-NRF_BLE_QWR_DEF(m_qwr);             /**< Context for the Queued Write module.*/
-BLE_PB_DEF(m_protobuf);             /**< Protobuf module instance. */
-BLE_ADVERTISING_DEF(m_advertising); /**< Advertising module instance. */
+NRF_BLE_QWRS_DEF(m_qwr, NRF_SDH_BLE_PERIPHERAL_LINK_COUNT); /**< Context for the Queued Write module.*/
+BLE_PB_DEF(m_protobuf);                                     /**< Protobuf module instance. */
+BLE_ADVERTISING_DEF(m_advertising);                         /**< Advertising module instance. */
 
 #define NRF_LOG_MODULE_NAME ble_m_periph
 #include "nrf_log.h"
 NRF_LOG_MODULE_REGISTER();
 
+#define ADV_EVT_RADIO_ON_US 4000   /**< Estimated radio on time of one coded PHY advertising event (3x ADV_EXT_IND + AUX_ADV_IND). */
+#define ADV_HIGH_DUTY_INTERVAL 6   /**< Interval used for the estimate while high duty directed advertising (3.75 ms). */
+
+/**@brief State of a connected hub. */
+typedef struct
+{
+    uint16_t conn_handle; /**< Handle of the connection, BLE_CONN_HANDLE_INVALID if the slot is free. */
+    pm_peer_id_t peer_id; /**< Bonded peer on the link, PM_PEER_ID_INVALID until secured. */
+    int8_t rssi;          /**< Last RSSI reading of the link. */
+    bool connected;       /**< The hub subscribed to notifications. */
+} periph_link_t;
+
 // Static defines
-static int8_t m_rssi;
-static uint16_t m_conn_handle = BLE_CONN_HANDLE_INVALID; /**< Handle of the current connection. */
+static periph_link_t m_links[NRF_SDH_BLE_PERIPHERAL_LINK_COUNT];
 static bool m_advertising_on_disconnect = true;
-static bool m_connected = false;
-static bool m_notifications_enabled = false;
 
 static raw_susbcribe_handler_t m_raw_evt_handler = NULL;
+static raw_bytes_handler_t m_raw_bytes_handler = NULL; /**< Takes encoded events when decoding is deferred. */
+
+static pm_peer_id_t m_peer_id = PM_PEER_ID_INVALID; /**< Device reference handle to the last bonded central lost. Target of directed advertising. */
+
+static bool m_reconnect_pending = false;      /**< A bonded hub was lost and has not reconnected yet. */
+static systick_ticks_t m_disconnect_ticks;    /**< When the hub was lost. */
+static uint16_t m_adv_interval = 0;           /**< Interval of the running advertising stage. 0 if not advertising. */
+static systick_ticks_t m_adv_stage_ticks;     /**< When the running advertising stage was last accounted. */
+static uint64_t m_adv_radio_on_us;            /**< Estimated advertising radio on time. */
+static ble_peripheral_adv_stats_t m_adv_stats;
+
+APP_TIMER_DEF(m_defer_timer);                                 /**< Deadline of the oldest deferred publish. */
+static bool m_defer_enabled = false;                          /**< Deferred publishing is on. */
+static ble_pb_tx_item_t m_deferred[BLE_PERIPHERAL_DEFER_MAX]; /**< Publishes waiting for a flush. */
+static uint8_t m_deferred_count = 0;
+static ble_peripheral_defer_stats_t m_defer_stats;
 
-static pm_peer_id_t m_peer_id; /**< Device reference handle to the current bonded central. */
+static bool m_store_forward = false; /**< Publishes without a hub go to flash. */
+
+/**@brief Throughput comparison phases. */
+typedef enum
+{
+    BENCH_IDLE, /**< Not running. */
+    BENCH_GATT, /**< Notifications on the Protobuf service. */
+    BENCH_BULK, /**< The same amount over the bulk channel. */
+} bench_state_t;
+
+static bench_state_t m_bench_state = BENCH_IDLE;
+static uint16_t m_bench_conn_handle = BLE_CONN_HANDLE_INVALID;
+static size_t m_bench_size;           /**< Bytes to send on each path. */
+static size_t m_bench_sent;           /**< Bytes of the GATT phase queued so far. */
+static systick_ticks_t m_bench_ticks; /**< When the GATT phase started. */
+static uint32_t m_bench_gatt_ms;      /**< Duration of the GATT phase. */
+static uint32_t m_bench_transfers;    /**< Completed bulk transfers before the bulk phase. */
+
+/**@brief Function for finding the state of a hub.
+ *
+ * @param[in] conn_handle  Connection handle. BLE_CONN_HANDLE_INVALID finds a free slot.
+ *
+ * @return Pointer to the link, NULL if there is none.
+ */
+static periph_link_t *link_get(uint16_t conn_handle)
+{
+    for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+        if (m_links[i].conn_handle == conn_handle)
+        {
+            return &m_links[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**@brief Function for counting the connected hubs.
+ */
+static uint8_t link_count(void)
+{
+    uint8_t count = 0;
+
+    for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+        if (m_links[i].conn_handle != BLE_CONN_HANDLE_INVALID)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/**@brief Function for accounting the time spent in the running advertising stage.
+ *
+ * @details The radio on time is estimated as one advertising event of
+ *          ADV_EVT_RADIO_ON_US per advertising interval.
+ */
+static void adv_stats_update(void)
+{
+    systick_ticks_t elapsed = systick_get_diff_now(m_adv_stage_ticks);
+    m_adv_stage_ticks = systick_get_ticks();
+
+    if (m_adv_interval == 0)
+    {
+        return;
+    }
+
+    m_adv_stats.adv_ms += elapsed;
+    m_adv_radio_on_us += ((uint64_t)elapsed * 1000 * ADV_EVT_RADIO_ON_US) / ((uint64_t)m_adv_interval * 625);
+    m_adv_stats.adv_radio_on_ms = m_adv_radio_on_us / 1000;
+}
+
+/**@brief Function for switching to a new advertising stage.
+ *
+ * @param[in] interval  Advertising interval of the stage in units of 0.625 ms. 0 when advertising stopped.
+ */
+static void adv_stage_set(uint16_t interval)
+{
+    adv_stats_update();
+    m_adv_interval = interval;
+}
+
+/**@brief Function for assigning new connection handle to available instance of QWR module.
+ *
+ * @param[in] conn_handle New connection handle.
+ */
+static void multi_qwr_conn_handle_assign(uint16_t conn_handle)
+{
+    for (uint32_t i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+        if (m_qwr[i].conn_handle == BLE_CONN_HANDLE_INVALID)
+        {
+            ret_code_t err_code = nrf_ble_qwr_conn_handle_assign(&m_qwr[i], conn_handle);
+            APP_ERROR_CHECK(err_code);
+            break;
+        }
+    }
+}
 
 /**@brief Function for setting filtered device identities.
  *
@@ -93,20 +226,38 @@ static void identities_set(pm_peer_id_list_skip_t skip)
 void ble_peripheral_evt_handler(ble_evt_t const *p_ble_evt, void *p_context)
 {
     uint32_t err_code = NRF_SUCCESS;
+    uint16_t conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+    periph_link_t *p_link;
 
     switch (p_ble_evt->header.evt_id)
     {
     case BLE_GAP_EVT_DISCONNECTED:
-        NRF_LOG_INFO("Peripheral disconnected!");
-
-        // Set LED
-        err_code = bsp_indication_set(BSP_INDICATE_IDLE);
-        APP_ERROR_CHECK(err_code);
+        NRF_LOG_INFO("Peripheral disconnected! Handle: 0x%x", conn_handle);
 
         // Reset variables.
-        m_conn_handle = BLE_CONN_HANDLE_INVALID;
-        m_connected = false;
-        m_notifications_enabled = false;
+        p_link = link_get(conn_handle);
+        if (p_link != NULL)
+        {
+            // Go after the lost hub first when advertising again
+            if (p_link->peer_id != PM_PEER_ID_INVALID)
+            {
+                m_peer_id = p_link->peer_id;
+                m_reconnect_pending = true;
+                m_disconnect_ticks = systick_get_ticks();
+            }
+
+            p_link->conn_handle = BLE_CONN_HANDLE_INVALID;
+            p_link->peer_id = PM_PEER_ID_INVALID;
+            p_link->connected = false;
+            p_link->rssi = 0;
+        }
+
+        // Set LED
+        if (link_count() == 0)
+        {
+            err_code = bsp_indication_set(BSP_INDICATE_IDLE);
+            APP_ERROR_CHECK(err_code);
+        }
 
         // Only advertising on disconnect when enabled
         if (m_advertising_on_disconnect)
@@ -120,12 +271,41 @@ void ble_peripheral_evt_handler(ble_evt_t const *p_ble_evt, void *p_context)
         err_code = bsp_indication_set(BSP_INDICATE_BONDING);
         APP_ERROR_CHECK(err_code);
 
+        // The SoftDevice stops advertising on connect
+        adv_stage_set(0);
+
+        if (m_reconnect_pending)
+        {
+            m_reconnect_pending = false;
+
+            m_adv_stats.reconnects++;
+            m_adv_stats.reconnect_ms_last = systick_get_diff_now(m_disconnect_ticks);
+            m_adv_stats.reconnect_ms_max = MAX(m_adv_stats.reconnect_ms_max, m_adv_stats.reconnect_ms_last);
+
+            NRF_LOG_INFO("Reconnected in %d ms", m_adv_stats.reconnect_ms_last);
+        }
+
         // Set connection handle
-        m_conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+        p_link = link_get(BLE_CONN_HANDLE_INVALID);
+        if (p_link == NULL)
+        {
+            NRF_LOG_WARNING("No free link. Disconnecting 0x%x", conn_handle);
+            err_code = sd_ble_gap_disconnect(conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+            APP_ERROR_CHECK(err_code);
+            break;
+        }
+
+        p_link->conn_handle = conn_handle;
+        p_link->peer_id = PM_PEER_ID_INVALID;
+        p_link->connected = false;
+        p_link->rssi = 0;
 
         // Assign QWR
-        err_code = nrf_ble_qwr_conn_handle_assign(&m_qwr, m_conn_handle);
-        APP_ERROR_CHECK(err_code);
+        multi_qwr_conn_handle_assign(conn_handle);
+
+        // Keep advertising for other hubs while there is room
+        if (link_count() < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT)
+            ble_peripheral_advertising_start(false);
 
         break;
 
@@ -158,8 +338,13 @@ void ble_peripheral_evt_handler(ble_evt_t const *p_ble_evt, void *p_context)
         APP_ERROR_CHECK(err_code);
         break;
     case BLE_GAP_EVT_RSSI_CHANGED:
-        NRF_LOG_DEBUG("Rssi changed! %i", p_ble_evt->evt.gap_evt.params.rssi_changed.rssi);
-        m_rssi = p_ble_evt->evt.gap_evt.params.rssi_changed.rssi;
+        NRF_LOG_DEBUG("Rssi changed! %i on %i", p_ble_evt->evt.gap_evt.params.rssi_changed.rssi, conn_handle);
+
+        p_link = link_get(conn_handle);
+        if (p_link != NULL)
+        {
+            p_link->rssi = p_ble_evt->evt.gap_evt.params.rssi_changed.rssi;
+        }
         break;
     default:
         // No implementation needed.
@@ -208,8 +393,16 @@ void ble_peripheral_advertising_start(bool erase_bonds)
         // Then set whitelist
         whitelist_set(PM_PEER_ID_LIST_SKIP_NO_ID_ADDR);
 
+        // Directed to the lost hub, then fast and slow undirected.
+        ble_adv_mode_t mode = BLE_ADV_MODE_FAST;
+
+        if (m_reconnect_pending && m_peer_id != PM_PEER_ID_INVALID)
+        {
+            mode = BLE_ADV_MODE_DIRECTED_HIGH_DUTY;
+        }
+
         // Then, start advertising!
-        err_code = ble_advertising_start(&m_advertising, BLE_ADV_MODE_FAST);
+        err_code = ble_advertising_start(&m_advertising, mode);
         APP_ERROR_CHECK(err_code);
     }
 }
@@ -220,12 +413,24 @@ static void advertising_config_get(ble_adv_modes_config_t *p_config)
 
     p_config->ble_adv_on_disconnect_disabled = true;
     p_config->ble_adv_whitelist_enabled = true;
-    p_config->ble_adv_directed_enabled = false;
     p_config->ble_adv_extended_enabled = true;
+
+    // Reconnect quickly to the hub that was lost
+    p_config->ble_adv_directed_high_duty_enabled = true;
+    p_config->ble_adv_directed_enabled = true;
+    p_config->ble_adv_directed_interval = APP_ADV_DIRECTED_INTERVAL;
+    p_config->ble_adv_directed_timeout = APP_ADV_DIRECTED_DURATION;
+
+    // Then anyone bonded
     p_config->ble_adv_fast_enabled = true;
     p_config->ble_adv_fast_interval = APP_ADV_INTERVAL;
     p_config->ble_adv_fast_timeout = APP_ADV_DURATION;
 
+    // Save power when nobody is around
+    p_config->ble_adv_slow_enabled = true;
+    p_config->ble_adv_slow_interval = APP_ADV_SLOW_INTERVAL;
+    p_config->ble_adv_slow_timeout = APP_ADV_SLOW_DURATION;
+
     // Coded PHY
     p_config->ble_adv_primary_phy = BLE_GAP_PHY_CODED;
     p_config->ble_adv_secondary_phy = BLE_GAP_PHY_CODED;
@@ -243,12 +448,34 @@ static void on_adv_evt(ble_adv_evt_t ble_adv_evt)
 
     switch (ble_adv_evt)
     {
+    case BLE_ADV_EVT_DIRECTED_HIGH_DUTY:
+        adv_stage_set(ADV_HIGH_DUTY_INTERVAL);
+        err_code = bsp_indication_set(BSP_INDICATE_ADVERTISING_DIRECTED);
+        APP_ERROR_CHECK(err_code);
+        break;
+
+    case BLE_ADV_EVT_DIRECTED:
+        adv_stage_set(APP_ADV_DIRECTED_INTERVAL);
+        err_code = bsp_indication_set(BSP_INDICATE_ADVERTISING_DIRECTED);
+        APP_ERROR_CHECK(err_code);
+        break;
+
     case BLE_ADV_EVT_FAST:
+    case BLE_ADV_EVT_FAST_WHITELIST:
+        adv_stage_set(APP_ADV_INTERVAL);
         err_code = bsp_indication_set(BSP_INDICATE_ADVERTISING);
         APP_ERROR_CHECK(err_code);
         break;
 
+    case BLE_ADV_EVT_SLOW:
+    case BLE_ADV_EVT_SLOW_WHITELIST:
+        adv_stage_set(APP_ADV_SLOW_INTERVAL);
+        err_code = bsp_indication_set(BSP_INDICATE_ADVERTISING_SLOW);
+        APP_ERROR_CHECK(err_code);
+        break;
+
     case BLE_ADV_EVT_IDLE:
+        adv_stage_set(0);
         break;
     case BLE_ADV_EVT_WHITELIST_REQUEST:
     {
@@ -322,12 +549,17 @@ static void advertising_init(void)
 
     int8_t tx_power = APP_ADV_TX_POWER;
 
+    // Lets the hub filter on the service before connecting
+    ble_uuid_t adv_uuids[] = {{PROTOBUF_UUID_SERVICE, m_protobuf.uuid_type}};
+
     memset(&init, 0, sizeof(init));
 
     init.advdata.p_tx_power_level = &tx_power; //8dBm
     init.advdata.name_type = BLE_ADVDATA_FULL_NAME;
     init.advdata.include_appearance = true;
     init.advdata.flags = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
+    init.advdata.uuids_complete.uuid_cnt = ARRAY_SIZE(adv_uuids);
+    init.advdata.uuids_complete.p_uuids = adv_uuids;
 
     advertising_config_get(&init.config);
 
@@ -344,7 +576,22 @@ void ble_peripheral_pm_evt_handler(pm_evt_t const *p_evt)
 {
     switch (p_evt->evt_id)
     {
+    case PM_EVT_CONN_SEC_SUCCEEDED:
+    {
+        // Remember the hub for directed advertising if it drops
+        periph_link_t *p_link = link_get(p_evt->conn_handle);
+        if (p_link != NULL)
+        {
+            p_link->peer_id = p_evt->peer_id;
+        }
+    }
+    break;
+
     case PM_EVT_PEERS_DELETE_SUCCEEDED:
+        // Nobody to reconnect to anymore
+        m_peer_id = PM_PEER_ID_INVALID;
+        m_reconnect_pending = false;
+
         // Re-enable advertising on disconnect
         m_advertising_on_disconnect = true;
 
@@ -374,26 +621,37 @@ void ble_protobuf_evt_hanlder(ble_protobuf_t *p_protobuf, ble_pb_evt_t *p_evt)
 {
 
     uint32_t err_code;
+    periph_link_t *p_link = link_get(p_evt->conn_handle);
 
     switch (p_evt->evt_type)
     {
     case BLE_PB_EVT_NOTIFICATION_ENABLED:
         NRF_LOG_INFO("Notifications enabled!")
-        m_notifications_enabled = true;
 
         // Set connected flag
-        m_connected = true;
+        if (p_link != NULL)
+        {
+            p_link->connected = true;
+        }
 
         // Show we're connected
         err_code = bsp_indication_set(BSP_INDICATE_CONNECTED);
         APP_ERROR_CHECK(err_code);
 
         // Enable RSSI readings
-        err_code = sd_ble_gap_rssi_start(m_conn_handle, 0, 100);
-        APP_ERROR_CHECK(err_code);
+        err_code = sd_ble_gap_rssi_start(p_evt->conn_handle, 0, 100);
+        if (err_code != NRF_ERROR_INVALID_STATE)
+        {
+            APP_ERROR_CHECK(err_code);
+        }
         break;
     case BLE_PB_EVT_NOTIFICATION_DISABLED:
         NRF_LOG_INFO("Notifications disabled!")
+
+        if (p_link != NULL)
+        {
+            p_link->connected = false;
+        }
         break;
     case BLE_PB_EVT_DATA:
         NRF_LOG_DEBUG("Data!");
@@ -401,8 +659,8 @@ void ble_protobuf_evt_hanlder(ble_protobuf_t *p_protobuf, ble_pb_evt_t *p_evt)
         // Forward to raw handler.
         if (m_raw_evt_handler != NULL)
         {
-            // Set the RSSI
-            p_evt->params.data.peripheral_rssi = m_rssi;
+            // Set the RSSI of the hub that sent it
+            p_evt->params.data.peripheral_rssi = (p_link != NULL) ? p_link->rssi : 0;
 
             // Set the address
             ble_gap_addr_t gap_addr;
@@ -415,6 +673,14 @@ void ble_protobuf_evt_hanlder(ble_protobuf_t *p_protobuf, ble_pb_evt_t *p_evt)
             m_raw_evt_handler(&(p_evt->params.data));
         }
 
+        break;
+    case BLE_PB_EVT_RAW:
+        // Decoded and tagged in the main context
+        if (m_raw_bytes_handler != NULL)
+        {
+            m_raw_bytes_handler(p_evt->params.raw.p_data, p_evt->params.raw.len,
+                                (p_link != NULL) ? p_link->rssi : 0);
+        }
         break;
     }
 }
@@ -433,7 +699,7 @@ static void nrf_qwr_error_handler(uint32_t nrf_error)
 
 /**@brief Function for initializing services that will be used by the application.
  */
-static void services_init(void)
+static void services_init(ble_peripheral_init_t *init)
 {
     uint32_t err_code;
     nrf_ble_qwr_init_t qwr_init = {0};
@@ -442,51 +708,464 @@ static void services_init(void)
     // Initialize Queued Write Module.
     qwr_init.error_handler = nrf_qwr_error_handler;
 
-    err_code = nrf_ble_qwr_init(&m_qwr, &qwr_init);
-    APP_ERROR_CHECK(err_code);
+    for (uint32_t i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+        err_code = nrf_ble_qwr_init(&m_qwr[i], &qwr_init);
+        APP_ERROR_CHECK(err_code);
+    }
 
     protobuf_init.evt_handler = ble_protobuf_evt_hanlder;
     protobuf_init.bl_cccd_wr_sec = SEC_JUST_WORKS;
     protobuf_init.bl_wr_sec = SEC_JUST_WORKS;
+    protobuf_init.tx_overflow = init->tx_overflow;
+    protobuf_init.defer_decode = (m_raw_bytes_handler != NULL);
 
     err_code = ble_protobuf_init(&m_protobuf, &protobuf_init);
     APP_ERROR_CHECK(err_code);
 }
 
+/**@brief Function for keeping a publish until a hub listens again.
+ */
+static void store(uint8_t *data, size_t size)
+{
+    ret_code_t err_code = ble_store_append(data, size);
+    if (err_code == NRF_ERROR_NO_MEM)
+    {
+        NRF_LOG_WARNING("Store full. Message dropped.");
+    }
+    else if (err_code == NRF_ERROR_DATA_SIZE)
+    {
+        NRF_LOG_WARNING("Message too large. Size: %d", size);
+    }
+    else
+    {
+        APP_ERROR_CHECK(err_code);
+    }
+}
+
+/**@brief Function for getting the deepest TX queue of the subscribed hubs.
+ */
+static size_t tx_pending_max(void)
+{
+    size_t pending = 0;
+
+    for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+        if (m_links[i].connected)
+        {
+            pending = MAX(pending, ble_protobuf_tx_pending(&m_protobuf, m_links[i].conn_handle));
+        }
+    }
+
+    return pending;
+}
+
+/**@brief Function for asking for a short interval on links with notifications backed up.
+ */
+static void tx_demand(void)
+{
+    for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+        if (m_links[i].connected && ble_protobuf_tx_pending(&m_protobuf, m_links[i].conn_handle))
+        {
+            ble_conn_mgr_demand(m_links[i].conn_handle);
+        }
+    }
+}
+
 void ble_peripheral_write(uint8_t *data, size_t size)
 {
 
     // Shoots out a warning that it's not connected.. yet.
-    if (!m_connected)
+    if (link_count() == 0)
     {
+        if (m_store_forward)
+        {
+            store(data, size);
+            return;
+        }
+
         NRF_LOG_WARNING("Unable to write. Not connected!");
         return;
     }
 
     // Shoots out a warning that it's not connected.. yet.
-    if (!m_notifications_enabled)
+    if (!ble_peripheral_is_connected())
     {
+        if (m_store_forward)
+        {
+            store(data, size);
+            return;
+        }
+
         NRF_LOG_WARNING("Unable to write. Notifications not enabled!");
         return;
     }
 
-    // Otherwise writes the data.
+    // Otherwise queues the data for every subscribed hub. Sent as soon as the SoftDevice has room.
     ret_code_t err_code = ble_protobuf_write(&m_protobuf, data, size);
-    if (err_code == NRF_ERROR_INVALID_STATE || err_code == NRF_ERROR_FORBIDDEN ||
-        err_code == NRF_ERROR_RESOURCES)
+    if (err_code == NRF_ERROR_INVALID_STATE)
     {
         NRF_LOG_WARNING("Not connected. Unable to send message.");
     }
+    else if (err_code == NRF_ERROR_NO_MEM)
+    {
+        NRF_LOG_WARNING("TX queue full. Message dropped.");
+    }
+    else if (err_code == NRF_ERROR_DATA_SIZE)
+    {
+        NRF_LOG_WARNING("Message too large. Size: %d", size);
+    }
     else
     {
         APP_ERROR_CHECK(err_code);
     }
+
+    // Ask for a short interval while notifications back up
+    tx_demand();
+}
+
+ret_code_t ble_peripheral_benchmark(size_t size)
+{
+    if (m_bench_state != BENCH_IDLE)
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    // First subscribed hub that opened a bulk channel
+    m_bench_conn_handle = BLE_CONN_HANDLE_INVALID;
+
+    for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+        if (m_links[i].connected && ble_bulk_is_connected(m_links[i].conn_handle))
+        {
+            m_bench_conn_handle = m_links[i].conn_handle;
+            break;
+        }
+    }
+
+    if (m_bench_conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    m_bench_size = size;
+    m_bench_sent = 0;
+    m_bench_ticks = systick_get_ticks();
+    m_bench_state = BENCH_GATT;
+
+    return NRF_SUCCESS;
+}
+
+/**@brief Function for running the throughput comparison.
+ *
+ * @details GATT first with the largest event that fits, as many as the queue takes,
+ *          then the bulk channel with generated data.
+ */
+static void bench_process(void)
+{
+    static uint8_t frame[sizeof(pyrinas_event_t)];
+    static size_t frame_len = 0;
+
+    if (m_bench_state == BENCH_IDLE)
+    {
+        return;
+    }
+
+    if (!ble_bulk_is_connected(m_bench_conn_handle))
+    {
+        NRF_LOG_WARNING("Benchmark aborted. Bulk channel lost.");
+        m_bench_state = BENCH_IDLE;
+        return;
+    }
+
+    switch (m_bench_state)
+    {
+    case BENCH_GATT:
+        // The largest event. It is decoded and dropped by the hub like any unsubscribed one.
+        if (frame_len == 0)
+        {
+            static pyrinas_event_t evt;
+
+            memset(&evt, 0, sizeof(evt));
+            memcpy(evt.name.bytes, "bench", 5);
+            evt.name.size = 5;
+            evt.data.size = member_size(pyrinas_event_data_t, bytes) - 1;
+            memset(evt.data.bytes, 'x', evt.data.size);
+
+            if (pyrinas_codec_encode(&evt, frame, sizeof(frame), &frame_len))
+            {
+                NRF_LOG_ERROR("Unable to encode data!");
+                m_bench_state = BENCH_IDLE;
+                return;
+            }
+        }
+
+        // Leave room for the fragments of one event
+        while (m_bench_sent < m_bench_size &&
+               ble_protobuf_tx_pending(&m_protobuf, m_bench_conn_handle) <= BLE_PB_TX_QUEUE_SIZE / 2)
+        {
+            if (ble_protobuf_write(&m_protobuf, frame, frame_len) != NRF_SUCCESS)
+            {
+                break;
+            }
+
+            m_bench_sent += frame_len;
+        }
+
+        tx_demand();
+
+        // Done once the last notification left
+        if (m_bench_sent >= m_bench_size && ble_protobuf_tx_pending(&m_protobuf, m_bench_conn_handle) == 0)
+        {
+            ble_bulk_stats_t stats;
+
+            m_bench_gatt_ms = systick_get_diff_now(m_bench_ticks);
+
+            ble_bulk_stats_get(&stats);
+            m_bench_transfers = stats.transfers;
+
+            if (ble_bulk_send_pattern(m_bench_conn_handle, m_bench_size) != NRF_SUCCESS)
+            {
+                NRF_LOG_WARNING("Benchmark aborted. Bulk channel busy.");
+                m_bench_state = BENCH_IDLE;
+                return;
+            }
+
+            m_bench_state = BENCH_BULK;
+        }
+        break;
+
+    case BENCH_BULK:
+        if (!ble_bulk_is_busy(m_bench_conn_handle))
+        {
+            ble_bulk_stats_t stats;
+            ble_bulk_stats_get(&stats);
+
+            if (stats.transfers == m_bench_transfers)
+            {
+                NRF_LOG_WARNING("Benchmark aborted. Bulk transfer failed.");
+            }
+            else
+            {
+                // Bytes per ms is kB/s
+                NRF_LOG_INFO("Benchmark %d bytes. GATT: %d ms, %d kB/s. Bulk: %d ms, %d kB/s.",
+                             m_bench_sent, m_bench_gatt_ms, m_bench_sent / MAX(m_bench_gatt_ms, 1),
+                             stats.bytes, stats.ms, stats.bytes / MAX(stats.ms, 1));
+            }
+
+            m_bench_state = BENCH_IDLE;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+void ble_peripheral_process(void)
+{
+    bench_process();
+
+    if (!m_store_forward || !ble_peripheral_is_connected() || ble_store_is_empty())
+    {
+        return;
+    }
+
+    static uint8_t frame[BLE_FRAG_DATA_MAX_LEN];
+    size_t size = 0;
+
+    for (int i = 0; i < BLE_STORE_REPLAY_BURST; i++)
+    {
+        // Live publishes first. Replay only fills the free half of the queue.
+        if (tx_pending_max() >= BLE_PB_TX_QUEUE_SIZE / 2)
+        {
+            break;
+        }
+
+        if (ble_store_peek(frame, sizeof(frame), &size) != NRF_SUCCESS)
+        {
+            break;
+        }
+
+        // Stays in the store until a hub took it
+        if (ble_protobuf_write(&m_protobuf, frame, size) != NRF_SUCCESS)
+        {
+            break;
+        }
+
+        ble_store_consume();
+    }
+
+    // Replay at full link rate
+    tx_demand();
+}
+
+/**@brief Function for handing all deferred publishes to the Protobuf service.
+ *
+ * @details Called from the main context, the radio notification interrupt and the timer.
+ */
+static void deferred_flush(void)
+{
+    CRITICAL_REGION_ENTER();
+
+    for (uint8_t i = 0; i < m_deferred_count; i++)
+    {
+        ret_code_t err_code = ble_protobuf_write(&m_protobuf, m_deferred[i].data, m_deferred[i].len);
+        if (err_code != NRF_SUCCESS)
+        {
+            NRF_LOG_WARNING("Deferred publish dropped. Err: 0x%x", err_code);
+        }
+    }
+
+    m_deferred_count = 0;
+
+    CRITICAL_REGION_EXIT();
+
+    UNUSED_RETURN_VALUE(app_timer_stop(m_defer_timer));
+}
+
+/**@brief Function for handling radio notifications.
+ *
+ * @details The radio is about to be used anyway, so deferred publishes ride along.
+ *
+ * @param[in] radio_active  True before the radio becomes active.
+ */
+static void radio_notification_evt_handler(bool radio_active)
+{
+    if (radio_active && m_deferred_count > 0)
+    {
+        m_defer_stats.flushes_radio++;
+        deferred_flush();
+    }
+}
+
+/**@brief Function for handling the deferred publish deadline.
+ */
+static void defer_timer_handler(void *p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    if (m_deferred_count > 0)
+    {
+        m_defer_stats.flushes_timeout++;
+        deferred_flush();
+    }
+}
+
+void ble_peripheral_write_deferred(uint8_t *data, size_t size)
+{
+    if (!m_defer_enabled || !ble_peripheral_is_connected() || size > BLE_PB_TX_DATA_MAX_LEN)
+    {
+        // Same warnings and handling as an urgent write
+        ble_peripheral_write(data, size);
+        return;
+    }
+
+    // Make room first
+    if (m_deferred_count == BLE_PERIPHERAL_DEFER_MAX)
+    {
+        m_defer_stats.flushes_full++;
+        deferred_flush();
+    }
+
+    bool first = false;
+
+    CRITICAL_REGION_ENTER();
+
+    m_deferred[m_deferred_count].len = size;
+    memcpy(m_deferred[m_deferred_count].data, data, size);
+
+    first = (m_deferred_count == 0);
+    m_deferred_count++;
+    m_defer_stats.deferred++;
+
+    CRITICAL_REGION_EXIT();
+
+    // The oldest publish sets the deadline
+    if (first)
+    {
+        ret_code_t err_code = app_timer_start(m_defer_timer, APP_TIMER_TICKS(BLE_PERIPHERAL_DEFER_DEADLINE_MS), NULL);
+        APP_ERROR_CHECK(err_code);
+    }
+}
+
+void ble_peripheral_defer_stats_get(ble_peripheral_defer_stats_t *p_stats)
+{
+    *p_stats = m_defer_stats;
+}
+
+void ble_peripheral_tx_stats_get(ble_pb_tx_stats_t *p_stats)
+{
+    ble_protobuf_tx_stats_get(&m_protobuf, p_stats);
+}
+
+void ble_peripheral_adv_stats_get(ble_peripheral_adv_stats_t *p_stats)
+{
+    // Include the running stage
+    adv_stats_update();
+
+    *p_stats = m_adv_stats;
 }
 
-void ble_peripheral_init()
+void ble_peripheral_init(ble_peripheral_init_t *init)
 {
+    for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+        m_links[i].conn_handle = BLE_CONN_HANDLE_INVALID;
+        m_links[i].peer_id = PM_PEER_ID_INVALID;
+        m_links[i].connected = false;
+        m_links[i].rssi = 0;
+    }
+
+    // Services first, advertising needs the UUID type
+    services_init(init);
     advertising_init();
-    services_init();
+
+    // Idle links trade latency for power
+    ble_conn_mgr_init();
+
+    // Hold non-urgent publishes for the next radio wake-up
+    if (init->defer_enabled)
+    {
+        ret_code_t err_code = app_timer_create(&m_defer_timer, APP_TIMER_MODE_SINGLE_SHOT, defer_timer_handler);
+        APP_ERROR_CHECK(err_code);
+
+        err_code = ble_radio_notification_init(APP_IRQ_PRIORITY_LOW,
+                                               NRF_RADIO_NOTIFICATION_DISTANCE_800US,
+                                               radio_notification_evt_handler);
+        APP_ERROR_CHECK(err_code);
+
+        m_defer_enabled = true;
+    }
+
+    // Nothing is lost while the hub is away
+    if (init->store_forward)
+    {
+        ble_store_init();
+        m_store_forward = true;
+    }
+
+    // Pick up fleet wide commands without a connection
+    if (init->broadcast_listen)
+    {
+        ble_broadcast_listen_start(&init->hub_addr);
+    }
+}
+
+void ble_peripheral_mtu_set(uint16_t conn_handle, uint16_t mtu)
+{
+    ble_protobuf_mtu_set(&m_protobuf, conn_handle, mtu);
+}
+
+uint8_t ble_peripheral_peer_caps_get(void)
+{
+    return ble_protobuf_peer_caps_get(&m_protobuf);
+}
+
+ret_code_t ble_peripheral_snapshot_update(uint8_t const *name, uint8_t name_len, uint8_t const *data, size_t size)
+{
+    return ble_protobuf_snapshot_update(&m_protobuf, name, name_len, data, size);
 }
 
 void ble_peripheral_attach_raw_handler(raw_susbcribe_handler_t raw_evt_handler)
@@ -494,33 +1173,67 @@ void ble_peripheral_attach_raw_handler(raw_susbcribe_handler_t raw_evt_handler)
     m_raw_evt_handler = raw_evt_handler;
 }
 
+void ble_peripheral_attach_raw_bytes_handler(raw_bytes_handler_t raw_bytes_handler)
+{
+    m_raw_bytes_handler = raw_bytes_handler;
+}
+
+void ble_peripheral_rx_cycles_get(util_cycles_stats_t *p_stats)
+{
+    *p_stats = m_protobuf.rx_cycles;
+}
+
 void ble_peripheral_disconnect()
 {
 
     // Disable advertising on disconnect.
     m_advertising_on_disconnect = false;
 
-    // Reset RSSI
-    m_rssi = 0;
-
-    // TODO: handle this better?
-    if (m_conn_handle != BLE_CONN_HANDLE_INVALID)
+    // Drop every hub
+    for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
     {
-        NRF_LOG_INFO("Disconnect");
-        ret_code_t err_code = sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
-        if (err_code != NRF_ERROR_INVALID_STATE)
+        // Reset RSSI
+        m_links[i].rssi = 0;
+
+        if (m_links[i].conn_handle != BLE_CONN_HANDLE_INVALID)
         {
-            APP_ERROR_CHECK(err_code);
+            NRF_LOG_INFO("Disconnect 0x%x", m_links[i].conn_handle);
+            ret_code_t err_code = sd_ble_gap_disconnect(m_links[i].conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+            if (err_code != NRF_ERROR_INVALID_STATE)
+            {
+                APP_ERROR_CHECK(err_code);
+            }
         }
     }
 }
 
 bool ble_peripheral_is_connected(void)
 {
-    return m_connected;
+    for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+        if (m_links[i].connected)
+        {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 int8_t ble_peripheral_get_rssi()
 {
-    return m_rssi;
+    int8_t rssi = 0;
+    bool found = false;
+
+    // Best link wins
+    for (int i = 0; i < NRF_SDH_BLE_PERIPHERAL_LINK_COUNT; i++)
+    {
+        if (m_links[i].connected && (!found || m_links[i].rssi > rssi))
+        {
+            rssi = m_links[i].rssi;
+            found = true;
+        }
+    }
+
+    return rssi;
 }
\ No newline at end of file
@@ -0,0 +1,170 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+
+#include "app_error.h"
+#include "app_util.h"
+
+#include "ble_pb.h"
+#include "ble_store.h"
+#include "fs.h"
+
+#define NRF_LOG_MODULE_NAME ble_store
+#include "nrf_log.h"
+#include "nrf_log_ctrl.h"
+NRF_LOG_MODULE_REGISTER();
+
+// Records are a little endian length followed by the encoded publish
+#define RECORD_HEADER_SIZE sizeof(uint16_t)
+#define RECORD_DATA_MAX_LEN BLE_FRAG_DATA_MAX_LEN
+
+static size_t m_write_offset = 0; /**< End of the log. */
+static size_t m_read_offset = 0;  /**< Start of the oldest unsent record. */
+static size_t m_peek_size = 0;    /**< Size of the record returned by the last peek. 0 if none. */
+static ble_store_stats_t m_stats;
+
+/**@brief Function for throwing away the whole log.
+ */
+static void store_clear(void)
+{
+    if (m_write_offset > 0)
+    {
+        fs_delete(BLE_STORE_FILE);
+    }
+
+    m_write_offset = 0;
+    m_read_offset = 0;
+    m_peek_size = 0;
+}
+
+void ble_store_init(void)
+{
+    m_write_offset = fs_size(BLE_STORE_FILE);
+    m_read_offset = 0;
+    m_peek_size = 0;
+
+    if (m_write_offset > 0)
+    {
+        NRF_LOG_INFO("%d bytes waiting to be forwarded.", m_write_offset);
+    }
+}
+
+ret_code_t ble_store_append(uint8_t const *data, size_t size)
+{
+    if (size == 0 || size > RECORD_DATA_MAX_LEN)
+    {
+        return NRF_ERROR_DATA_SIZE;
+    }
+
+    // Bounded so a hub that never comes back can't fill the flash
+    if (m_write_offset + RECORD_HEADER_SIZE + size > BLE_STORE_MAX_SIZE)
+    {
+        m_stats.dropped++;
+        return NRF_ERROR_NO_MEM;
+    }
+
+    // The encoded publish is kept as is. Events carry no capture time, so the hub
+    // sees the time of the replay.
+    static uint8_t record[RECORD_HEADER_SIZE + RECORD_DATA_MAX_LEN];
+    uint16_encode(size, record);
+    memcpy(&record[RECORD_HEADER_SIZE], data, size);
+
+    fs_append(BLE_STORE_FILE, record, RECORD_HEADER_SIZE + size);
+
+    m_write_offset += RECORD_HEADER_SIZE + size;
+    m_stats.stored++;
+
+    return NRF_SUCCESS;
+}
+
+ret_code_t ble_store_peek(uint8_t *data, size_t size_max, size_t *size)
+{
+    if (ble_store_is_empty())
+    {
+        return NRF_ERROR_NOT_FOUND;
+    }
+
+    // Header and data in one read to mount the fs once
+    static uint8_t record[RECORD_HEADER_SIZE + RECORD_DATA_MAX_LEN];
+    size_t bytes_read = 0;
+
+    fs_read_at(BLE_STORE_FILE, m_read_offset, record, sizeof(record), &bytes_read);
+
+    uint16_t len = (bytes_read >= RECORD_HEADER_SIZE) ? uint16_decode(record) : 0;
+
+    // A torn write or a foreign file. Nothing after it can be trusted.
+    if (len == 0 || len > RECORD_DATA_MAX_LEN || len > size_max || bytes_read < RECORD_HEADER_SIZE + len)
+    {
+        NRF_LOG_ERROR("Store corrupt at %d. Discarding.", m_read_offset);
+
+        m_stats.dropped++;
+        store_clear();
+
+        return NRF_ERROR_NOT_FOUND;
+    }
+
+    memcpy(data, &record[RECORD_HEADER_SIZE], len);
+    *size = len;
+    m_peek_size = len;
+
+    return NRF_SUCCESS;
+}
+
+void ble_store_consume(void)
+{
+    if (m_peek_size == 0)
+    {
+        return;
+    }
+
+    m_read_offset += RECORD_HEADER_SIZE + m_peek_size;
+    m_peek_size = 0;
+    m_stats.replayed++;
+
+    // Everything is out. Start a fresh log.
+    if (m_read_offset >= m_write_offset)
+    {
+        NRF_LOG_INFO("Store forwarded.");
+        store_clear();
+    }
+}
+
+bool ble_store_is_empty(void)
+{
+    return m_read_offset >= m_write_offset;
+}
+
+void ble_store_stats_get(ble_store_stats_t *p_stats)
+{
+    *p_stats = m_stats;
+}
@@ -0,0 +1,711 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+
+#include "app_util.h"
+
+#include "codec_fast.h"
+
+#define NRF_LOG_MODULE_NAME codec_fast
+#include "nrf_log.h"
+NRF_LOG_MODULE_REGISTER();
+
+// CBOR major types
+#define CBOR_UINT 0x00
+#define CBOR_NINT 0x20
+#define CBOR_BYTES 0x40
+#define CBOR_TEXT 0x60
+#define CBOR_MAP 0xa0
+#define CBOR_MAJOR_MASK 0xe0
+#define CBOR_INFO_MASK 0x1f
+
+// Keys of the event map, in the order pyrinas_codec_encode() writes them
+#define KEY_NAME 0
+#define KEY_DATA 1
+#define KEY_PERIPHERAL_ADDR 2
+#define KEY_CENTRAL_ADDR 3
+#define KEY_PERIPHERAL_RSSI 4
+#define KEY_CENTRAL_RSSI 5
+#define KEY_COUNT 6
+
+#define HEAD_MAX 3 /**< Largest head written here. Lengths stay below 64 kB. */
+
+#define NAME_MAX member_size(pyrinas_event_name_data_t, bytes)
+#define DATA_MAX member_size(pyrinas_event_data_t, bytes)
+#define ADDR_LEN member_size(pyrinas_event_t, peripheral_addr)
+
+// Map, key, name head and key of the data
+#define TEMPLATE_SIZE (1 + 1 + HEAD_MAX + NAME_MAX + 1)
+
+// Everything after the data
+#define TAIL_MAX (2 * (1 + 1 + ADDR_LEN) + 2 * (1 + 2))
+
+/**@brief Prebuilt start of the map of one topic.
+ */
+typedef struct
+{
+    uint8_t bytes[TEMPLATE_SIZE]; /**< Up to and including the key of the data. */
+    uint8_t len;                  /**< Bytes in use. 0 if the slot is free. */
+    uint8_t name_offset;          /**< Where the name starts in bytes. */
+    uint8_t name_len;             /**< Length of the name. */
+    bool generic;                 /**< Did not match. pyrinas_codec_encode() does this topic. */
+} template_t;
+
+static template_t m_templates[CODEC_FAST_TEMPLATES];
+static uint8_t m_next = 0; /**< Slot reused when all are taken. */
+
+static codec_fast_stats_t m_stats;
+
+/**@brief Function for writing the head of a CBOR item in its shortest form.
+ *
+ * @return Bytes written.
+ */
+static inline size_t cbor_head(uint8_t *p_out, uint8_t major, uint16_t value)
+{
+    if (value < 24)
+    {
+        p_out[0] = major | value;
+        return 1;
+    }
+
+    if (value <= UINT8_MAX)
+    {
+        p_out[0] = major | 24;
+        p_out[1] = value;
+        return 2;
+    }
+
+    p_out[0] = major | 25;
+    p_out[1] = value >> 8;
+    p_out[2] = value;
+    return 3;
+}
+
+/**@brief Function for writing a signed integer.
+ */
+static inline size_t cbor_int(uint8_t *p_out, int8_t value)
+{
+    if (value < 0)
+    {
+        return cbor_head(p_out, CBOR_NINT, -1 - value);
+    }
+
+    return cbor_head(p_out, CBOR_UINT, value);
+}
+
+/**@brief Function for writing a byte string.
+ */
+static inline size_t cbor_bytes(uint8_t *p_out, uint8_t const *p_data, uint16_t len)
+{
+    size_t head = cbor_head(p_out, CBOR_BYTES, len);
+
+    memcpy(&p_out[head], p_data, len);
+
+    return head + len;
+}
+
+/**@brief Function for reading the head of a CBOR item.
+ *
+ * @return Bytes read. 0 if truncated or not a definite length that fits 32 bits.
+ */
+static size_t cbor_head_read(uint8_t const *p_in, size_t len, uint8_t *p_major, uint32_t *p_value)
+{
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    uint8_t info = p_in[0] & CBOR_INFO_MASK;
+    size_t size;
+
+    *p_major = p_in[0] & CBOR_MAJOR_MASK;
+
+    if (info < 24)
+    {
+        *p_value = info;
+        return 1;
+    }
+
+    // 1, 2 or 4 bytes of argument. 64 bit and indefinite lengths are not used here.
+    switch (info)
+    {
+    case 24:
+        size = 1;
+        break;
+    case 25:
+        size = 2;
+        break;
+    case 26:
+        size = 4;
+        break;
+    default:
+        return 0;
+    }
+
+    if (len < 1 + size)
+    {
+        return 0;
+    }
+
+    *p_value = 0;
+    for (size_t i = 1; i <= size; i++)
+    {
+        *p_value = (*p_value << 8) | p_in[i];
+    }
+
+    return 1 + size;
+}
+
+ret_code_t codec_fast_view_decode(uint8_t const *p_buf, size_t len, codec_fast_view_t *p_view)
+{
+    uint8_t major;
+    uint32_t count;
+    size_t pos = cbor_head_read(p_buf, len, &major, &count);
+
+    memset(p_view, 0, sizeof(codec_fast_view_t));
+
+    if (pos == 0 || major != CBOR_MAP)
+    {
+        return NRF_ERROR_NOT_SUPPORTED;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t key;
+        uint32_t value;
+        size_t head = cbor_head_read(&p_buf[pos], len - pos, &major, &key);
+
+        if (head == 0 || major != CBOR_UINT)
+        {
+            return NRF_ERROR_NOT_SUPPORTED;
+        }
+
+        pos += head;
+        head = cbor_head_read(&p_buf[pos], len - pos, &major, &value);
+
+        if (head == 0)
+        {
+            return NRF_ERROR_INVALID_DATA;
+        }
+
+        pos += head;
+
+        // Strings are followed by their bytes
+        uint8_t const *p_bytes = &p_buf[pos];
+
+        if (major == CBOR_BYTES || major == CBOR_TEXT)
+        {
+            if (value > len - pos)
+            {
+                return NRF_ERROR_INVALID_DATA;
+            }
+
+            pos += value;
+        }
+        else if (major != CBOR_UINT && major != CBOR_NINT)
+        {
+            return NRF_ERROR_NOT_SUPPORTED;
+        }
+
+        switch (key)
+        {
+        case KEY_NAME:
+        case KEY_DATA:
+            if (major != CBOR_BYTES || value > (key == KEY_NAME ? NAME_MAX : DATA_MAX))
+            {
+                return NRF_ERROR_INVALID_DATA;
+            }
+
+            if (key == KEY_NAME)
+            {
+                p_view->p_name = p_bytes;
+                p_view->name_len = value;
+            }
+            else
+            {
+                p_view->p_data = p_bytes;
+                p_view->data_len = value;
+            }
+            break;
+        case KEY_PERIPHERAL_ADDR:
+        case KEY_CENTRAL_ADDR:
+            if (major != CBOR_BYTES || value != ADDR_LEN)
+            {
+                return NRF_ERROR_INVALID_DATA;
+            }
+
+            if (key == KEY_PERIPHERAL_ADDR)
+                p_view->p_peripheral_addr = p_bytes;
+            else
+                p_view->p_central_addr = p_bytes;
+
+            p_view->fields |= 1 << (key - KEY_PERIPHERAL_ADDR);
+            break;
+        case KEY_PERIPHERAL_RSSI:
+        case KEY_CENTRAL_RSSI:
+        {
+            if ((major != CBOR_UINT && major != CBOR_NINT) || value > INT8_MAX + (major == CBOR_NINT))
+            {
+                return NRF_ERROR_INVALID_DATA;
+            }
+
+            int8_t rssi = major == CBOR_NINT ? (int8_t)(-1 - (int32_t)value) : (int8_t)value;
+
+            if (key == KEY_PERIPHERAL_RSSI)
+                p_view->peripheral_rssi = rssi;
+            else
+                p_view->central_rssi = rssi;
+
+            p_view->fields |= 1 << (key - KEY_PERIPHERAL_ADDR);
+        }
+        break;
+        default:
+            // Newer fields are skipped
+            break;
+        }
+    }
+
+    if (p_view->p_name == NULL || p_view->p_data == NULL)
+    {
+        return NRF_ERROR_INVALID_DATA;
+    }
+
+    return NRF_SUCCESS;
+}
+
+void codec_fast_view_to_event(codec_fast_view_t const *p_view, pyrinas_event_t *p_event)
+{
+    memset(p_event, 0, sizeof(pyrinas_event_t));
+
+    p_event->name.size = p_view->name_len;
+    memcpy(p_event->name.bytes, p_view->p_name, p_view->name_len);
+    p_event->data.size = p_view->data_len;
+    memcpy(p_event->data.bytes, p_view->p_data, p_view->data_len);
+
+    if (p_view->p_peripheral_addr != NULL)
+        memcpy(p_event->peripheral_addr, p_view->p_peripheral_addr, ADDR_LEN);
+
+    if (p_view->p_central_addr != NULL)
+        memcpy(p_event->central_addr, p_view->p_central_addr, ADDR_LEN);
+
+    p_event->peripheral_rssi = p_view->peripheral_rssi;
+    p_event->central_rssi = p_view->central_rssi;
+}
+
+/**@brief Function for encoding the name, the data and the given fields of a view.
+ *
+ * @return Bytes written. 0 if p_out is too small.
+ */
+static size_t view_encode(codec_fast_view_t const *p_view, uint8_t fields, uint8_t *p_out, size_t size)
+{
+    uint8_t count = 2;
+
+    if (2 * HEAD_MAX + 3 + p_view->name_len + p_view->data_len + TAIL_MAX > size)
+    {
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        count += (fields >> i) & 1;
+    }
+
+    size_t len = 0;
+
+    p_out[len++] = CBOR_MAP | count;
+    p_out[len++] = KEY_NAME;
+    len += cbor_bytes(&p_out[len], p_view->p_name, p_view->name_len);
+    p_out[len++] = KEY_DATA;
+    len += cbor_bytes(&p_out[len], p_view->p_data, p_view->data_len);
+
+    if (fields & CODEC_FAST_FIELD_PERIPHERAL_ADDR)
+    {
+        p_out[len++] = KEY_PERIPHERAL_ADDR;
+        len += cbor_bytes(&p_out[len], p_view->p_peripheral_addr, ADDR_LEN);
+    }
+
+    if (fields & CODEC_FAST_FIELD_CENTRAL_ADDR)
+    {
+        p_out[len++] = KEY_CENTRAL_ADDR;
+        len += cbor_bytes(&p_out[len], p_view->p_central_addr, ADDR_LEN);
+    }
+
+    if (fields & CODEC_FAST_FIELD_PERIPHERAL_RSSI)
+    {
+        p_out[len++] = KEY_PERIPHERAL_RSSI;
+        len += cbor_int(&p_out[len], p_view->peripheral_rssi);
+    }
+
+    if (fields & CODEC_FAST_FIELD_CENTRAL_RSSI)
+    {
+        p_out[len++] = KEY_CENTRAL_RSSI;
+        len += cbor_int(&p_out[len], p_view->central_rssi);
+    }
+
+    return len;
+}
+
+ret_code_t codec_fast_hdr_compress(codec_fast_hdr_t *p_hdr, uint8_t const *p_in, size_t len,
+                                   uint8_t *p_out, size_t size, size_t *p_len)
+{
+    codec_fast_view_t view;
+
+    if (codec_fast_view_decode(p_in, len, &view) != NRF_SUCCESS || view.fields != CODEC_FAST_FIELDS_ALL)
+    {
+        return NRF_ERROR_NOT_SUPPORTED;
+    }
+
+    uint8_t fields = CODEC_FAST_FIELDS_ALL;
+
+    // Only what changed since the last frame
+    if (p_hdr->valid && p_hdr->frames < CODEC_FAST_HDR_REFRESH)
+    {
+        fields = 0;
+
+        if (memcmp(p_hdr->peripheral_addr, view.p_peripheral_addr, ADDR_LEN) != 0)
+            fields |= CODEC_FAST_FIELD_PERIPHERAL_ADDR;
+
+        if (memcmp(p_hdr->central_addr, view.p_central_addr, ADDR_LEN) != 0)
+            fields |= CODEC_FAST_FIELD_CENTRAL_ADDR;
+
+        if (p_hdr->peripheral_rssi != view.peripheral_rssi)
+            fields |= CODEC_FAST_FIELD_PERIPHERAL_RSSI;
+
+        if (p_hdr->central_rssi != view.central_rssi)
+            fields |= CODEC_FAST_FIELD_CENTRAL_RSSI;
+    }
+
+    if (size < CODEC_FAST_HDR_SIZE)
+    {
+        return NRF_ERROR_NO_MEM;
+    }
+
+    p_out[0] = CODEC_FAST_HDR_MARKER;
+    p_out[1] = p_hdr->seq + 1;
+
+    size_t out_len = view_encode(&view, fields, &p_out[CODEC_FAST_HDR_SIZE], size - CODEC_FAST_HDR_SIZE);
+    if (out_len == 0)
+    {
+        return NRF_ERROR_NO_MEM;
+    }
+
+    *p_len = CODEC_FAST_HDR_SIZE + out_len;
+
+    memcpy(p_hdr->peripheral_addr, view.p_peripheral_addr, ADDR_LEN);
+    memcpy(p_hdr->central_addr, view.p_central_addr, ADDR_LEN);
+    p_hdr->peripheral_rssi = view.peripheral_rssi;
+    p_hdr->central_rssi = view.central_rssi;
+    p_hdr->frames = fields == CODEC_FAST_FIELDS_ALL ? 0 : p_hdr->frames + 1;
+    p_hdr->seq++;
+    p_hdr->valid = true;
+
+    return NRF_SUCCESS;
+}
+
+ret_code_t codec_fast_hdr_expand(codec_fast_hdr_t *p_hdr, uint8_t const *p_in, size_t len,
+                                 uint8_t *p_out, size_t size, size_t *p_len)
+{
+    codec_fast_view_t view;
+
+    if (!codec_fast_hdr_is_compressed(p_in, len) ||
+        codec_fast_view_decode(&p_in[CODEC_FAST_HDR_SIZE], len - CODEC_FAST_HDR_SIZE, &view) != NRF_SUCCESS)
+    {
+        return NRF_ERROR_INVALID_DATA;
+    }
+
+    uint8_t seq = p_in[1];
+
+    // A missing frame may have carried a change this one leaves out
+    if (seq != (uint8_t)(p_hdr->seq + 1))
+    {
+        p_hdr->valid = false;
+    }
+
+    p_hdr->seq = seq;
+
+    if (view.fields != CODEC_FAST_FIELDS_ALL && !p_hdr->valid)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    // Take what came, keep the rest
+    if (view.fields & CODEC_FAST_FIELD_PERIPHERAL_ADDR)
+        memcpy(p_hdr->peripheral_addr, view.p_peripheral_addr, ADDR_LEN);
+
+    if (view.fields & CODEC_FAST_FIELD_CENTRAL_ADDR)
+        memcpy(p_hdr->central_addr, view.p_central_addr, ADDR_LEN);
+
+    if (view.fields & CODEC_FAST_FIELD_PERIPHERAL_RSSI)
+        p_hdr->peripheral_rssi = view.peripheral_rssi;
+
+    if (view.fields & CODEC_FAST_FIELD_CENTRAL_RSSI)
+        p_hdr->central_rssi = view.central_rssi;
+
+    p_hdr->valid = true;
+
+    view.p_peripheral_addr = p_hdr->peripheral_addr;
+    view.p_central_addr = p_hdr->central_addr;
+    view.peripheral_rssi = p_hdr->peripheral_rssi;
+    view.central_rssi = p_hdr->central_rssi;
+
+    *p_len = view_encode(&view, CODEC_FAST_FIELDS_ALL, p_out, size);
+
+    return *p_len > 0 ? NRF_SUCCESS : NRF_ERROR_NO_MEM;
+}
+
+/**@brief Function for finding the template of a topic.
+ */
+static template_t *template_find(pyrinas_event_name_data_t const *p_name)
+{
+    for (int i = 0; i < CODEC_FAST_TEMPLATES; i++)
+    {
+        template_t *p_tpl = &m_templates[i];
+
+        if (p_tpl->len > 0 && p_tpl->name_len == p_name->size &&
+            memcmp(&p_tpl->bytes[p_tpl->name_offset], p_name->bytes, p_name->size) == 0)
+        {
+            return p_tpl;
+        }
+    }
+
+    return NULL;
+}
+
+/**@brief Function for writing the map head, the name and the key of the data.
+ *
+ * @return Bytes written. At most TEMPLATE_SIZE.
+ */
+static size_t head_write(uint8_t *p_out, uint8_t const *p_name, uint16_t name_len)
+{
+    size_t len = 0;
+
+    p_out[len++] = CBOR_MAP | KEY_COUNT;
+    p_out[len++] = KEY_NAME;
+    len += cbor_bytes(&p_out[len], p_name, name_len);
+    p_out[len++] = KEY_DATA;
+
+    return len;
+}
+
+/**@brief Function for writing everything after the data.
+ *
+ * @return Bytes written. At most TAIL_MAX.
+ */
+static size_t tail_write(uint8_t *p_out, uint8_t const *p_peripheral_addr, uint8_t const *p_central_addr,
+                         int8_t peripheral_rssi, int8_t central_rssi)
+{
+    size_t len = 0;
+
+    p_out[len++] = KEY_PERIPHERAL_ADDR;
+    len += cbor_bytes(&p_out[len], p_peripheral_addr, ADDR_LEN);
+    p_out[len++] = KEY_CENTRAL_ADDR;
+    len += cbor_bytes(&p_out[len], p_central_addr, ADDR_LEN);
+    p_out[len++] = KEY_PERIPHERAL_RSSI;
+    len += cbor_int(&p_out[len], peripheral_rssi);
+    p_out[len++] = KEY_CENTRAL_RSSI;
+    len += cbor_int(&p_out[len], central_rssi);
+
+    return len;
+}
+
+/**@brief Function for building the template of a topic in the next slot.
+ */
+static template_t *template_build(pyrinas_event_name_data_t const *p_name)
+{
+    template_t *p_tpl = &m_templates[m_next];
+    m_next = (m_next + 1) % CODEC_FAST_TEMPLATES;
+
+    p_tpl->len = head_write(p_tpl->bytes, p_name->bytes, p_name->size);
+    p_tpl->name_offset = p_tpl->len - 1 - p_name->size;
+    p_tpl->name_len = p_name->size;
+    p_tpl->generic = false;
+
+    m_stats.templates++;
+
+    return p_tpl;
+}
+
+/**@brief Function for encoding from a template.
+ */
+static size_t template_encode(template_t const *p_tpl, pyrinas_event_t const *p_event, uint8_t *p_out)
+{
+    size_t len = p_tpl->len;
+
+    memcpy(p_out, p_tpl->bytes, len);
+
+    len += cbor_bytes(&p_out[len], p_event->data.bytes, p_event->data.size);
+    len += tail_write(&p_out[len], p_event->peripheral_addr, p_event->central_addr,
+                      p_event->peripheral_rssi, p_event->central_rssi);
+
+    return len;
+}
+
+size_t codec_fast_head_encode(uint8_t const *p_name, size_t name_len, uint8_t *p_out, size_t size)
+{
+    if (name_len > NAME_MAX || 1 + 1 + HEAD_MAX + name_len + 1 > size)
+    {
+        return 0;
+    }
+
+    return head_write(p_out, p_name, name_len);
+}
+
+size_t codec_fast_tail_encode(uint8_t const *p_peripheral_addr, uint8_t const *p_central_addr,
+                              uint8_t *p_out, size_t size)
+{
+    if (TAIL_MAX > size)
+    {
+        return 0;
+    }
+
+    return tail_write(p_out, p_peripheral_addr, p_central_addr, 0, 0);
+}
+
+/**@brief Function for encoding with pyrinas_codec_encode() and timing it.
+ */
+static ret_code_t generic_encode(pyrinas_event_t *p_event, uint8_t *p_out, size_t size, size_t *p_len)
+{
+    uint32_t begin = util_cycles_get();
+
+    int err = pyrinas_codec_encode(p_event, p_out, size, p_len);
+
+    util_cycles_stats_add(&m_stats.generic_cycles, begin);
+    m_stats.generic++;
+
+    return err ? NRF_ERROR_INTERNAL : NRF_SUCCESS;
+}
+
+ret_code_t codec_fast_encode(pyrinas_event_t *p_event, uint8_t *p_out, size_t size, size_t *p_len)
+{
+    if (p_event->name.size > NAME_MAX || p_event->data.size > UINT16_MAX)
+    {
+        return generic_encode(p_event, p_out, size, p_len);
+    }
+
+    template_t *p_tpl = template_find(&p_event->name);
+    bool verify = false;
+
+    if (p_tpl == NULL)
+    {
+        p_tpl = template_build(&p_event->name);
+        verify = true;
+    }
+
+    if (p_tpl->generic)
+    {
+        return generic_encode(p_event, p_out, size, p_len);
+    }
+
+    if (p_tpl->len + HEAD_MAX + p_event->data.size + TAIL_MAX > size)
+    {
+        return NRF_ERROR_NO_MEM;
+    }
+
+    uint32_t begin = util_cycles_get();
+
+    *p_len = template_encode(p_tpl, p_event, p_out);
+
+    util_cycles_stats_add(&m_stats.fast_cycles, begin);
+    m_stats.fast++;
+
+    if (!verify)
+    {
+        return NRF_SUCCESS;
+    }
+
+    // First event of the topic. Both have to agree byte for byte.
+    static uint8_t check[sizeof(pyrinas_event_t)];
+    size_t check_len;
+
+    ret_code_t err_code = generic_encode(p_event, check, sizeof(check), &check_len);
+    if (err_code != NRF_SUCCESS)
+    {
+        return err_code;
+    }
+
+    if (check_len != *p_len || memcmp(check, p_out, check_len) != 0)
+    {
+        NRF_LOG_WARNING("Template of %d byte topic differs. Using the generic encoder.", p_event->name.size);
+
+        p_tpl->generic = true;
+        m_stats.mismatches++;
+
+        if (check_len > size)
+        {
+            return NRF_ERROR_NO_MEM;
+        }
+
+        memcpy(p_out, check, check_len);
+        *p_len = check_len;
+    }
+
+    return NRF_SUCCESS;
+}
+
+ret_code_t codec_fast_benchmark(pyrinas_event_t *p_event, uint32_t runs)
+{
+    static uint8_t fast[sizeof(pyrinas_event_t)];
+    static uint8_t generic[sizeof(pyrinas_event_t)];
+    size_t fast_len = 0;
+    size_t generic_len = 0;
+
+    for (uint32_t i = 0; i < runs; i++)
+    {
+        if (generic_encode(p_event, generic, sizeof(generic), &generic_len) != NRF_SUCCESS ||
+            codec_fast_encode(p_event, fast, sizeof(fast), &fast_len) != NRF_SUCCESS)
+        {
+            return NRF_ERROR_INTERNAL;
+        }
+    }
+
+    if (fast_len != generic_len || memcmp(fast, generic, fast_len) != 0)
+    {
+        return NRF_ERROR_INTERNAL;
+    }
+
+    NRF_LOG_INFO("Encode %d bytes: fast %d cycles, generic %d cycles",
+                 fast_len, m_stats.fast_cycles.last, m_stats.generic_cycles.last);
+
+    return NRF_SUCCESS;
+}
+
+void codec_fast_reset(void)
+{
+    memset(m_templates, 0, sizeof(m_templates));
+    m_next = 0;
+}
+
+void codec_fast_stats_get(codec_fast_stats_t *p_stats)
+{
+    *p_stats = m_stats;
+}
@@ -0,0 +1,359 @@
+/**
+ *
+ * Copyright (c) 2020, Jared Wolff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+
+#include "codec_value.h"
+
+// CBOR major types and simple values
+#define CBOR_UINT 0x00
+#define CBOR_NINT 0x20
+#define CBOR_BYTES 0x40
+#define CBOR_TEXT 0x60
+#define CBOR_ARRAY 0x80
+#define CBOR_FLOAT32 0xfa
+#define CBOR_FLOAT64 0xfb
+#define CBOR_MAJOR_MASK 0xe0
+#define CBOR_INFO_MASK 0x1f
+
+#define HEAD_MAX 5  /**< Head with a 32 bit argument. */
+#define FLOAT_SIZE 5 /**< Head and 4 bytes. */
+
+/**@brief Function for writing the head of a CBOR item in its shortest form.
+ *
+ * @return Bytes written.
+ */
+static size_t head_write(uint8_t *p_out, uint8_t major, uint32_t value)
+{
+    if (value < 24)
+    {
+        p_out[0] = major | value;
+        return 1;
+    }
+
+    uint8_t info = value <= UINT8_MAX ? 24 : value <= UINT16_MAX ? 25 : 26;
+    size_t size = 1 << (info - 24);
+
+    p_out[0] = major | info;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        p_out[size - i] = value >> (8 * i);
+    }
+
+    return 1 + size;
+}
+
+/**@brief Function for reading the head of a CBOR item. Up to 32 bit arguments.
+ *
+ * @return Bytes read. 0 if truncated or not supported.
+ */
+static size_t head_read(uint8_t const *p_in, size_t len, uint8_t *p_major, uint32_t *p_value)
+{
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    uint8_t info = p_in[0] & CBOR_INFO_MASK;
+
+    *p_major = p_in[0] & CBOR_MAJOR_MASK;
+
+    if (info < 24)
+    {
+        *p_value = info;
+        return 1;
+    }
+
+    if (info > 26)
+    {
+        return 0;
+    }
+
+    size_t size = 1 << (info - 24);
+
+    if (len < 1 + size)
+    {
+        return 0;
+    }
+
+    *p_value = 0;
+    for (size_t i = 1; i <= size; i++)
+    {
+        *p_value = (*p_value << 8) | p_in[i];
+    }
+
+    return 1 + size;
+}
+
+static size_t int_write(uint8_t *p_out, int32_t value)
+{
+    if (value < 0)
+    {
+        return head_write(p_out, CBOR_NINT, (uint32_t)(-1 - value));
+    }
+
+    return head_write(p_out, CBOR_UINT, value);
+}
+
+static size_t float_write(uint8_t *p_out, float value)
+{
+    uint32_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    p_out[0] = CBOR_FLOAT32;
+    p_out[1] = bits >> 24;
+    p_out[2] = bits >> 16;
+    p_out[3] = bits >> 8;
+    p_out[4] = bits;
+
+    return FLOAT_SIZE;
+}
+
+/**@brief Function for reading an integer or a float.
+ *
+ * @return Bytes read. 0 if it is something else or does not fit.
+ */
+static size_t number_read(uint8_t const *p_in, size_t len, bool *p_is_float, int32_t *p_integer, float *p_real)
+{
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    if (p_in[0] == CBOR_FLOAT32 || p_in[0] == CBOR_FLOAT64)
+    {
+        size_t size = p_in[0] == CBOR_FLOAT32 ? 4 : 8;
+        uint64_t bits = 0;
+
+        if (len < 1 + size)
+        {
+            return 0;
+        }
+
+        for (size_t i = 1; i <= size; i++)
+        {
+            bits = (bits << 8) | p_in[i];
+        }
+
+        if (size == 4)
+        {
+            uint32_t bits32 = bits;
+            memcpy(p_real, &bits32, sizeof(float));
+        }
+        else
+        {
+            double real;
+            memcpy(&real, &bits, sizeof(double));
+            *p_real = real;
+        }
+
+        *p_is_float = true;
+        return 1 + size;
+    }
+
+    uint8_t major;
+    uint32_t value;
+    size_t head = head_read(p_in, len, &major, &value);
+
+    if (head == 0 || (major != CBOR_UINT && major != CBOR_NINT) || value > INT32_MAX)
+    {
+        return 0;
+    }
+
+    *p_integer = major == CBOR_NINT ? -1 - (int32_t)value : (int32_t)value;
+    *p_is_float = false;
+
+    return head;
+}
+
+ret_code_t codec_value_encode(codec_value_t const *p_value, uint8_t *p_out, size_t size, size_t *p_len)
+{
+    size_t max;
+
+    // Worst case first, so the writes below need no checks
+    switch (p_value->type)
+    {
+    case CODEC_VALUE_INT:
+    case CODEC_VALUE_FLOAT:
+        max = HEAD_MAX;
+        break;
+    case CODEC_VALUE_BYTES:
+        max = HEAD_MAX + p_value->bytes.len;
+        break;
+    case CODEC_VALUE_INT_ARRAY:
+    case CODEC_VALUE_FLOAT_ARRAY:
+        if (p_value->array.count > CODEC_VALUE_ARRAY_MAX)
+        {
+            return NRF_ERROR_INVALID_PARAM;
+        }
+
+        max = 1 + p_value->array.count * HEAD_MAX;
+        break;
+    default:
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    if (1 + max > size)
+    {
+        return NRF_ERROR_NO_MEM;
+    }
+
+    size_t len = 0;
+
+    p_out[len++] = CODEC_VALUE_MARKER;
+
+    switch (p_value->type)
+    {
+    case CODEC_VALUE_INT:
+        len += int_write(&p_out[len], p_value->integer);
+        break;
+    case CODEC_VALUE_FLOAT:
+        len += float_write(&p_out[len], p_value->real);
+        break;
+    case CODEC_VALUE_BYTES:
+        len += head_write(&p_out[len], CBOR_BYTES, p_value->bytes.len);
+        memcpy(&p_out[len], p_value->bytes.p_data, p_value->bytes.len);
+        len += p_value->bytes.len;
+        break;
+    case CODEC_VALUE_INT_ARRAY:
+        len += head_write(&p_out[len], CBOR_ARRAY, p_value->array.count);
+        for (uint8_t i = 0; i < p_value->array.count; i++)
+        {
+            len += int_write(&p_out[len], p_value->array.integers[i]);
+        }
+        break;
+    case CODEC_VALUE_FLOAT_ARRAY:
+        len += head_write(&p_out[len], CBOR_ARRAY, p_value->array.count);
+        for (uint8_t i = 0; i < p_value->array.count; i++)
+        {
+            len += float_write(&p_out[len], p_value->array.reals[i]);
+        }
+        break;
+    default:
+        break;
+    }
+
+    *p_len = len;
+
+    return NRF_SUCCESS;
+}
+
+ret_code_t codec_value_decode(uint8_t const *p_data, size_t len, codec_value_t *p_value)
+{
+    memset(p_value, 0, sizeof(codec_value_t));
+
+    if (!codec_value_is_typed(p_data, len))
+    {
+        p_value->type = CODEC_VALUE_TEXT;
+        p_value->bytes.p_data = p_data;
+        p_value->bytes.len = len;
+        return NRF_SUCCESS;
+    }
+
+    // Skip the marker
+    p_data++;
+    len--;
+
+    bool is_float;
+    size_t used = number_read(p_data, len, &is_float, &p_value->integer, &p_value->real);
+
+    if (used > 0)
+    {
+        p_value->type = is_float ? CODEC_VALUE_FLOAT : CODEC_VALUE_INT;
+        return used == len ? NRF_SUCCESS : NRF_ERROR_INVALID_DATA;
+    }
+
+    uint8_t major;
+    uint32_t value;
+    size_t pos = head_read(p_data, len, &major, &value);
+
+    if (pos == 0)
+    {
+        return NRF_ERROR_INVALID_DATA;
+    }
+
+    if (major == CBOR_BYTES || major == CBOR_TEXT)
+    {
+        if (value != len - pos)
+        {
+            return NRF_ERROR_INVALID_DATA;
+        }
+
+        p_value->type = major == CBOR_BYTES ? CODEC_VALUE_BYTES : CODEC_VALUE_TEXT;
+        p_value->bytes.p_data = &p_data[pos];
+        p_value->bytes.len = value;
+        return NRF_SUCCESS;
+    }
+
+    if (major != CBOR_ARRAY || value > CODEC_VALUE_ARRAY_MAX)
+    {
+        return NRF_ERROR_INVALID_DATA;
+    }
+
+    // Integers unless the first item says otherwise. No mixing.
+    p_value->type = CODEC_VALUE_INT_ARRAY;
+    p_value->array.count = value;
+
+    for (uint32_t i = 0; i < value; i++)
+    {
+        int32_t integer;
+        float real;
+
+        used = number_read(&p_data[pos], len - pos, &is_float, &integer, &real);
+
+        if (used == 0)
+        {
+            return NRF_ERROR_INVALID_DATA;
+        }
+
+        if (i == 0 && is_float)
+        {
+            p_value->type = CODEC_VALUE_FLOAT_ARRAY;
+        }
+
+        if (is_float != (p_value->type == CODEC_VALUE_FLOAT_ARRAY))
+        {
+            return NRF_ERROR_INVALID_DATA;
+        }
+
+        if (is_float)
+            p_value->array.reals[i] = real;
+        else
+            p_value->array.integers[i] = integer;
+
+        pos += used;
+    }
+
+    return pos == len ? NRF_SUCCESS : NRF_ERROR_INVALID_DATA;
+}
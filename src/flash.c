@@ -33,38 +33,218 @@
 #include "flash.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "nrfx_qspi.h"
 
 #include "app_error.h"
+#include "app_util.h"
+#include "app_util_platform.h"
 #include "boards.h"
+#include "nrf_queue.h"
+#include "sdk_macros.h"
+
+#ifdef SOFTDEVICE_PRESENT
+#include "nrf_sdh.h"
+#endif
 
 #define NRF_LOG_MODULE_NAME flash
 #include "nrf_log.h"
 #include "nrf_log_ctrl.h"
 NRF_LOG_MODULE_REGISTER();
 
-volatile bool m_finished = false;
-
 #define QSPI_TEST_DATA_SIZE 256
 
-static uint8_t m_buffer_tx[QSPI_TEST_DATA_SIZE];
-static uint8_t m_buffer_rx[QSPI_TEST_DATA_SIZE];
+// Bounce buffers for littlefs, whose buffers need not be word aligned
+static uint8_t m_buffer_tx[QSPI_TEST_DATA_SIZE] __ALIGN(4);
+static uint8_t m_buffer_rx[QSPI_TEST_DATA_SIZE] __ALIGN(4);
+
+typedef struct
+{
+    flash_evt_t evt;
+    flash_evt_handler_t handler;
+    bool sync; /**< Completes into m_sync_done instead of m_flash_done. */
+} flash_req_t;
+
+// One more than FLASH_QUEUE_SIZE for the synchronous request
+NRF_QUEUE_DEF(flash_req_t, m_flash_pending, FLASH_QUEUE_SIZE + 1, NRF_QUEUE_MODE_NO_OVERFLOW);
+NRF_QUEUE_DEF(flash_req_t, m_flash_done, FLASH_QUEUE_SIZE, NRF_QUEUE_MODE_NO_OVERFLOW);
+
+static flash_req_t m_active;    /**< Request the QSPI is working on. */
+static volatile bool m_busy;    /**< m_active is under way. */
+static uint8_t m_outstanding;   /**< Asynchronous requests not handed back yet. */
+
+static volatile bool m_sync_done;
+static volatile ret_code_t m_sync_result;
+
+static ret_code_t req_start(flash_req_t const *p_req)
+{
+    switch (p_req->evt.op)
+    {
+    case FLASH_OP_READ:
+        return nrfx_qspi_read(p_req->evt.p_data, p_req->evt.size, p_req->evt.addr);
+    case FLASH_OP_PROG:
+        return nrfx_qspi_write(p_req->evt.p_data, p_req->evt.size, p_req->evt.addr);
+    case FLASH_OP_ERASE:
+        return nrfx_qspi_erase(NRF_QSPI_ERASE_LEN_4KB, p_req->evt.addr);
+    default:
+        return NRF_ERROR_INVALID_PARAM;
+    }
+}
 
-#define WAIT_FOR_PERIPH()   \
-    do                      \
-    {                       \
-        while (!m_finished) \
-        {                   \
-        }                   \
-        m_finished = false; \
-    } while (0)
+static void req_complete(flash_req_t *p_req, ret_code_t result)
+{
+    p_req->evt.result = result;
+
+    if (p_req->sync)
+    {
+        m_sync_result = result;
+        m_sync_done = true;
+        return;
+    }
+
+    // Can't overflow, m_outstanding is limited to its size
+    ret_code_t err_code = nrf_queue_push(&m_flash_done, p_req);
+    APP_ERROR_CHECK(err_code);
+}
+
+/**@brief Function for starting the next queued request if the QSPI is idle.
+ *
+ * @details Runs with the QSPI interrupt blocked, from it or in a critical region.
+ */
+static void queue_run(void)
+{
+    while (!m_busy && nrf_queue_pop(&m_flash_pending, &m_active) == NRF_SUCCESS)
+    {
+        ret_code_t err_code = req_start(&m_active);
+
+        if (err_code == NRF_SUCCESS)
+        {
+            m_busy = true;
+        }
+        else
+        {
+            NRF_LOG_WARNING("Unable to start flash op %d. Err: 0x%x", m_active.evt.op, err_code);
+            req_complete(&m_active, err_code);
+        }
+    }
+}
 
 static void qspi_handler(nrfx_qspi_evt_t event, void *p_context)
 {
     UNUSED_PARAMETER(event);
     UNUSED_PARAMETER(p_context);
-    m_finished = true;
+
+    m_busy = false;
+    req_complete(&m_active, NRF_SUCCESS);
+
+    // Start the next one straight away
+    queue_run();
+}
+
+static ret_code_t req_submit(flash_req_t const *p_req)
+{
+    ret_code_t err_code;
+
+    CRITICAL_REGION_ENTER();
+
+    if (!p_req->sync && m_outstanding >= FLASH_QUEUE_SIZE)
+    {
+        err_code = NRF_ERROR_NO_MEM;
+    }
+    else
+    {
+        err_code = nrf_queue_push(&m_flash_pending, p_req);
+
+        if (err_code == NRF_SUCCESS)
+        {
+            if (!p_req->sync)
+            {
+                m_outstanding++;
+            }
+
+            queue_run();
+        }
+    }
+
+    CRITICAL_REGION_EXIT();
+
+    return err_code;
+}
+
+static ret_code_t req_check(void const *p_data, uint32_t size)
+{
+    if (!nrfx_is_in_ram(p_data) || !nrfx_is_word_aligned(p_data))
+    {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+
+    if (size == 0 || (size % 4) != 0)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    return NRF_SUCCESS;
+}
+
+static ret_code_t req_async(flash_op_t op, uint32_t addr, void *p_data, uint32_t size,
+                            flash_evt_handler_t handler, void *p_context)
+{
+    flash_req_t req = {
+        .evt = {
+            .op = op,
+            .addr = addr,
+            .p_data = p_data,
+            .size = size,
+            .p_context = p_context,
+        },
+        .handler = handler,
+        .sync = false,
+    };
+
+    return req_submit(&req);
+}
+
+/**@brief Function for sleeping until the synchronous request is done.
+ */
+static void sync_wait(void)
+{
+    while (!m_sync_done)
+    {
+#ifdef SOFTDEVICE_PRESENT
+        if (nrf_sdh_is_enabled())
+        {
+            ret_code_t err_code = sd_app_evt_wait();
+            APP_ERROR_CHECK(err_code);
+            continue;
+        }
+#endif
+        // Woken by the QSPI interrupt
+        __WFE();
+    }
+}
+
+/**@brief Function for running a request behind the queued ones and waiting for it.
+ */
+static void sync_run(flash_op_t op, uint32_t addr, void *p_data, uint32_t size)
+{
+    flash_req_t req = {
+        .evt = {
+            .op = op,
+            .addr = addr,
+            .p_data = p_data,
+            .size = size,
+        },
+        .sync = true,
+    };
+
+    m_sync_done = false;
+
+    ret_code_t err_code = req_submit(&req);
+    APP_ERROR_CHECK(err_code);
+
+    sync_wait();
+    APP_ERROR_CHECK(m_sync_result);
 }
 
 static int configure_memory()
@@ -116,27 +296,19 @@ static int wake()
 
 static int test()
 {
-
-    ret_code_t err_code;
-
     srand(0);
     for (int i = 0; i < QSPI_TEST_DATA_SIZE; ++i)
     {
         m_buffer_tx[i] = (uint8_t)rand();
     }
 
-    err_code = nrfx_qspi_erase(NRF_QSPI_ERASE_LEN_4KB, 0);
-    APP_ERROR_CHECK(err_code);
-    WAIT_FOR_PERIPH();
+    sync_run(FLASH_OP_ERASE, 0, NULL, FLASH_ERASE_SIZE);
     NRF_LOG_DEBUG("Process of erasing first block start");
 
-    err_code = nrfx_qspi_write(m_buffer_tx, QSPI_TEST_DATA_SIZE, 0);
-    APP_ERROR_CHECK(err_code);
-    WAIT_FOR_PERIPH();
+    sync_run(FLASH_OP_PROG, 0, m_buffer_tx, QSPI_TEST_DATA_SIZE);
     NRF_LOG_DEBUG("Process of writing data start");
 
-    err_code = nrfx_qspi_read(m_buffer_rx, QSPI_TEST_DATA_SIZE, 0);
-    WAIT_FOR_PERIPH();
+    sync_run(FLASH_OP_READ, 0, m_buffer_rx, QSPI_TEST_DATA_SIZE);
     NRF_LOG_DEBUG("Data read");
 
     NRF_LOG_DEBUG("Compare...");
@@ -203,11 +375,59 @@ void flash_init()
     UNUSED_VARIABLE(test);
 }
 
-// TODO: handling reading and writing > buffer size
-int flash_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size)
+ret_code_t flash_read_async(uint32_t addr, void *p_data, uint32_t size,
+                            flash_evt_handler_t handler, void *p_context)
 {
-    ret_code_t err_code;
+    ret_code_t err_code = req_check(p_data, size);
+    VERIFY_SUCCESS(err_code);
+
+    return req_async(FLASH_OP_READ, addr, p_data, size, handler, p_context);
+}
+
+ret_code_t flash_prog_async(uint32_t addr, void const *p_data, uint32_t size,
+                            flash_evt_handler_t handler, void *p_context)
+{
+    ret_code_t err_code = req_check(p_data, size);
+    VERIFY_SUCCESS(err_code);
+
+    return req_async(FLASH_OP_PROG, addr, (void *)p_data, size, handler, p_context);
+}
+
+ret_code_t flash_erase_async(uint32_t addr, flash_evt_handler_t handler, void *p_context)
+{
+    if ((addr % FLASH_ERASE_SIZE) != 0)
+    {
+        return NRF_ERROR_INVALID_ADDR;
+    }
 
+    return req_async(FLASH_OP_ERASE, addr, NULL, FLASH_ERASE_SIZE, handler, p_context);
+}
+
+bool flash_busy(void)
+{
+    return m_busy || !nrf_queue_is_empty(&m_flash_pending);
+}
+
+void flash_process(void)
+{
+    flash_req_t req;
+
+    while (nrf_queue_pop(&m_flash_done, &req) == NRF_SUCCESS)
+    {
+        // Free the slot first so the handler can queue the next request
+        CRITICAL_REGION_ENTER();
+        m_outstanding--;
+        CRITICAL_REGION_EXIT();
+
+        if (req.handler != NULL)
+        {
+            req.handler(&req.evt);
+        }
+    }
+}
+
+int flash_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size)
+{
     // Calculate the  max size/address that is accessible
     const uint32_t max_size = c->block_count * c->block_size;
 
@@ -221,27 +441,24 @@ int flash_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, voi
     // Calculate the memory address by multiplying the blocks and adding the offset.
     uint32_t addr = block * c->block_size + off;
 
-    // Clear the read buffer before use.
-    memset(m_buffer_rx, 0, sizeof(m_buffer_rx));
-    // Read the data
-    err_code = nrfx_qspi_read(m_buffer_rx, size, addr);
-    APP_ERROR_CHECK(err_code);
+    // Read through the bounce buffer, a chunk at a time
+    for (lfs_size_t done = 0; done < size;)
+    {
+        uint32_t chunk = MIN(size - done, sizeof(m_buffer_rx));
 
-    // TODO: kill this.
-    WAIT_FOR_PERIPH();
+        // The QSPI moves whole words
+        sync_run(FLASH_OP_READ, addr + done, m_buffer_rx, ALIGN_NUM(4, chunk));
 
-    // Copy to outgoing buffer
-    memcpy((uint8_t *)buffer, m_buffer_rx, size);
+        // Copy to outgoing buffer
+        memcpy((uint8_t *)buffer + done, m_buffer_rx, chunk);
+        done += chunk;
+    }
 
     return 0;
 }
 
-// TODO: handling reading and writing > buffer size
 int flash_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size)
 {
-
-    ret_code_t err_code;
-
     NRF_LOG_DEBUG("flash write %d offset %d size %d", block, off, size);
 
     // Calculate the  max size/address that is accessible
@@ -257,25 +474,23 @@ int flash_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, con
     // Calculate the memory address by multiplying the blocks and adding the offset.
     uint32_t addr = block * c->block_size + off;
 
-    // Clean tx buffer, copy to tx buff
-    memset(m_buffer_tx, 0, sizeof(m_buffer_tx));
-    memcpy(m_buffer_tx, (const uint8_t *)buffer, size);
+    for (lfs_size_t done = 0; done < size;)
+    {
+        uint32_t chunk = MIN(size - done, sizeof(m_buffer_tx));
 
-    // Read the data
-    err_code = nrfx_qspi_write(m_buffer_tx, size, addr);
-    APP_ERROR_CHECK(err_code);
+        // Pad to a whole word with 0xff, which leaves the flash as it is
+        memset(m_buffer_tx, 0xff, sizeof(m_buffer_tx));
+        memcpy(m_buffer_tx, (const uint8_t *)buffer + done, chunk);
 
-    // TODO: kill this.
-    WAIT_FOR_PERIPH();
+        sync_run(FLASH_OP_PROG, addr + done, m_buffer_tx, ALIGN_NUM(4, chunk));
+        done += chunk;
+    }
 
     return 0;
 }
 
 int flash_erase(const struct lfs_config *c, lfs_block_t block)
 {
-
-    ret_code_t err_code;
-
     NRF_LOG_DEBUG("erase block %d", block);
 
     // Check to make sure the block is correct.
@@ -290,11 +505,7 @@ int flash_erase(const struct lfs_config *c, lfs_block_t block)
     NRF_LOG_DEBUG("erase block %d    %d", block, addr);
 
     // Erase at a certain address
-    err_code = nrfx_qspi_erase(NRF_QSPI_ERASE_LEN_4KB, addr);
-    APP_ERROR_CHECK(err_code);
-
-    // TODO: kill this.
-    WAIT_FOR_PERIPH();
+    sync_run(FLASH_OP_ERASE, addr, NULL, FLASH_ERASE_SIZE);
 
     return 0;
 }
@@ -302,4 +513,4 @@ int flash_erase(const struct lfs_config *c, lfs_block_t block)
 int flash_sync(const struct lfs_config *c)
 {
     return 0;
-}
\ No newline at end of file
+}
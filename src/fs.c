@@ -273,4 +273,97 @@ bool fs_file_exists(const char *filename)
         fs_check_error(err);
 
     return true;
-}
\ No newline at end of file
+}
+
+void fs_append(const char *filename, const void *data, size_t size)
+{
+    // Mount the fs
+    int err = lfs_mount(&lfs, &cfg);
+    if (err)
+        fs_check_error(err);
+
+    // Open the file at its end
+    err = lfs_file_opencfg(&lfs, &file, filename, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND, &file_cfg);
+    if (err)
+        fs_check_error(err);
+
+    // Write the data
+    err = lfs_file_write(&lfs, &file, data, size);
+    if (err)
+        fs_check_error(err);
+
+    // remember the storage is not updated until the file is closed successfully
+    err = lfs_file_close(&lfs, &file);
+    if (err)
+        fs_check_error(err);
+
+    // release any resources we were using
+    err = lfs_unmount(&lfs);
+    if (err)
+        fs_check_error(err);
+}
+
+void fs_read_at(const char *filename, size_t offset, void *data, size_t size, size_t *bytes_read)
+{
+    // Mount the fs
+    int err = lfs_mount(&lfs, &cfg);
+    if (err)
+        fs_check_error(err);
+
+    // Open the file for reading
+    err = lfs_file_opencfg(&lfs, &file, filename, LFS_O_RDONLY, &file_cfg);
+    if (err)
+        fs_check_error(err);
+
+    *bytes_read = 0;
+
+    // Skip to the offset
+    lfs_soff_t pos = lfs_file_seek(&lfs, &file, offset, LFS_SEEK_SET);
+    if (pos < 0)
+        fs_check_error(pos);
+
+    // Read the data
+    int ret = lfs_file_read(&lfs, &file, data, size);
+    if (ret > 0)
+    {
+        *bytes_read = ret;
+    }
+    else if (ret < 0)
+    {
+        fs_check_error(ret);
+    }
+
+    err = lfs_file_close(&lfs, &file);
+    if (err)
+        fs_check_error(err);
+
+    // release any resources we were using
+    err = lfs_unmount(&lfs);
+    if (err)
+        fs_check_error(err);
+}
+
+size_t fs_size(const char *filename)
+{
+    struct lfs_info info;
+    size_t size = 0;
+
+    // Mount the fs
+    int err = lfs_mount(&lfs, &cfg);
+    if (err)
+        fs_check_error(err);
+
+    // Missing files are empty
+    err = lfs_stat(&lfs, filename, &info);
+    if (err == 0)
+    {
+        size = info.size;
+    }
+
+    // release any resources we were using
+    err = lfs_unmount(&lfs);
+    if (err)
+        fs_check_error(err);
+
+    return size;
+}
@@ -36,6 +36,14 @@
 
 #include "nrf_log.h"
 
+void util_cycles_init(void)
+{
+    // Trace has to be on for the DWT to count
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
 // TODO: get this without SDH
 void util_print_device_address(bool with_delim)
 {